@@ -20,7 +20,10 @@
 #define VCDIFF_H
 
 #include "vcdiff/addrcache.h"
+#include "vcdiff/codetable.h"
+#include "vcdiff/hash.h"
 #include "vcdiff/state.h"
+#include "vcdiff/types.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -31,10 +34,62 @@
  *
  * If an instruction requires more space, it is split into smaller chunks.
  * Using a buffer with 1 byte size is possible but causes a lot of IO operations.
+ *
+ * With size 0, the buffer is left out of the context and must be provided by
+ * vcdiff_set_buffer(). This keeps contexts small if many of them are in use.
  */
 #define VCDIFF_BUFFER_SIZE (1024 * 1024)
 #endif
 
+/**
+ * @brief   Skip writes that wouldn't change the target
+ *
+ * Before writing, the target is read back into the upper half of the buffer
+ * and compared. Thus, chunks are half the buffer size. Equal data isn't
+ * written. The window erase is deferred to the first write that differs and
+ * only covers the rest of the window; windows that already match aren't
+ * erased at all. Thus, the target driver must keep the data in front of the
+ * given range. vcdiff_flash_t needs a stage buffer for this.
+ */
+#define VCDIFF_FLAG_WRITE_IF_DIFFERENT 0x1
+
+/**
+ * @brief   Source and target are the same device
+ *
+ * COPYs from the source to the very same offset in the target are skipped
+ * without any IO. Instead of erasing whole windows, only the ranges that
+ * are actually written are erased right before writing to them. Thus, the
+ * target driver must erase exactly the given range. vcdiff_flash_t does so
+ * with vcdiff_flash_set_alias() and a stage buffer.
+ */
+#define VCDIFF_FLAG_ALIAS 0x2
+
+/**
+ * @brief   Compare the target against the delta instead of writing
+ *
+ * Every instruction is decoded, but the target is only read and compared in
+ * chunks of half the buffer size. Nothing is erased, written or flushed.
+ * Decoding stops with an error at the first difference; its offset is
+ * stored in vcdiff_t::mismatch_offset.
+ */
+#define VCDIFF_FLAG_VERIFY 0x4
+
+/**
+ * @brief   Return code of vcdiff_apply_delta_budget() if the budget has been used up
+ *          or a driver isn't ready
+ */
+#define VCDIFF_YIELD 2
+
+/**
+ * @brief   Driver return code if the operation cannot be carried out right now
+ *
+ * The write operation of the target driver and read operations for COPYs may
+ * return this code, e.g. if a socket would block. The decoder stops with
+ * VCDIFF_YIELD and retries the very same operation on the next call. Outside
+ * the errno range to avoid clashes with drivers returning `-errno`.
+ */
+#define VCDIFF_AGAIN (-0x1000)
+
 /**
  * @brief   Signature for read operations
  *
@@ -45,7 +100,7 @@
  * @return     `>= 0` if data has been read successfully
  * @return     `< 0` if an error occured while reading
  */
-typedef int (*vcdiff_driver_read_t)(void *dev, uint8_t *dest, size_t offset, size_t len);
+typedef int (*vcdiff_driver_read_t)(void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len);
 
 /**
  * @brief   Signature for write operations
@@ -57,7 +112,7 @@ typedef int (*vcdiff_driver_read_t)(void *dev, uint8_t *dest, size_t offset, siz
  * @return     `>= 0` if data has been written successfully
  * @return     `< 0` if an error occured while writing
  */
-typedef int (*vcdiff_driver_write_t)(void *dev, uint8_t *src, size_t offset, size_t len);
+typedef int (*vcdiff_driver_write_t)(void *dev, uint8_t *src, vcdiff_off_t offset, size_t len);
 
 /**
  * @brief   Signature for flush operations
@@ -77,7 +132,7 @@ typedef int (*vcdiff_driver_flush_t)(void *dev);
  * @return     `>= 0` if data has been erased successfully
  * @return     `< 0` if an error occured while erasing
  */
-typedef int (*vcdiff_driver_erase_t)(void *dev, size_t offset, size_t len);
+typedef int (*vcdiff_driver_erase_t)(void *dev, vcdiff_off_t offset, vcdiff_off_t len);
 
 /**
  * @brief   Signature for logging callbacks
@@ -103,40 +158,61 @@ typedef struct {
  *
  * The context holds the state of the decoder. Since the decoders allows the incoming
  * delta file to be split into chunks of arbitrary size, no state is hold on the stack.
+ *
+ * Fields touched by every instruction come first and share a cache line, so feeding
+ * the delta in small chunks doesn't pull the debug fields or the buffer into the cache.
  */
 typedef struct {
-#if !defined(VCDIFF_NDEBUG)
-	const char *error_msg;                /**< Message of the last error */
-	vcdiff_log_t inst_log;                /**< Callback for instruction logging */
-	vcdiff_log_t state_log;               /**< Callback for state logging */
-#endif
+	/* hot: touched by every instruction */
+	uint16_t state;                       /**< Current decoder state */
+	uint8_t flags;                        /**< Decoder flags VCDIFF_FLAG_* */
+	uint8_t inst0;
+	uint8_t inst1;
+	uint8_t mode0;
+	uint8_t mode1;
+	uint8_t win_indicator;
+	size_t budget;                        /**< Target bytes left for the current call */
+	vcdiff_off_t size0;
+	vcdiff_off_t size1;
+	vcdiff_off_t addr0;
+	vcdiff_off_t addr1;
+	vcdiff_off_t win_window_pos;
+	const vcdiff_codetable_t *codetable; /**< Code table used to decode instructions */
 
+	/* warm: touched by ADD, RUN and COPY data and once per call */
+	size_t buffer_ptr;
+	vcdiff_off_t win_window_len;
+	uint8_t *buffer;                     /**< Buffer for ADD, RUN and COPY instructions */
+	size_t buffer_size;
+	vcdiff_off_t target_offset;
+	vcdiff_off_t delta_offset;            /**< Amount of delta bytes consumed so far */
 	const vcdiff_driver_t *source_driver; /**< Source driver defintion */
 	void *source_dev;                     /**< Context for source driver */
 	const vcdiff_driver_t *target_driver; /**< Target driver defintion */
 	void *target_dev;                     /**< Context for target driver */
+	vcdiff_off_t win_segment_len;
+	vcdiff_off_t win_segment_pos;
+	uint8_t win_erased;
+	uint8_t cache_near_size;             /**< Near cache size belonging to the code table */
+	uint8_t cache_same_size;             /**< Same cache size belonging to the code table */
+	vcdiff_cache_t cache;                /**< Context for the address cache */
 
-	uint16_t state;                       /**< Current decoder state */
-
-	uint8_t win_indicator;
-	size_t target_offset;
-	size_t win_segment_len;
-	size_t win_segment_pos;
-	size_t win_window_len;
-	size_t win_window_pos;
+	/* cold */
+	vcdiff_off_t mismatch_offset;         /**< First differing target byte in VCDIFF_FLAG_VERIFY mode or VCDIFF_OFF_MAX */
+	vcdiff_hash_t hash;                  /**< Hash over the target data in target order */
+	const uint8_t *hash_expected;        /**< Digest checked by vcdiff_finish() or NULL */
+	uint8_t digest[VCDIFF_HASH_MAX_LEN]; /**< Digest of the target after vcdiff_finish() */
+	vcdiff_codetable_t custom_codetable; /**< Storage for a code table given by the delta header */
 
-	vcdiff_cache_t cache;                /**< Context for the address cache */
-	uint8_t buffer[VCDIFF_BUFFER_SIZE];  /**< Buffer for ADD, RUN and COPY instructions */
-	size_t buffer_ptr;
+#if !defined(VCDIFF_NDEBUG)
+	const char *error_msg;                /**< Message of the last error */
+	vcdiff_log_t inst_log;                /**< Callback for instruction logging */
+	vcdiff_log_t state_log;               /**< Callback for state logging */
+#endif
 
-	uint8_t inst0;
-	uint8_t inst1;
-	uint8_t mode0;
-	uint8_t mode1;
-	size_t size0;
-	size_t size1;
-	size_t addr0;
-	size_t addr1;
+#if VCDIFF_BUFFER_SIZE > 0
+	uint8_t buffer_storage[VCDIFF_BUFFER_SIZE]; /**< Default buffer */
+#endif
 } vcdiff_t;
 
 /**
@@ -158,6 +234,34 @@ static inline void vcdiff_set_target_driver (vcdiff_t *ctx, const vcdiff_driver_
 	ctx->target_dev = dev;
 }
 
+/**
+ * @brief   Provides the buffer for ADD, RUN and COPY instructions
+ *
+ * Replaces the buffer within the context. Mandatory if VCDIFF_BUFFER_SIZE is 0.
+ * Must be called before the first delta data is applied. Smaller buffers split
+ * instructions into more driver operations.
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  buf       Buffer; must stay valid during decoding
+ * @param[in]  size      Size of buf in byte; must not be zero
+ */
+static inline void vcdiff_set_buffer (vcdiff_t *ctx, uint8_t *buf, size_t size) {
+	ctx->buffer = buf;
+	ctx->buffer_size = size;
+}
+
+/**
+ * @brief   Sets decoder flags
+ *
+ * When restoring a checkpoint, set the same flags before vcdiff_checkpoint_restore().
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  flags     Bitwise or of VCDIFF_FLAG_* values
+ */
+static inline void vcdiff_set_flags (vcdiff_t *ctx, uint8_t flags) {
+	ctx->flags = flags;
+}
+
 /**
  * @brief   Connects decoder context and source device driver
  *
@@ -170,6 +274,59 @@ static inline void vcdiff_set_source_driver (vcdiff_t *ctx, const vcdiff_driver_
 	ctx->source_dev = dev;
 }
 
+/**
+ * @brief   Sets the target offset the next window is written to
+ *
+ * By default, decoding starts at offset 0 of the target. This allows for decoding
+ * windows that have been cut out of a delta at their original position.
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  offset    Offset in byte on the target device
+ */
+static inline void vcdiff_set_target_offset (vcdiff_t *ctx, vcdiff_off_t offset) {
+	ctx->target_offset = offset;
+}
+
+/**
+ * @brief   Registers an application-defined code table
+ *
+ * Deltas without a code table in their header are decoded using the given table
+ * instead of the default code table. This way, encoder and decoder can agree on
+ * a table without transmitting it in every delta. Tables given by the delta
+ * header always take precedence. Decoding is equally fast for all tables.
+ *
+ * Must be called before the first delta data is applied. When restoring a
+ * checkpoint, call it again before vcdiff_checkpoint_restore().
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  table     Code table prepared by vcdiff_codetable_prepare(). Must stay
+ *                       valid during decoding.
+ * @param[in]  near_size Size of the near cache, up to VCDIFF_CACHE_NEAR_SIZE
+ * @param[in]  same_size Size of the same cache, up to VCDIFF_CACHE_SAME_SIZE
+ * @return `0` if the table has been registered
+ * @return `<0` if the cache sizes exceed the compiled-in maximum
+ */
+int vcdiff_set_codetable (vcdiff_t *ctx, const vcdiff_codetable_t *table, uint8_t near_size, uint8_t same_size);
+
+/**
+ * @brief   Hashes the target while it is decoded
+ *
+ * Every target byte is hashed in target order as it is passed to the target
+ * driver, so drivers may reorder or defer writes. Data skipped by
+ * VCDIFF_FLAG_WRITE_IF_DIFFERENT is hashed as well; in-place COPYs skipped by
+ * VCDIFF_FLAG_ALIAS are read for hashing. vcdiff_finish() stores the digest in
+ * vcdiff_t::digest and compares it against the expected digest.
+ *
+ * Must be called before the first delta data is applied. When restoring a
+ * checkpoint, call it again before vcdiff_checkpoint_restore().
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  type      Hash algorithm
+ * @param[in]  expected  Expected digest of vcdiff_hash_len() bytes or NULL. Must
+ *                       stay valid until vcdiff_finish().
+ */
+void vcdiff_set_hash (vcdiff_t *ctx, vcdiff_hash_type_t type, const uint8_t *expected);
+
 /**
  * @brief   Connects decoder context and logging callbacks
  *
@@ -193,23 +350,95 @@ static inline void vcdiff_set_logger (vcdiff_t *ctx, vcdiff_log_t inst_log, vcdi
  *
  * Deltas can be applied partially. Passing in the delta file byte by byte is supported.
  *
+ * If a driver returns VCDIFF_AGAIN, decoding stops with VCDIFF_YIELD. The
+ * delta data from `ctx->delta_offset` on hasn't been consumed then and must be
+ * passed in again; vcdiff_apply_delta_budget() reports the consumed amount.
+ *
  * @param      ctx       Decoder context
  * @param[in]  input     Pointer to delta data
  * @param[in]  len       Length of provieded delta data
  * @return `0` if the provided delta data has been fully processed
+ * @return VCDIFF_YIELD if a driver isn't ready
  * @return `<0` if an error occured during processing
  */
 int vcdiff_apply_delta (vcdiff_t *ctx, const uint8_t *input, size_t len);
 
+/**
+ * @brief   Applies delta data with a bounded amount of work
+ *
+ * Like vcdiff_apply_delta(), but returns once about `budget` bytes have been
+ * passed to the target, even in the middle of an instruction. The next call
+ * resumes exactly there with the delta data that hasn't been consumed. This
+ * bounds the latency of a single call for cooperative schedulers.
+ *
+ * RUNs and COPYs are split at the budget. ADD data is written in chunks of up
+ * to the buffer size as it arrives; pass in smaller delta chunks to bound
+ * those as well.
+ *
+ * If a driver returns VCDIFF_AGAIN, decoding stops with VCDIFF_YIELD, too.
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  input     Pointer to delta data
+ * @param[in]  len       Length of provided delta data
+ * @param[in]  budget    Amount of target bytes to process at most; must not be zero. SIZE_MAX is unlimited.
+ * @param[out] consumed  Amount of delta data consumed; may be NULL
+ * @return `0` if the provided delta data has been fully processed
+ * @return VCDIFF_YIELD if the budget has been used up
+ * @return `<0` if an error occured during processing
+ */
+int vcdiff_apply_delta_budget (vcdiff_t *ctx, const uint8_t *input, size_t len, size_t budget, size_t *consumed);
+
 /**
  * @brief   Finishes decoding
  *
  * @param      ctx       Decoder context
  * @return `0` if all provided delta data has been processed and no further data is awaited
- * @return `<0` if the operation is unfinished
+ * @return `<0` if the operation is unfinished or the target hash doesn't match
  */
 int vcdiff_finish (vcdiff_t *ctx);
 
+/**
+ * @brief   Maximum size of a serialised checkpoint in byte
+ */
+#define VCDIFF_CHECKPOINT_MAX_LEN (8 + VCDIFF_CODETABLE_LEN + sizeof(vcdiff_hash_t) + (31 + VCDIFF_CACHE_NEAR_SIZE + 2 * VCDIFF_CACHE_SAME_SIZE * 256) * ((sizeof(vcdiff_off_t) * 8 + 6) / 7))
+
+/**
+ * @brief   Serialises the decoder state into a checkpoint
+ *
+ * The checkpoint covers everything required to resume decoding except for the
+ * drivers and the buffer. Thus, it can only be taken while no ADD data is
+ * buffered. This is always the case at window and instruction boundaries.
+ *
+ * Decoding can be resumed by restoring the checkpoint with vcdiff_checkpoint_restore()
+ * and passing in the delta starting at `ctx->delta_offset`. The target must
+ * contain all data written before the checkpoint has been taken.
+ *
+ * @param      ctx       Decoder context
+ * @param[out] buf       Buffer to write the checkpoint into
+ * @param[in]  len       Size of buf. VCDIFF_CHECKPOINT_MAX_LEN is always sufficient.
+ * @return `>0` length of the checkpoint written to buf
+ * @return `<0` if no checkpoint can be taken right now or buf is too small
+ */
+int vcdiff_checkpoint_save (vcdiff_t *ctx, uint8_t *buf, size_t len);
+
+/**
+ * @brief   Restores the decoder state from a checkpoint
+ *
+ * The context must be initialised and the drivers must be connected. The
+ * code table registered with vcdiff_set_codetable(), the hash set with
+ * vcdiff_set_hash() and the flags must be set up as they were when the
+ * checkpoint was taken. Code tables given by the delta header are part of the
+ * checkpoint.
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  buf       Checkpoint created by vcdiff_checkpoint_save()
+ * @param[in]  len       Length of the checkpoint
+ * @return `0` if the checkpoint has been restored
+ * @return `<0` if the checkpoint is corrupted, has been created by an incompatible
+ *         version or with a different code table, hash or flags
+ */
+int vcdiff_checkpoint_restore (vcdiff_t *ctx, const uint8_t *buf, size_t len);
+
 /**
  * @brief   Retrieve the current state
  *
@@ -1,11 +1,36 @@
 #ifndef VCDIFF_ADDRCACHE_H
 #define VCDIFF_ADDRCACHE_H
 
+#include "vcdiff/types.h"
 #include <stdint.h>
 #include <stddef.h>
 
+/* Maximum cache sizes. The default code table uses all of them; code tables
+ * given in the delta header may choose smaller caches. */
+#ifndef VCDIFF_CACHE_NEAR_SIZE
 #define VCDIFF_CACHE_NEAR_SIZE 4
+#endif
+#ifndef VCDIFF_CACHE_SAME_SIZE
 #define VCDIFF_CACHE_SAME_SIZE 3
+#endif
+
+#if VCDIFF_CACHE_NEAR_SIZE < 4 || VCDIFF_CACHE_SAME_SIZE < 3
+# error "The default code table requires a near cache of 4 and a same cache of 3 entries"
+#endif
+
+/* Type for addresses stored in the cache. VCDIFF_ADDR32 halves the cache on
+ * 64 bit platforms but limits windows and segments to 4 GiB together; larger
+ * windows are rejected while parsing their header. VCDIFF_ADDR64
+ * allows for large images on 32 bit platforms. Otherwise, vcdiff_off_t is used. */
+#if defined(VCDIFF_ADDR32) && defined(VCDIFF_ADDR64)
+# error "VCDIFF_ADDR32 and VCDIFF_ADDR64 are mutually exclusive"
+#elif defined(VCDIFF_ADDR32)
+typedef uint32_t vcdiff_addr_t;
+#elif defined(VCDIFF_ADDR64)
+typedef uint64_t vcdiff_addr_t;
+#else
+typedef vcdiff_off_t vcdiff_addr_t;
+#endif
 
 typedef enum {
 	VCDIFF_MODE_SELF,
@@ -16,40 +41,55 @@ typedef enum {
 } vcdiff_mode_t;
 
 typedef struct {
-	size_t near[VCDIFF_CACHE_NEAR_SIZE];
-	size_t same[VCDIFF_CACHE_SAME_SIZE * 256];
-	size_t next_slot;
+	vcdiff_addr_t near[VCDIFF_CACHE_NEAR_SIZE];
+	vcdiff_addr_t same[VCDIFF_CACHE_SAME_SIZE * 256];
+	/* same entries are only valid if their bit is set; this way resetting
+	 * the cache doesn't require clearing the whole same array */
+	uint32_t same_valid[VCDIFF_CACHE_SAME_SIZE * 256 / 32];
+	uint8_t next_slot;
+	uint8_t near_size;
+	uint8_t same_size;
 } vcdiff_cache_t;
 
-void vcdiff_addrcache_init (vcdiff_cache_t *cache);
+void vcdiff_addrcache_init (vcdiff_cache_t *cache, uint8_t near_size, uint8_t same_size);
 
-void vcdiff_addrcache_update (vcdiff_cache_t *cache, size_t addr);
+void vcdiff_addrcache_update (vcdiff_cache_t *cache, vcdiff_addr_t addr);
 
-vcdiff_mode_t vcdiff_addrcache_get_mode (uint8_t mode);
+vcdiff_mode_t vcdiff_addrcache_get_mode (const vcdiff_cache_t *cache, uint8_t mode);
 
-static inline size_t vcdiff_addrcache_decode_self (vcdiff_cache_t *cache, size_t addr) {
+static inline vcdiff_addr_t vcdiff_addrcache_get_same (const vcdiff_cache_t *cache, size_t idx) {
+	return (cache->same_valid[idx / 32] & (UINT32_C(1) << (idx % 32))) ? cache->same[idx] : 0;
+}
+
+static inline void vcdiff_addrcache_set_same (vcdiff_cache_t *cache, size_t idx, vcdiff_addr_t addr) {
+	cache->same[idx] = addr;
+	cache->same_valid[idx / 32] |= UINT32_C(1) << (idx % 32);
+}
+
+static inline vcdiff_addr_t vcdiff_addrcache_decode_self (vcdiff_cache_t *cache, vcdiff_addr_t addr) {
 	vcdiff_addrcache_update(cache, addr);
 	return addr;
 }
 
-static inline size_t vcdiff_addrcache_decode_here (vcdiff_cache_t *cache, size_t here, size_t addr) {
+static inline vcdiff_addr_t vcdiff_addrcache_decode_here (vcdiff_cache_t *cache, vcdiff_addr_t here, vcdiff_addr_t addr) {
 	addr = here - addr;
 	vcdiff_addrcache_update(cache, addr);
 	return addr;
 }
 
-static inline size_t vcdiff_addrcache_decode_near (vcdiff_cache_t *cache, uint8_t mode, size_t addr) {
+static inline vcdiff_addr_t vcdiff_addrcache_decode_near (vcdiff_cache_t *cache, uint8_t mode, vcdiff_addr_t addr) {
 	mode -= 2;
 	addr = cache->near[mode] + addr;
 	vcdiff_addrcache_update(cache, addr);
 	return addr;
 }
 
-static inline uint32_t vcdiff_addrcache_decode_same (vcdiff_cache_t *cache, uint8_t mode, uint32_t addr) {
-	mode -= 2 + VCDIFF_CACHE_NEAR_SIZE;
-	addr = cache->same[mode * 256 + addr];
-	vcdiff_addrcache_update(cache, addr);
-	return addr;
+static inline vcdiff_addr_t vcdiff_addrcache_decode_same (vcdiff_cache_t *cache, uint8_t mode, uint8_t addr) {
+	vcdiff_addr_t res;
+	mode -= 2 + cache->near_size;
+	res = vcdiff_addrcache_get_same(cache, mode * 256 + addr);
+	vcdiff_addrcache_update(cache, res);
+	return res;
 }
 
 #endif
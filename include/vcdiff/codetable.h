@@ -1,6 +1,7 @@
 #ifndef VCDIFF_CODETABLE_H
 #define VCDIFF_CODETABLE_H
 
+#include "vcdiff/types.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -11,8 +12,42 @@ enum {
 	VCDIFF_INST_COPY
 };
 
-void vcdiff_codetable_decode(uint8_t * inst0, size_t * size0, uint8_t * mode0,
-                             uint8_t * inst1, size_t * size1, uint8_t * mode1,
+/* Code table laid out like its string representation of RFC 3284 section 7.
+ * Hence, code tables transmitted in the delta header are decoded right into
+ * this struct and the default table serves as their source. */
+#define VCDIFF_CODETABLE_LEN 1536
+
+typedef struct {
+	uint8_t inst0[256];
+	uint8_t inst1[256];
+	uint8_t size0[256];
+	uint8_t size1[256];
+	uint8_t mode0[256];
+	uint8_t mode1[256];
+} vcdiff_codetable_t;
+
+extern const vcdiff_codetable_t vcdiff_codetable_default;
+
+static inline void vcdiff_codetable_lookup(const vcdiff_codetable_t *table,
+                                           uint8_t * inst0, vcdiff_off_t * size0, uint8_t * mode0,
+                                           uint8_t * inst1, vcdiff_off_t * size1, uint8_t * mode1,
+                                           uint8_t code) {
+	*inst0 = table->inst0[code];
+	*inst1 = table->inst1[code];
+	*size0 = table->size0[code];
+	*size1 = table->size1[code];
+	*mode0 = table->mode0[code];
+	*mode1 = table->mode1[code];
+}
+
+void vcdiff_codetable_decode(uint8_t * inst0, vcdiff_off_t * size0, uint8_t * mode0,
+                             uint8_t * inst1, vcdiff_off_t * size1, uint8_t * mode1,
                              uint8_t code);
 
+/* validates a decoded code table and moves instructions following a NOP to
+ * the first slot; returns 0 on success, <0 if the table is invalid */
+int vcdiff_codetable_prepare(vcdiff_codetable_t *table);
+
+uint8_t vcdiff_codetable_encode(uint8_t inst, vcdiff_off_t size, uint8_t mode);
+
 #endif
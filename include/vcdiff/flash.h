@@ -0,0 +1,102 @@
+#ifndef VCDIFF_FLASH_H
+#define VCDIFF_FLASH_H
+
+#include "vcdiff.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Target driver adapter for raw NOR/NAND flash.
+ *
+ * The decoder erases every window and writes chunks of arbitrary size and
+ * alignment. The adapter turns this into erases of whole erase blocks and
+ * programs of whole pages on the underlying flash driver:
+ *  - erases are aligned to erase blocks; blocks below the erase watermark
+ *    are never erased twice, even if windows share a block
+ *  - writes are collected in the caller-provided page buffer and programmed
+ *    once the page is complete or another page is written to; partial pages
+ *    are read back first to keep data not covered by the writes
+ *
+ * The underlying driver receives block-aligned erases and page-aligned
+ * programs of exactly one page.
+ *
+ * An erase that starts inside a block the adapter hasn't erased itself, e.g.
+ * the first window of a target that doesn't start at a block boundary or the
+ * deferred erase of VCDIFF_FLAG_WRITE_IF_DIFFERENT, would wipe the data in
+ * front of it. With a stage buffer of block_size bytes registered by
+ * vcdiff_flash_set_stage(), that data is read into it and programmed again
+ * after the erase. Without one, such erases fail.
+ *
+ * With VCDIFF_FLAG_ALIAS, the target is patched in place and everything
+ * outside of the erased range is still in use, also behind it. Enable
+ * vcdiff_flash_set_alias() for this: the end of the last block is kept in the
+ * stage buffer and only programmed again once the decoder moves on without
+ * overwriting it. Reads see it in the meantime, so the source must be read
+ * through the adapter as well. Erases that don't cover whole blocks fail
+ * without a stage buffer.
+ *
+ * The erase watermark isn't part of decoder checkpoints. Flush the adapter
+ * before taking a checkpoint and store erased_until along with it. After a
+ * reset, pass it to vcdiff_flash_resume() on the fresh adapter: blocks below
+ * aren't erased again. Pages written after the checkpoint are programmed
+ * again with the same data.
+ *
+ * Flash that can erase in the background may register vcdiff_flash_async_t.
+ * Window erases are then deferred: blocks are erased one by one ahead of
+ * the write cursor, and the next block is erased while the current one is
+ * programmed. Writes only wait if they catch up with the erase or start a
+ * partial page, which is read back; reads always wait for it to finish, as
+ * most parts cannot read while erasing.
+ */
+
+typedef struct {
+	int (*erase_start)(void *dev, vcdiff_off_t offset, vcdiff_off_t len); /* start erasing, return immediately */
+	int (*erase_busy)(void *dev);   /* >0 while erasing, 0 once done, <0 on error */
+} vcdiff_flash_async_t;
+
+typedef struct {
+	const vcdiff_driver_t *driver;  /* underlying flash */
+	void *dev;
+	size_t block_size;
+	size_t page_size;
+
+	uint8_t *page;                  /* page buffer of page_size bytes */
+	vcdiff_off_t page_offset;
+	bool page_valid;
+
+	vcdiff_off_t erased_from;       /* [erased_from, erased_until) has been erased */
+	vcdiff_off_t erased_until;
+	vcdiff_off_t erase_until;       /* end of the area requested to be erased */
+
+	const vcdiff_flash_async_t *async;
+	bool erasing;                   /* block at erased_until is being erased */
+
+	size_t erase_cnt;               /* erased blocks */
+	size_t program_cnt;             /* programmed pages */
+	size_t readback_cnt;            /* pages read back */
+	size_t erase_stalls;            /* writes waiting for a background erase */
+
+	uint8_t *stage;                 /* optional stage buffer of block_size bytes */
+	bool alias;
+	vcdiff_off_t stage_offset;      /* block held by the stage buffer */
+	vcdiff_off_t stage_from;        /* [stage_from, stage_until) is still to be programmed */
+	vcdiff_off_t stage_until;
+	size_t keep_cnt;                /* blocks erased keeping data in use */
+} vcdiff_flash_t;
+
+void vcdiff_flash_init (vcdiff_flash_t *flash, const vcdiff_driver_t *driver, void *dev,
+                        size_t block_size, size_t page_size, uint8_t *page);
+
+void vcdiff_flash_set_async (vcdiff_flash_t *flash, const vcdiff_flash_async_t *async);
+
+void vcdiff_flash_set_stage (vcdiff_flash_t *flash, uint8_t *stage);
+
+void vcdiff_flash_resume (vcdiff_flash_t *flash, vcdiff_off_t erased_until);
+
+void vcdiff_flash_set_alias (vcdiff_flash_t *flash, bool alias);
+
+/* driver to be used with vcdiff_set_target_driver() and the vcdiff_flash_t as device */
+extern const vcdiff_driver_t vcdiff_flash_driver;
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef VCDIFF_HASH_H
+#define VCDIFF_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VCDIFF_HASH_MAX_LEN 32
+
+typedef enum {
+	VCDIFF_HASH_NONE,
+	VCDIFF_HASH_CRC32,   /* IEEE 802.3, as used by zlib and cksum -a crc32b */
+	VCDIFF_HASH_SHA256
+} vcdiff_hash_type_t;
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t len;
+	uint8_t block[64];
+} vcdiff_sha256_t;
+
+typedef struct {
+	uint8_t type;
+	union {
+		uint32_t crc32;
+		vcdiff_sha256_t sha256;
+	} state;
+} vcdiff_hash_t;
+
+void vcdiff_hash_init (vcdiff_hash_t *hash, vcdiff_hash_type_t type);
+
+void vcdiff_hash_update (vcdiff_hash_t *hash, const uint8_t *data, size_t len);
+
+/* writes the digest and returns its length */
+size_t vcdiff_hash_final (vcdiff_hash_t *hash, uint8_t *digest);
+
+size_t vcdiff_hash_len (vcdiff_hash_type_t type);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef VCDIFF_PARSE_H
+#define VCDIFF_PARSE_H
+
+#include "vcdiff/addrcache.h"
+#include "vcdiff/codetable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-memory parser for complete deltas.
+ *
+ * Unlike vcdiff_apply_delta(), the parser requires the whole delta to be
+ * accessible at once and never touches source or target. It is meant for
+ * tools inspecting or rewriting deltas.
+ */
+
+#define VCDIFF_VCD_DECOMPRESS 0x1
+#define VCDIFF_VCD_CODETABLE 0x2
+
+#define VCDIFF_VCD_SOURCE 0x1
+#define VCDIFF_VCD_TARGET 0x2
+
+typedef struct {
+	uint8_t indicator;      /* VCD_SOURCE / VCD_TARGET */
+	vcdiff_off_t segment_len;
+	vcdiff_off_t segment_pos;
+	vcdiff_off_t window_len;
+	const uint8_t *inst;    /* interleaved instruction section */
+	size_t inst_len;
+	size_t offset;          /* offset of the window header inside the delta */
+	size_t len;             /* length of the whole window inside the delta */
+} vcdiff_window_t;
+
+typedef struct {
+	uint8_t inst;           /* VCDIFF_INST_ADD, VCDIFF_INST_RUN or VCDIFF_INST_COPY */
+	uint8_t mode;           /* COPY: address mode */
+	vcdiff_off_t size;
+	vcdiff_off_t addr;      /* COPY: decoded address */
+	vcdiff_off_t window_pos; /* target position of the instruction inside the window */
+	const uint8_t *data;    /* ADD: data to add; RUN: byte to repeat */
+} vcdiff_inst_t;
+
+typedef struct {
+	const char *error_msg;
+
+	const uint8_t *delta;
+	const uint8_t *input;
+	size_t input_remainder;
+
+	vcdiff_window_t window;
+	const uint8_t *inst_input;
+	size_t inst_remainder;
+	vcdiff_off_t window_pos;
+	vcdiff_cache_t *cache;
+
+	const vcdiff_codetable_t *codetable;
+	vcdiff_codetable_t *custom_codetable;
+	uint8_t near_size;
+	uint8_t same_size;
+
+	uint8_t inst1;
+	uint8_t mode1;
+	vcdiff_off_t size1;
+} vcdiff_parser_t;
+
+/* custom_codetable is the storage for a code table given in the header. Set
+ * it to NULL to reject deltas coming with their own code table. */
+void vcdiff_parser_init (vcdiff_parser_t *parser, vcdiff_cache_t *cache, vcdiff_codetable_t *custom_codetable,
+                         const uint8_t *delta, size_t len);
+
+/* returns 0 on success, <0 on error */
+int vcdiff_parse_header (vcdiff_parser_t *parser);
+
+/* returns 1 if a window has been parsed, 0 at the end of the delta, <0 on error */
+int vcdiff_parse_window (vcdiff_parser_t *parser, vcdiff_window_t *window);
+
+/* returns 1 if an instruction has been parsed, 0 at the end of the window, <0 on error */
+int vcdiff_parse_inst (vcdiff_parser_t *parser, vcdiff_inst_t *inst);
+
+/* decodes the code table data of a header with VCD_CODETABLE set: the cache
+ * sizes followed by a delta against the default code table;
+ * returns 0 on success, <0 on error */
+int vcdiff_parse_codetable (vcdiff_codetable_t *table, uint8_t *near_size, uint8_t *same_size,
+                            vcdiff_cache_t *cache, const uint8_t *data, size_t len, const char **error_msg);
+
+static inline size_t vcdiff_parser_offset (const vcdiff_parser_t *parser) {
+	return parser->input - parser->delta;
+}
+
+#endif
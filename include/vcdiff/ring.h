@@ -0,0 +1,50 @@
+#ifndef VCDIFF_RING_H
+#define VCDIFF_RING_H
+
+#include "vcdiff.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Input ring for deltas received by an interrupt handler or DMA.
+ *
+ * The producer (ISR/DMA) commits received bytes into a caller-provided
+ * buffer, the consumer (main loop) decodes them straight from the buffer.
+ * There is exactly one producer and one consumer; no locks are taken and
+ * interrupts need not be disabled:
+ *  - head is only written by the producer, tail only by the consumer
+ *  - both count bytes since init and are masked with size - 1, which
+ *    requires size to be a power of two
+ *
+ * DMA engines can be pointed at vcdiff_ring_write_ptr() and committed with
+ * vcdiff_ring_commit(). Byte-wise receivers use vcdiff_ring_put().
+ */
+
+typedef struct {
+	uint8_t *buf;
+	size_t size;                    /* power of two */
+	atomic_size_t head;             /* bytes committed by the producer */
+	atomic_size_t tail;             /* bytes consumed by the decoder */
+} vcdiff_ring_t;
+
+void vcdiff_ring_init (vcdiff_ring_t *ring, uint8_t *buf, size_t size);
+
+/* producer: contiguous free space up to the wrap point; returns its length */
+size_t vcdiff_ring_write_ptr (vcdiff_ring_t *ring, uint8_t **ptr);
+
+/* producer: publish len bytes written to vcdiff_ring_write_ptr() */
+void vcdiff_ring_commit (vcdiff_ring_t *ring, size_t len);
+
+/* producer: copy data into the ring; returns the amount of bytes that fit */
+size_t vcdiff_ring_put (vcdiff_ring_t *ring, const uint8_t *data, size_t len);
+
+/* consumer: committed bytes not consumed yet */
+size_t vcdiff_ring_used (vcdiff_ring_t *ring);
+
+/* consumer: decode all committed bytes in place, across the wrap point;
+ * VCDIFF_YIELD if a driver returned VCDIFF_AGAIN: the bytes not consumed are
+ * kept, call again once the driver is ready, even without new bytes */
+int vcdiff_ring_apply (vcdiff_t *ctx, vcdiff_ring_t *ring);
+
+#endif
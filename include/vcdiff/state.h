@@ -9,7 +9,9 @@
 	STATE(STATE_HDR_MAGIC1) \
 	STATE(STATE_HDR_MAGIC2) \
 	STATE(STATE_HDR_MAGIC3) \
-	STATE(STATE_HDR_INDICATOR)
+	STATE(STATE_HDR_INDICATOR) \
+	STATE(STATE_HDR_CODETABLE_LEN) \
+	STATE(STATE_HDR_CODETABLE_DATA)
 
 #define FOREACH_STATE_WIN_HDR(STATE) \
 	STATE(STATE_WIN_HDR_INDICATOR) \
@@ -0,0 +1,44 @@
+#ifndef VCDIFF_TRACE_H
+#define VCDIFF_TRACE_H
+
+/*
+ * Static tracepoints of the provider "vcdiff".
+ *
+ * With VCDIFF_TRACE defined, the probes are emitted as USDT probes using
+ * <sys/sdt.h> from SystemTap. Each probe is a single NOP until a tracer like
+ * bpftrace or perf attaches to it, so release builds may keep them enabled:
+ *
+ *   bpftrace -e 'usdt:./vcdiff-decode:vcdiff:window_start { printf("%d\n", arg1); }'
+ *
+ * Probes and their arguments:
+ *   window_start  target offset, window length, segment position, segment length
+ *   window_done   target offset, window length
+ *   inst          instruction, target offset, size, address
+ *   read_start    1 if reading the target else 0, offset, length
+ *   read_done     return code
+ *   write_start   offset, length
+ *   write_done    return code
+ *   erase_start   offset, length
+ *   erase_done    return code
+ *   flush_start
+ *   flush_done    return code
+ *
+ * Without VCDIFF_TRACE, they compile to nothing.
+ */
+
+#if defined(VCDIFF_TRACE)
+# include <sys/sdt.h>
+# define VCDIFF_TRACE0(NAME) DTRACE_PROBE(vcdiff, NAME)
+# define VCDIFF_TRACE1(NAME, A) DTRACE_PROBE1(vcdiff, NAME, A)
+# define VCDIFF_TRACE2(NAME, A, B) DTRACE_PROBE2(vcdiff, NAME, A, B)
+# define VCDIFF_TRACE3(NAME, A, B, C) DTRACE_PROBE3(vcdiff, NAME, A, B, C)
+# define VCDIFF_TRACE4(NAME, A, B, C, D) DTRACE_PROBE4(vcdiff, NAME, A, B, C, D)
+#else
+# define VCDIFF_TRACE0(NAME)
+# define VCDIFF_TRACE1(NAME, A)
+# define VCDIFF_TRACE2(NAME, A, B)
+# define VCDIFF_TRACE3(NAME, A, B, C)
+# define VCDIFF_TRACE4(NAME, A, B, C, D)
+#endif
+
+#endif
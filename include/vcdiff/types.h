@@ -0,0 +1,22 @@
+#ifndef VCDIFF_TYPES_H
+#define VCDIFF_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Type for offsets and lengths on the source and target devices and within the
+ * delta. Unlike buffers, they aren't bounded by the address space: VCDIFF_OFF64
+ * allows for images larger than 4 GiB on 32 bit platforms. Otherwise, size_t
+ * is used. */
+#if defined(VCDIFF_OFF64)
+# include <inttypes.h>
+typedef uint64_t vcdiff_off_t;
+# define VCDIFF_OFF_MAX UINT64_MAX
+# define VCDIFF_PRIoff PRIu64
+#else
+typedef size_t vcdiff_off_t;
+# define VCDIFF_OFF_MAX SIZE_MAX
+# define VCDIFF_PRIoff "zu"
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef VCDIFF_VALIDATE_H
+#define VCDIFF_VALIDATE_H
+
+#include "vcdiff/addrcache.h"
+#include "vcdiff/codetable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Validation pass over a complete delta.
+ *
+ * Checks everything vcdiff_apply_delta() would check, without any driver
+ * IO: headers, instruction sizes and COPY addresses against the window and
+ * segment lengths, segments against the source length and the target
+ * produced so far. Run it before erasing anything to rule out corrupt or
+ * truncated deltas. Statistics describe the IO the delta will cause.
+ */
+
+typedef struct {
+	vcdiff_cache_t cache;
+	vcdiff_codetable_t codetable;   /* storage for a code table in the header */
+
+	const char *error_msg;
+	size_t error_offset;            /* delta offset at which the error has been detected */
+
+	size_t windows;
+	vcdiff_off_t target_len;        /* bytes written to the target */
+	size_t add_cnt, run_cnt, copy_cnt;
+	vcdiff_off_t add_bytes, run_bytes, copy_bytes;
+	vcdiff_off_t source_read_bytes; /* COPYs from the source */
+	vcdiff_off_t target_read_bytes; /* COPYs from the target written so far */
+	size_t source_seeks;            /* source COPYs not continuing the previous one */
+	vcdiff_off_t source_seek_bytes; /* total distance of these jumps */
+} vcdiff_validate_t;
+
+/* source_len may be VCDIFF_OFF_MAX if unknown; returns 0 if the delta is valid, <0 otherwise */
+int vcdiff_validate (vcdiff_validate_t *val, const uint8_t *delta, size_t len, vcdiff_off_t source_len);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef VCDIFF_WRITE_H
+#define VCDIFF_WRITE_H
+
+#include "vcdiff/types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum amount of bytes an encoded integer may occupy */
+#define VCDIFF_WRITE_INT_MAX_LEN ((sizeof(vcdiff_off_t) * 8 + 6) / 7)
+
+size_t vcdiff_write_int (uint8_t *dst, vcdiff_off_t value);
+
+size_t vcdiff_write_int_len (vcdiff_off_t value);
+
+#endif
@@ -3,15 +3,40 @@
 #include "vcdiff/state.h"
 #include "vcdiff/addrcache.h"
 #include "vcdiff/codetable.h"
+#include "vcdiff/parse.h"
+#include "vcdiff/trace.h"
 #include "assert.h"
+#include <stdbool.h>
 #include <string.h>
-#include <sys/types.h>
 
-#define STATE(MAJ, MIN) \
+#if defined(VCDIFF_THREADED_DISPATCH)
+/* every state gets a label: a call enters its state with one indirect jump and
+ * transitions jump straight to the next state instead of returning to the loop */
+# define STATE(MAJ, MIN) \
 	/* fallthrough */ \
 	case (MAJ + MIN): \
+	label_##MIN: \
 		assert(ctx->state == MAJ + MIN); \
 		LOG_STATE();
+# define GENERATE_LABEL(STATE) &&label_##STATE,
+# define DISPATCH(FOREACH_STATE) { \
+	static const void *const labels[] = { FOREACH_STATE(GENERATE_LABEL) }; \
+	if ((ctx->state & 0xff) >= sizeof(labels) / sizeof(labels[0])) RET_ERR(-1, "Reached invalid state"); \
+	goto *labels[ctx->state & 0xff]; }
+# define NEXT_STATE(MAJ, MIN) { \
+	SET_STATE(MAJ, MIN); \
+	goto label_##MIN; }
+#else
+# define STATE(MAJ, MIN) \
+	/* fallthrough */ \
+	case (MAJ + MIN): \
+		assert(ctx->state == MAJ + MIN); \
+		LOG_STATE();
+# define DISPATCH(FOREACH_STATE)
+# define NEXT_STATE(MAJ, MIN) { \
+	SET_STATE(MAJ, MIN); \
+	break; }
+#endif
 
 #if defined(VCDIFF_NDEBUG)
 # define LOG(FMT, ...)
@@ -45,13 +70,39 @@
 
 #define MIN(a, b) (a > b) ? b : a;
 
-#define FIT_TO_BUFFER(LEN) MIN(LEN, sizeof(ctx->buffer))
+/* comparing against the target takes the upper half of the buffer */
+#define BUFFER_CHUNK_SIZE \
+	(((ctx->flags & (VCDIFF_FLAG_WRITE_IF_DIFFERENT | VCDIFF_FLAG_VERIFY)) && ctx->buffer_size > 1) ? \
+		ctx->buffer_size / 2 : ctx->buffer_size)
+
+#define FIT_TO_BUFFER(LEN) MIN(LEN, BUFFER_CHUNK_SIZE)
+
+/* target bytes left for this call of vcdiff_apply_delta_budget(); SIZE_MAX
+ * is unlimited, as a single call may produce more than that with 64 bit offsets */
+#define YIELD_IF_OUT_OF_BUDGET() \
+	if (ctx->budget == 0) return VCDIFF_YIELD;
+
+#define SPEND_BUDGET(LEN) \
+	if (ctx->budget != SIZE_MAX) ctx->budget -= MIN(LEN, ctx->budget);
+
+/* the driver isn't ready: the operation is retried on the next call */
+#define YIELD_IF_AGAIN(RC) \
+	if ((RC) == VCDIFF_AGAIN) return VCDIFF_YIELD;
 
 #define READ_BUFFER(LEN) {\
 	int rc = vcdiff_read_buffer(ctx->buffer, &ctx->buffer_ptr, LEN, input, input_remainder); \
 	if (rc != 0) return rc; \
 	ctx->buffer_ptr = 0; }
 
+/* instructions are traced once they have been decoded completely */
+#define SET_STATE_EXEC(N) \
+	VCDIFF_TRACE4(inst, ctx->inst##N, ctx->target_offset + ctx->win_window_pos, ctx->size##N, ctx->addr##N); \
+	SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC##N);
+
+#define NEXT_STATE_EXEC(N) \
+	VCDIFF_TRACE4(inst, ctx->inst##N, ctx->target_offset + ctx->win_window_pos, ctx->size##N, ctx->addr##N); \
+	NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC##N);
+
 #define CALL(FN, ...) { \
 	int rc = FN(ctx, input, input_remainder, __VA_ARGS__); \
 	if (rc != 0) return rc; }
@@ -60,7 +111,11 @@
 static const char *msg_invalid_magic = "Invalid magic";
 #endif
 
+#define VCD_DECOMPRESS 0x1
+#define VCD_CODETABLE 0x2
+
 static inline int _parse_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder) {
+	DISPATCH(FOREACH_STATE_HDR);
 	switch (ctx->state) {
 		STATE(STATE_HDR, STATE_HDR_MAGIC0) {
 			uint8_t magic;
@@ -89,7 +144,30 @@ static inline int _parse_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *input
 		STATE(STATE_HDR, STATE_HDR_INDICATOR) {
 			uint8_t ind;
 			READ_BYTE(&ind);
-			if (ind != 0x00) RET_ERR(-1, "Header indicator references unsupported features");
+			if (ind & ~VCD_CODETABLE) RET_ERR(-1, "Header indicator references unsupported features");
+			if (!(ind & VCD_CODETABLE)) {
+				SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_INDICATOR);
+				break;
+			}
+			ctx->size0 = 0;
+			SET_STATE(STATE_HDR, STATE_HDR_CODETABLE_LEN);
+		}
+		STATE(STATE_HDR, STATE_HDR_CODETABLE_LEN) {
+			READ_INT(&ctx->size0);
+			/* the compressed code table is decoded at once */
+			if (ctx->size0 > ctx->buffer_size) RET_ERR(-1, "Code table exceeds buffer");
+			SET_STATE(STATE_HDR, STATE_HDR_CODETABLE_DATA);
+		}
+		STATE(STATE_HDR, STATE_HDR_CODETABLE_DATA) {
+			const char *msg;
+			READ_BUFFER(ctx->size0);
+			/* the cache isn't in use before the first window */
+			if (vcdiff_parse_codetable(&ctx->custom_codetable, &ctx->cache_near_size, &ctx->cache_same_size,
+			                           &ctx->cache, ctx->buffer, ctx->size0, &msg) < 0) {
+				RET_ERR(-1, msg);
+			}
+			ctx->codetable = &ctx->custom_codetable;
+			LOG("CODETABLE near=%d same=%d\n", ctx->cache_near_size, ctx->cache_same_size);
 			SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_INDICATOR);
 			break;
 		}
@@ -103,7 +181,40 @@ static inline int _parse_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *input
 #define VCD_SOURCE 0x1
 #define VCD_TARGET 0x2
 
+/* driver calls are wrapped for tracing */
+static inline int _driver_read(vcdiff_t *ctx, bool target, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	VCDIFF_TRACE3(read_start, target, offset, len);
+	int rc = target ? ctx->target_driver->read(ctx->target_dev, dest, offset, len) :
+	                  ctx->source_driver->read(ctx->source_dev, dest, offset, len);
+	VCDIFF_TRACE1(read_done, rc);
+	return rc;
+}
+
+static inline int _driver_write(vcdiff_t *ctx, vcdiff_off_t offset, size_t len) {
+	VCDIFF_TRACE2(write_start, offset, len);
+	int rc = ctx->target_driver->write(ctx->target_dev, ctx->buffer, offset, len);
+	VCDIFF_TRACE1(write_done, rc);
+	return rc;
+}
+
+static int _erase(vcdiff_t *ctx, vcdiff_off_t offset, vcdiff_off_t len) {
+	if (ctx->target_driver->erase) {
+		VCDIFF_TRACE2(erase_start, offset, len);
+		int rc = ctx->target_driver->erase(ctx->target_dev, offset, len);
+		VCDIFF_TRACE1(erase_done, rc);
+		if (rc < 0) RET_ERR(rc, "Target erase failed");
+	}
+	return 0;
+}
+
+static int _erase_window(vcdiff_t *ctx) {
+	/* erase the part of the window that hasn't been written, yet */
+	ctx->win_erased = 1;
+	return _erase(ctx, ctx->target_offset + ctx->win_window_pos, ctx->win_window_len - ctx->win_window_pos);
+}
+
 static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder) {
+	DISPATCH(FOREACH_STATE_WIN_HDR);
 	switch (ctx->state) {
 		STATE(STATE_WIN_HDR, STATE_WIN_HDR_INDICATOR) {
 			READ_BYTE(&ctx->win_indicator);
@@ -119,8 +230,7 @@ static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *i
 
 			if (ctx->win_indicator == 0x00) {
 				LOG("WIN%s", "");
-				SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_DELTA_LEN);
-				break; /* the parent method will bring us back */
+				NEXT_STATE(STATE_WIN_HDR, STATE_WIN_HDR_DELTA_LEN);
 			} else {
 				LOG("WIN %s ", (ctx->win_indicator == VCD_SOURCE) ? "VCD_SOURCE" : "VCD_TARGET");
 				SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_SEGMENT_LEN);
@@ -137,12 +247,18 @@ static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *i
 		}
 		STATE(STATE_WIN_HDR, STATE_WIN_HDR_DELTA_LEN) {
 			/* just skip the delta length ... we don't care. */
-			size_t len = 0;
+			vcdiff_off_t len = 0;
 			READ_INT(&len);
 			SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_WINDOW_LENGTH);
 		}
 		STATE(STATE_WIN_HDR, STATE_WIN_HDR_WINDOW_LENGTH) {
 			READ_INT(&ctx->win_window_len);
+#if defined(VCDIFF_ADDR32) && VCDIFF_OFF_MAX > UINT32_MAX
+			/* the address cache holds addresses into the segment and the window */
+			if (ctx->win_segment_len > UINT32_MAX || ctx->win_window_len > UINT32_MAX - ctx->win_segment_len) {
+				RET_ERR(-1, "Window exceeds 32 bit address range");
+			}
+#endif
 			SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_DELTA_INDICATOR);
 		}
 		STATE(STATE_WIN_HDR, STATE_WIN_HDR_DELTA_INDICATOR) {
@@ -162,7 +278,7 @@ static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *i
 		}
 		STATE(STATE_WIN_HDR, STATE_WIN_HDR_INST_LEN) {
 			/* skip instruction length ... we don't care. */
-			size_t len = 0;
+			vcdiff_off_t len = 0;
 			READ_INT(&len);
 			SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_ADDR_LEN);
 		}
@@ -173,17 +289,24 @@ static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *i
 
 			/* prepare instruction decoding */
 			ctx->win_window_pos = 0;
-			vcdiff_addrcache_init(&ctx->cache);
+			VCDIFF_TRACE4(window_start, ctx->target_offset, ctx->win_window_len, ctx->win_segment_pos, ctx->win_segment_len);
+			vcdiff_addrcache_init(&ctx->cache, ctx->cache_near_size, ctx->cache_same_size);
 
 			/* prepare target window */
-			if (ctx->target_driver->erase) {
-				int rc = ctx->target_driver->erase(ctx->target_dev, ctx->target_offset, ctx->win_window_len);
-				if (rc < 0) RET_ERR(rc, "Target erase failed");
+			ctx->win_erased = 0;
+			if (!(ctx->flags & (VCDIFF_FLAG_WRITE_IF_DIFFERENT | VCDIFF_FLAG_ALIAS | VCDIFF_FLAG_VERIFY))) {
+				int rc = _erase_window(ctx);
+				if (rc < 0) return rc;
 			}
 
 			LOG(" => [0x%0x+%d]\n", ctx->target_offset, ctx->win_window_len);
 
-			SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
+			if (ctx->win_window_len == 0) {
+				/* empty window: there are no instructions to wait for */
+				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_STATE_WIN_BODY_FINISH);
+			} else {
+				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
+			}
 			break;
 		}
 		default:
@@ -193,8 +316,8 @@ static inline int _parse_win_hdr(vcdiff_t *ctx, const uint8_t **input, size_t *i
 	return 0;
 }
 
-static int _parse_win_body_addr(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder, uint8_t mode, size_t *addr) {
-	switch (vcdiff_addrcache_get_mode(mode)) {
+static int _parse_win_body_addr(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder, uint8_t mode, vcdiff_off_t *addr) {
+	switch (vcdiff_addrcache_get_mode(&ctx->cache, mode)) {
 		case VCDIFF_MODE_SELF:
 			READ_INT(addr);
 			*addr = vcdiff_addrcache_decode_self(&ctx->cache, *addr);
@@ -207,30 +330,110 @@ static int _parse_win_body_addr(vcdiff_t *ctx, const uint8_t **input, size_t *in
 			READ_INT(addr);
 			*addr = vcdiff_addrcache_decode_near(&ctx->cache, mode, *addr);
 			break;
-		case VCDIFF_MODE_SAME:
-			READ_BYTE((uint8_t*) addr);
-			*addr = vcdiff_addrcache_decode_same(&ctx->cache, mode, *addr);
+		case VCDIFF_MODE_SAME: {
+			uint8_t byte;
+			READ_BYTE(&byte);
+			*addr = vcdiff_addrcache_decode_same(&ctx->cache, mode, byte);
 			break;
+		}
 		default:
 			RET_ERR(-1, "Invalid mode");
 	}
 	return 0;
 }
 
-static int _parse_win_body_exec(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder, uint8_t inst, size_t *size, size_t *addr) {
+static int _target_compare(vcdiff_t *ctx, vcdiff_off_t offset, size_t len, size_t *pos) {
+	uint8_t byte;
+	uint8_t *cmp = &byte;
+	size_t cmp_size = 1;
+
+	/* read back into the upper half of the buffer; see FIT_TO_BUFFER() */
+	if (ctx->buffer_size > 1) {
+		cmp = &ctx->buffer[ctx->buffer_size / 2];
+		cmp_size = ctx->buffer_size / 2;
+	}
+
+	for (*pos = 0; *pos < len; *pos += cmp_size) {
+		size_t n = MIN(len - *pos, cmp_size);
+		int rc = _driver_read(ctx, true, cmp, offset + *pos, n);
+		if (rc < 0) RET_ERR(rc, "Cannot read target for comparison");
+		if (memcmp(cmp, &ctx->buffer[*pos], n)) {
+			while (cmp[0] == ctx->buffer[*pos]) {
+				cmp++;
+				(*pos)++;
+			}
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int _write(vcdiff_t *ctx, size_t len, const char *error_msg) {
+	vcdiff_off_t offset = ctx->target_offset + ctx->win_window_pos;
+	size_t pos;
 	int rc;
 
-	if (ctx->win_window_pos + *size > ctx->win_window_len) {
+	(void) error_msg;
+
+	if (ctx->flags & VCDIFF_FLAG_VERIFY) {
+		rc = _target_compare(ctx, offset, len, &pos);
+		if (rc < 0) return rc;
+		if (rc == 0) {
+			ctx->mismatch_offset = offset + pos;
+			RET_ERR(-1, "Target differs");
+		}
+		vcdiff_hash_update(&ctx->hash, ctx->buffer, len);
+		return 0;
+	}
+
+	/* erased targets are blank; no need to compare */
+	if ((ctx->flags & VCDIFF_FLAG_WRITE_IF_DIFFERENT) && !(ctx->win_erased && ctx->target_driver->erase)) {
+		rc = _target_compare(ctx, offset, len, &pos);
+		if (rc < 0) return rc;
+		if (rc > 0) {
+			vcdiff_hash_update(&ctx->hash, ctx->buffer, len);
+			return 0;
+		}
+	}
+
+	if (!ctx->win_erased) {
+		/* aliasing windows may contain data in place that must be kept */
+		rc = (ctx->flags & VCDIFF_FLAG_ALIAS) ? _erase(ctx, offset, len) : _erase_window(ctx);
+		if (rc < 0) return rc;
+	}
+
+	rc = _driver_write(ctx, offset, len);
+	YIELD_IF_AGAIN(rc);
+	if (rc < 0) RET_ERR(rc, error_msg);
+
+	/* hash once the write succeeded; it may be retried */
+	vcdiff_hash_update(&ctx->hash, ctx->buffer, len);
+	return 0;
+}
+
+static int _parse_win_body_exec(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder, uint8_t inst, vcdiff_off_t *size, vcdiff_off_t *addr) {
+	int rc;
+
+	if (*size > ctx->win_window_len - ctx->win_window_pos) {
 		RET_ERR(-1, "Size out of bounds");
 	}
 
 	if (inst == VCDIFF_INST_ADD) {
 		while (*size > 0) {
+			/* partly buffered chunks must be completed with the same length */
+			if (ctx->buffer_ptr == 0) YIELD_IF_OUT_OF_BUDGET();
 			size_t to_write = FIT_TO_BUFFER(*size);
 			READ_BUFFER(to_write);
 			LOG("  ADD => [0x%x+%d]\n", ctx->target_offset + ctx->win_window_pos, to_write);
-			rc = ctx->target_driver->write(ctx->target_dev, ctx->buffer, ctx->target_offset + ctx->win_window_pos, to_write);
-			if (rc < 0) RET_ERR(rc, "INST_ADD: cannot write to target");
+			rc = _write(ctx, to_write, "INST_ADD: cannot write to target");
+			if (rc == VCDIFF_YIELD) {
+				/* the data has been consumed already: keep it buffered */
+				ctx->buffer_ptr = to_write;
+				return rc;
+			}
+			if (rc < 0) return rc;
+			SPEND_BUDGET(to_write);
 			ctx->win_window_pos += to_write;
 			*size -= to_write;
 		}
@@ -238,14 +441,22 @@ static int _parse_win_body_exec(vcdiff_t *ctx, const uint8_t **input, size_t *in
 	}
 
 	if (inst == VCDIFF_INST_RUN) {
-		uint8_t byte;
-		READ_BYTE(&byte);
+		/* the byte is kept in the unused address to resume after yielding */
+		if (*addr == 0) {
+			uint8_t byte;
+			READ_BYTE(&byte);
+			*addr = 0x100 | byte;
+		}
+		uint8_t byte = *addr;
 		while (*size > 0) {
+			YIELD_IF_OUT_OF_BUDGET();
 			size_t to_write = FIT_TO_BUFFER(*size);
+			to_write = MIN(to_write, ctx->budget);
 			memset(ctx->buffer, byte, to_write);
 			LOG("  RUN 0x%02x => [0x%x+%d]\n", byte, ctx->target_offset + ctx->win_window_pos, to_write);
-			rc = ctx->target_driver->write(ctx->target_dev, ctx->buffer, ctx->target_offset + ctx->win_window_pos, to_write);
-			if (rc < 0) RET_ERR(rc, "INST_RUN: cannot write to target");
+			rc = _write(ctx, to_write, "INST_RUN: cannot write to target");
+			if (rc != 0) return rc;
+			SPEND_BUDGET(to_write);
 			ctx->win_window_pos += to_write;
 			*size -= to_write;
 		}
@@ -254,36 +465,54 @@ static int _parse_win_body_exec(vcdiff_t *ctx, const uint8_t **input, size_t *in
 
 	if (inst == VCDIFF_INST_COPY) {
 		while (*size > 0) {
-			const vcdiff_driver_t *driver = (ctx->win_indicator & VCD_SOURCE) ? ctx->source_driver : ctx->target_driver;
-			void *dev = (ctx->win_indicator & VCD_SOURCE) ? ctx->source_dev : ctx->target_dev;
-
 			size_t to_copy = FIT_TO_BUFFER(*size);
+			bool in_place = false;
+
+			YIELD_IF_OUT_OF_BUDGET();
+			to_copy = MIN(to_copy, ctx->budget);
 
 			/* read */
 			if (*addr < ctx->win_segment_len) {
 				/* data lives in the given segment */
-				if (*addr + *size > ctx->win_segment_len) {
+				if (*size > ctx->win_segment_len - *addr) {
 					RET_ERR(-1, "Address must not cross source boundary");
 				}
+				in_place = (ctx->flags & VCDIFF_FLAG_ALIAS) && (ctx->win_indicator & VCD_SOURCE) &&
+				           ctx->win_segment_pos + *addr == ctx->target_offset + ctx->win_window_pos;
+				if (in_place && ctx->hash.type == VCDIFF_HASH_NONE) {
+					/* the data is in place already */
+					LOG("  COPY in place [0x%x+%d]\n", ctx->target_offset + ctx->win_window_pos, *size);
+					ctx->win_window_pos += *size;
+					*addr += *size;
+					*size = 0;
+					break;
+				}
 				LOG("  COPY from SEGMENT [0x%x+%d]", *addr, to_copy);
-				rc = driver->read(dev, ctx->buffer, ctx->win_segment_pos + *addr, to_copy);
+				rc = _driver_read(ctx, !(ctx->win_indicator & VCD_SOURCE), ctx->buffer, ctx->win_segment_pos + *addr, to_copy);
 			} else {
 				/* data lives in the current window */
-				ssize_t bytes_ahead = ctx->win_window_pos - (*addr - ctx->win_segment_len);
-				if (bytes_ahead <= 0) {
+				vcdiff_off_t window_addr = *addr - ctx->win_segment_len;
+				if (window_addr >= ctx->win_window_pos) {
 					RET_ERR(-1, "Address is outside of available target window");
 				}
-				to_copy = MIN(to_copy, (size_t) bytes_ahead);
-				LOG("  COPY from WINDOW [0x%x+%d]", *addr - ctx->win_segment_len, to_copy);
-				rc = ctx->target_driver->read(ctx->target_dev, ctx->buffer, *addr - ctx->win_segment_len + ctx->target_offset, to_copy);
+				to_copy = MIN(to_copy, ctx->win_window_pos - window_addr);
+				LOG("  COPY from WINDOW [0x%x+%d]", window_addr, to_copy);
+				rc = _driver_read(ctx, true, ctx->buffer, ctx->target_offset + window_addr, to_copy);
 			}
+			YIELD_IF_AGAIN(rc);
 			if (rc < 0) RET_ERR(rc, "INST_COPY: cannot read from target/source");
 
 			/* write */
 			LOG(" => [0x%x+%d]\n", ctx->target_offset + ctx->win_window_pos, to_copy);
-			rc = ctx->target_driver->write(ctx->target_dev, ctx->buffer, ctx->target_offset + ctx->win_window_pos, to_copy);
-			if (rc < 0) RET_ERR(rc, "INST_COPY: cannot write to target");
+			if (in_place) {
+				/* only read for hashing */
+				vcdiff_hash_update(&ctx->hash, ctx->buffer, to_copy);
+			} else {
+				rc = _write(ctx, to_copy, "INST_COPY: cannot write to target");
+				if (rc != 0) return rc;
+			}
 
+			SPEND_BUDGET(to_copy);
 			ctx->win_window_pos += to_copy;
 			*size -= to_copy;
 			*addr += to_copy;
@@ -295,6 +524,7 @@ static int _parse_win_body_exec(vcdiff_t *ctx, const uint8_t **input, size_t *in
 }
 
 static inline int _parse_win_body(vcdiff_t *ctx, const uint8_t **input, size_t *input_remainder) {
+	DISPATCH(FOREACH_STATE_WIN_BODY);
 	switch (ctx->state) {
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST) {
 			uint8_t code;
@@ -304,16 +534,14 @@ static inline int _parse_win_body(vcdiff_t *ctx, const uint8_t **input, size_t *
 			ctx->addr0 = 0;
 			ctx->addr1 = 0;
 
-			vcdiff_codetable_decode(&ctx->inst0, &ctx->size0, &ctx->mode0,
+			vcdiff_codetable_lookup(ctx->codetable, &ctx->inst0, &ctx->size0, &ctx->mode0,
 			                        &ctx->inst1, &ctx->size1, &ctx->mode1, code);
 			if (ctx->size0 == 0) {
 				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_SIZE0);
 			} else if (ctx->inst0 == VCDIFF_INST_COPY) {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR0);
-				break;
+				NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR0);
 			} else {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC0);
-				break;
+				NEXT_STATE_EXEC(0);
 			}
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_SIZE0) {
@@ -321,32 +549,27 @@ static inline int _parse_win_body(vcdiff_t *ctx, const uint8_t **input, size_t *
 			if (ctx->inst0 == VCDIFF_INST_COPY) {
 				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR0);
 			} else {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC0);
-				break;
+				NEXT_STATE_EXEC(0);
 			}
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR0) {
 			CALL(_parse_win_body_addr, ctx->mode0, &ctx->addr0);
-			SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC0);
+			SET_STATE_EXEC(0);
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC0) {
 			CALL(_parse_win_body_exec, ctx->inst0, &ctx->size0, &ctx->addr0);
 			if (ctx->win_window_pos >= ctx->win_window_len) {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_STATE_WIN_BODY_FINISH);
-				break;
+				NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_STATE_WIN_BODY_FINISH);
 			} else if (ctx->inst1 != VCDIFF_INST_NOP) {
-				if (ctx->size0 == 0) {
+				if (ctx->size1 == 0) {
 					SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_SIZE1);
 				} else if (ctx->inst1 == VCDIFF_INST_COPY) {
-					SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR1);
-					break;
+					NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR1);
 				} else {
-					SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC1);
-					break;
+					NEXT_STATE_EXEC(1);
 				}
 			} else {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
-				break;
+				NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
 			}
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_SIZE1) {
@@ -354,25 +577,24 @@ static inline int _parse_win_body(vcdiff_t *ctx, const uint8_t **input, size_t *
 			if (ctx->inst1 == VCDIFF_INST_COPY) {
 				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR1);
 			} else {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC1);
-				break;
+				NEXT_STATE_EXEC(1);
 			}
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_ADDR1) {
 			CALL(_parse_win_body_addr, ctx->mode1, &ctx->addr1);
-			SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC1);
+			SET_STATE_EXEC(1);
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_EXEC1) {
 			CALL(_parse_win_body_exec, ctx->inst1, &ctx->size1, &ctx->addr1);
 			if (ctx->win_window_pos >= ctx->win_window_len) {
 				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_STATE_WIN_BODY_FINISH);
 			} else {
-				SET_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
-				break;
+				NEXT_STATE(STATE_WIN_BODY, STATE_WIN_BODY_INST);
 			}
 		}
 		STATE(STATE_WIN_BODY, STATE_WIN_BODY_STATE_WIN_BODY_FINISH) {
 			/* add the length of the processed window */
+			VCDIFF_TRACE2(window_done, ctx->target_offset, ctx->win_window_len);
 			ctx->target_offset += ctx->win_window_len;
 
 			SET_STATE(STATE_WIN_HDR, STATE_WIN_HDR_INDICATOR);
@@ -386,10 +608,14 @@ static inline int _parse_win_body(vcdiff_t *ctx, const uint8_t **input, size_t *
 	return 0;
 }
 
-int vcdiff_apply_delta (vcdiff_t *ctx, const uint8_t *input, size_t input_remainder) {
+int vcdiff_apply_delta_budget (vcdiff_t *ctx, const uint8_t *input, size_t input_remainder, size_t budget, size_t *consumed) {
 	int rc = 0;
+	size_t len = input_remainder;
 
-	/* make sure drivers are attached */
+	ctx->budget = budget;
+
+	/* make sure drivers and buffer are attached */
+	assert(ctx->buffer && ctx->buffer_size > 0);
 	assert(ctx->target_driver && ctx->target_driver->read && ctx->target_driver->write);
 	assert(ctx->source_driver && ctx->source_driver->read);
 
@@ -409,25 +635,61 @@ int vcdiff_apply_delta (vcdiff_t *ctx, const uint8_t *input, size_t input_remain
 		}
 	}
 
+	ctx->delta_offset += len - input_remainder;
+	if (consumed) *consumed = len - input_remainder;
+
 	/* mask out continue return codes */
-	if (rc > 0) rc = 0;
+	if (rc > 0 && rc != VCDIFF_YIELD) rc = 0;
 
 	return rc;
 }
 
+int vcdiff_apply_delta (vcdiff_t *ctx, const uint8_t *input, size_t input_remainder) {
+	return vcdiff_apply_delta_budget(ctx, input, input_remainder, SIZE_MAX, NULL);
+}
+
 void vcdiff_init (vcdiff_t *ctx) {
 	SET_STATE(STATE_HDR, STATE_HDR_MAGIC0);
 	SET_ERROR_MSG(NULL);
+	ctx->delta_offset = 0;
 	ctx->target_offset = 0;
 	ctx->buffer_ptr = 0;
+#if VCDIFF_BUFFER_SIZE > 0
+	vcdiff_set_buffer(ctx, ctx->buffer_storage, sizeof(ctx->buffer_storage));
+#else
+	vcdiff_set_buffer(ctx, NULL, 0);
+#endif
 	ctx->target_driver = NULL;
 	ctx->source_driver = NULL;
+	ctx->flags = 0;
+	ctx->mismatch_offset = VCDIFF_OFF_MAX;
+	vcdiff_set_hash(ctx, VCDIFF_HASH_NONE, NULL);
+	ctx->codetable = &vcdiff_codetable_default;
+	ctx->cache_near_size = 4;
+	ctx->cache_same_size = 3;
 #if !defined(VCDIFF_NDEBUG)
 	ctx->inst_log = NULL;
 	ctx->state_log = NULL;
 #endif
 }
 
+int vcdiff_set_codetable (vcdiff_t *ctx, const vcdiff_codetable_t *table, uint8_t near_size, uint8_t same_size) {
+	if (near_size > VCDIFF_CACHE_NEAR_SIZE || same_size > VCDIFF_CACHE_SAME_SIZE) {
+		SET_ERROR_MSG("Code table cache sizes exceed supported maximum");
+		return -1;
+	}
+
+	ctx->codetable = table;
+	ctx->cache_near_size = near_size;
+	ctx->cache_same_size = same_size;
+	return 0;
+}
+
+void vcdiff_set_hash (vcdiff_t *ctx, vcdiff_hash_type_t type, const uint8_t *expected) {
+	vcdiff_hash_init(&ctx->hash, type);
+	ctx->hash_expected = expected;
+}
+
 int vcdiff_finish (vcdiff_t *ctx) {
 	assert(ctx->target_driver);
 
@@ -444,11 +706,20 @@ int vcdiff_finish (vcdiff_t *ctx) {
 	}
 
 	/* flush pending data; not further writes are to be expected */
-	if (ctx->target_driver->flush) {
+	if (ctx->target_driver->flush && !(ctx->flags & VCDIFF_FLAG_VERIFY)) {
+		VCDIFF_TRACE0(flush_start);
 		int rc = ctx->target_driver->flush(ctx->target_dev);
+		VCDIFF_TRACE1(flush_done, rc);
 		if (rc < 0) RET_ERR(rc, "Target flush failed");
 	}
 
+	if (ctx->hash.type != VCDIFF_HASH_NONE) {
+		size_t len = vcdiff_hash_final(&ctx->hash, ctx->digest);
+		if (ctx->hash_expected && memcmp(ctx->digest, ctx->hash_expected, len)) {
+			RET_ERR(-1, "Target hash mismatch");
+		}
+	}
+
 	ctx->state = STATE_FINISH;
 	return 0;
 }
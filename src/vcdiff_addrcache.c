@@ -1,25 +1,32 @@
 #include "vcdiff/addrcache.h"
 #include <string.h>
+#include <assert.h>
 
-#ifdef ARRAY_SIZE
-#undef ARRAY_SIZE
-#endif
-#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
+void vcdiff_addrcache_init (vcdiff_cache_t *cache, uint8_t near_size, uint8_t same_size) {
+	assert(near_size <= VCDIFF_CACHE_NEAR_SIZE && same_size <= VCDIFF_CACHE_SAME_SIZE);
+	cache->near_size = near_size;
+	cache->same_size = same_size;
 
-void vcdiff_addrcache_init (vcdiff_cache_t *cache) {
-	memset(cache, 0x00, sizeof(vcdiff_cache_t));
+	/* the same array is left as it is: invalidating its entries is sufficient */
+	memset(cache->near, 0x00, sizeof(cache->near));
+	memset(cache->same_valid, 0x00, sizeof(cache->same_valid));
+	cache->next_slot = 0;
 }
 
-void vcdiff_addrcache_update (vcdiff_cache_t *cache, size_t addr) {
+void vcdiff_addrcache_update (vcdiff_cache_t *cache, vcdiff_addr_t addr) {
 	/* update near cache */
-	cache->near[cache->next_slot] = addr;
-	cache->next_slot = (cache->next_slot + 1) % ARRAY_SIZE(cache->near);
+	if (cache->near_size) {
+		cache->near[cache->next_slot] = addr;
+		cache->next_slot = (cache->next_slot + 1) % cache->near_size;
+	}
 
 	/* udpate same cache */
-	cache->same[addr % ARRAY_SIZE(cache->same)] = addr;
+	if (cache->same_size) {
+		vcdiff_addrcache_set_same(cache, addr % (cache->same_size * 256), addr);
+	}
 }
 
-vcdiff_mode_t vcdiff_addrcache_get_mode (uint8_t mode) {
+vcdiff_mode_t vcdiff_addrcache_get_mode (const vcdiff_cache_t *cache, uint8_t mode) {
 	if (mode == 0x00) {
 		return VCDIFF_MODE_SELF;
 	}
@@ -29,12 +36,12 @@ vcdiff_mode_t vcdiff_addrcache_get_mode (uint8_t mode) {
 	}
 
 	mode -= 2;
-	if (mode < VCDIFF_CACHE_NEAR_SIZE) {
+	if (mode < cache->near_size) {
 		return VCDIFF_MODE_NEAR;
 	}
 
-	mode -= VCDIFF_CACHE_NEAR_SIZE;
-	if (mode < VCDIFF_CACHE_SAME_SIZE) {
+	mode -= cache->near_size;
+	if (mode < cache->same_size) {
 		return VCDIFF_MODE_SAME;
 	}
 
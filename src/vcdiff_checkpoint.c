@@ -0,0 +1,241 @@
+#include "vcdiff.h"
+#include "vcdiff/read.h"
+#include "vcdiff/write.h"
+#include "vcdiff/state.h"
+#include <string.h>
+
+#if defined(VCDIFF_NDEBUG)
+# define SET_ERROR_MSG(MSG)
+#else
+# define SET_ERROR_MSG(MSG) \
+	ctx->error_msg = MSG;
+#endif
+
+#define CHECKPOINT_VERSION 4
+
+static const uint8_t magic[] = {'V', 'C', 'P', CHECKPOINT_VERSION};
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
+
+#define PUT_INT(VALUE) { \
+	vcdiff_off_t value = VALUE; \
+	if (pos + vcdiff_write_int_len(value) > len) goto too_small; \
+	pos += vcdiff_write_int(&buf[pos], value); }
+
+#define PUT_BYTES(SRC, LEN) { \
+	if (pos + (LEN) > len) goto too_small; \
+	memcpy(&buf[pos], SRC, LEN); \
+	pos += LEN; }
+
+#define GET_INT(VAR) { \
+	vcdiff_off_t value = 0; \
+	if (vcdiff_read_int(&value, &input, &input_remainder) != VCDIFF_READ_DONE) goto corrupted; \
+	VAR = value; }
+
+#define GET_BYTES(DST, LEN) { \
+	if (input_remainder < (LEN)) goto corrupted; \
+	memcpy(DST, input, LEN); \
+	input += LEN; \
+	input_remainder -= LEN; }
+
+static uint32_t _adler32 (const uint8_t *buf, size_t len) {
+	uint32_t a = 1, b = 0;
+
+	while (len--) {
+		a = (a + *buf++) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+int vcdiff_checkpoint_save (vcdiff_t *ctx, uint8_t *buf, size_t len) {
+	size_t pos = sizeof(magic);
+
+	if (ctx->state == STATE_ERR || ctx->state == STATE_FINISH) {
+		SET_ERROR_MSG("Cannot checkpoint finished or failed operation");
+		return -1;
+	}
+
+	if (ctx->buffer_ptr != 0) {
+		/* the buffer is not part of the checkpoint */
+		SET_ERROR_MSG("Cannot checkpoint while ADD data is buffered");
+		return -1;
+	}
+
+	if (len < sizeof(magic)) goto too_small;
+	memcpy(buf, magic, sizeof(magic));
+
+	PUT_INT(ctx->state);
+	PUT_INT(ctx->delta_offset);
+	PUT_INT(ctx->win_indicator);
+	PUT_INT(ctx->target_offset);
+	PUT_INT(ctx->win_segment_len);
+	PUT_INT(ctx->win_segment_pos);
+	PUT_INT(ctx->win_window_len);
+	PUT_INT(ctx->win_window_pos);
+	PUT_INT(ctx->win_erased);
+	PUT_INT(ctx->inst0);
+	PUT_INT(ctx->inst1);
+	PUT_INT(ctx->mode0);
+	PUT_INT(ctx->mode1);
+	PUT_INT(ctx->size0);
+	PUT_INT(ctx->size1);
+	PUT_INT(ctx->addr0);
+	PUT_INT(ctx->addr1);
+
+	/* flags are set again before restoring; only recorded to detect mismatches */
+	PUT_INT(ctx->flags);
+
+	/* code tables given by the header are part of the checkpoint; registered
+	 * tables must be registered again before restoring and are recorded by
+	 * their checksum */
+	PUT_INT(ctx->codetable == &ctx->custom_codetable);
+	PUT_INT(ctx->cache_near_size);
+	PUT_INT(ctx->cache_same_size);
+	if (ctx->codetable == &ctx->custom_codetable) {
+		PUT_BYTES(&ctx->custom_codetable, VCDIFF_CODETABLE_LEN);
+	} else {
+		PUT_INT(_adler32((const uint8_t *) ctx->codetable, VCDIFF_CODETABLE_LEN));
+	}
+
+	/* the hash must be set again before restoring */
+	PUT_INT(ctx->hash.type);
+	if (ctx->hash.type != VCDIFF_HASH_NONE) {
+		PUT_BYTES(&ctx->hash.state, sizeof(ctx->hash.state));
+	}
+
+	/* address cache: the same cache is mostly empty; store it sparse */
+	PUT_INT(ctx->cache.next_slot);
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->cache.near); i++) {
+		PUT_INT(ctx->cache.near[i]);
+	}
+	size_t cnt = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->cache.same); i++) {
+		if (vcdiff_addrcache_get_same(&ctx->cache, i)) cnt++;
+	}
+	PUT_INT(cnt);
+	size_t last = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->cache.same); i++) {
+		vcdiff_addr_t addr = vcdiff_addrcache_get_same(&ctx->cache, i);
+		if (!addr) continue;
+		PUT_INT(i - last);
+		PUT_INT(addr);
+		last = i;
+	}
+
+	if (pos + 4 > len) goto too_small;
+	uint32_t checksum = _adler32(buf, pos);
+	buf[pos++] = checksum >> 24;
+	buf[pos++] = checksum >> 16;
+	buf[pos++] = checksum >> 8;
+	buf[pos++] = checksum;
+
+	return pos;
+
+too_small:
+	SET_ERROR_MSG("Checkpoint buffer too small");
+	return -1;
+}
+
+int vcdiff_checkpoint_restore (vcdiff_t *ctx, const uint8_t *buf, size_t len) {
+	const uint8_t *input;
+	size_t input_remainder;
+
+	if (len < sizeof(magic) + 4 || memcmp(buf, magic, sizeof(magic))) {
+		SET_ERROR_MSG("Incompatible checkpoint");
+		ctx->state = STATE_ERR;
+		return -1;
+	}
+
+	len -= 4;
+	uint32_t checksum = ((uint32_t) buf[len] << 24) | ((uint32_t) buf[len + 1] << 16) | ((uint32_t) buf[len + 2] << 8) | buf[len + 3];
+	if (checksum != _adler32(buf, len)) goto corrupted;
+
+	input = buf + sizeof(magic);
+	input_remainder = len - sizeof(magic);
+
+	GET_INT(ctx->state);
+	GET_INT(ctx->delta_offset);
+	GET_INT(ctx->win_indicator);
+	GET_INT(ctx->target_offset);
+	GET_INT(ctx->win_segment_len);
+	GET_INT(ctx->win_segment_pos);
+	GET_INT(ctx->win_window_len);
+	GET_INT(ctx->win_window_pos);
+	GET_INT(ctx->win_erased);
+	GET_INT(ctx->inst0);
+	GET_INT(ctx->inst1);
+	GET_INT(ctx->mode0);
+	GET_INT(ctx->mode1);
+	GET_INT(ctx->size0);
+	GET_INT(ctx->size1);
+	GET_INT(ctx->addr0);
+	GET_INT(ctx->addr1);
+
+	uint8_t flags;
+	GET_INT(flags);
+	if (flags != ctx->flags) goto mismatch;
+
+	size_t custom, near_size, same_size;
+	GET_INT(custom);
+	GET_INT(near_size);
+	GET_INT(same_size);
+	if (custom) {
+		if (near_size > VCDIFF_CACHE_NEAR_SIZE || same_size > VCDIFF_CACHE_SAME_SIZE) goto corrupted;
+		GET_BYTES(&ctx->custom_codetable, VCDIFF_CODETABLE_LEN);
+		ctx->codetable = &ctx->custom_codetable;
+		ctx->cache_near_size = near_size;
+		ctx->cache_same_size = same_size;
+	} else {
+		uint32_t table_checksum;
+		GET_INT(table_checksum);
+		if (table_checksum != _adler32((const uint8_t *) ctx->codetable, VCDIFF_CODETABLE_LEN)) goto mismatch;
+		if (near_size != ctx->cache_near_size || same_size != ctx->cache_same_size) goto mismatch;
+	}
+	ctx->cache.near_size = ctx->cache_near_size;
+	ctx->cache.same_size = ctx->cache_same_size;
+
+	uint8_t hash_type;
+	GET_INT(hash_type);
+	if (hash_type != ctx->hash.type) goto mismatch;
+	if (ctx->hash.type != VCDIFF_HASH_NONE) {
+		GET_BYTES(&ctx->hash.state, sizeof(ctx->hash.state));
+	}
+
+	GET_INT(ctx->cache.next_slot);
+	if (ctx->cache.next_slot >= ARRAY_SIZE(ctx->cache.near)) goto corrupted;
+	for (size_t i = 0; i < ARRAY_SIZE(ctx->cache.near); i++) {
+		GET_INT(ctx->cache.near[i]);
+	}
+	memset(ctx->cache.same_valid, 0, sizeof(ctx->cache.same_valid));
+	size_t cnt;
+	GET_INT(cnt);
+	size_t idx = 0;
+	while (cnt--) {
+		size_t gap;
+		vcdiff_addr_t addr;
+		GET_INT(gap);
+		idx += gap;
+		if (idx >= ARRAY_SIZE(ctx->cache.same)) goto corrupted;
+		GET_INT(addr);
+		vcdiff_addrcache_set_same(&ctx->cache, idx, addr);
+	}
+
+	if (input_remainder != 0) goto corrupted;
+
+	ctx->buffer_ptr = 0;
+	SET_ERROR_MSG(NULL);
+
+	return 0;
+
+corrupted:
+	SET_ERROR_MSG("Corrupted checkpoint");
+	ctx->state = STATE_ERR;
+	return -1;
+
+mismatch:
+	SET_ERROR_MSG("Checkpoint taken with a different code table, hash or flags");
+	ctx->state = STATE_ERR;
+	return -1;
+}
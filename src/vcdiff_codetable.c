@@ -1,52 +1,194 @@
 #include "vcdiff/codetable.h"
 
-void vcdiff_codetable_decode(uint8_t * inst0, size_t * size0, uint8_t * mode0,
-                             uint8_t * inst1, size_t * size1, uint8_t * mode1,
+#define R VCDIFF_INST_RUN
+#define A VCDIFF_INST_ADD
+#define C VCDIFF_INST_COPY
+#define N VCDIFF_INST_NOP
+
+/* default code table of RFC 3284 section 5.6 */
+const vcdiff_codetable_t vcdiff_codetable_default = {
+	.inst0 = {
+		R,  /* opcode 0 */
+		A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 1-18 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 19-34 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 35-50 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 51-66 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 67-82 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 83-98 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 99-114 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 115-130 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 131-146 */
+		C, C, C, C, C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 147-162 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 163-174 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 175-186 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 187-198 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 199-210 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 211-222 */
+		A, A, A, A, A, A, A, A, A, A, A, A,  /* opcodes 223-234 */
+		A, A, A, A,  /* opcodes 235-238 */
+		A, A, A, A,  /* opcodes 239-242 */
+		A, A, A, A,  /* opcodes 243-246 */
+		C, C, C, C, C, C, C, C, C,  /* opcodes 247-255 */
+	},
+	.inst1 = {
+		N,  /* opcode 0 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 1-18 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 19-34 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 35-50 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 51-66 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 67-82 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 83-98 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 99-114 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 115-130 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 131-146 */
+		N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,  /* opcodes 147-162 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 163-174 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 175-186 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 187-198 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 199-210 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 211-222 */
+		C, C, C, C, C, C, C, C, C, C, C, C,  /* opcodes 223-234 */
+		C, C, C, C,  /* opcodes 235-238 */
+		C, C, C, C,  /* opcodes 239-242 */
+		C, C, C, C,  /* opcodes 243-246 */
+		A, A, A, A, A, A, A, A, A,  /* opcodes 247-255 */
+	},
+	.size0 = {
+		0,  /* opcode 0 */
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17,  /* 1-18 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 19-34 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 35-50 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 51-66 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 67-82 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 83-98 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 99-114 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 115-130 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 131-146 */
+		0, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,  /* 147-162 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 163-174 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 175-186 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 187-198 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 199-210 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 211-222 */
+		1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,  /* opcodes 223-234 */
+		1, 2, 3, 4,  /* opcodes 235-238 */
+		1, 2, 3, 4,  /* opcodes 239-242 */
+		1, 2, 3, 4,  /* opcodes 243-246 */
+		4, 4, 4, 4, 4, 4, 4, 4, 4,  /* opcodes 247-255 */
+	},
+	.size1 = {
+		0,  /* opcode 0 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 1-18 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 19-34 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 35-50 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 51-66 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 67-82 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 83-98 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 99-114 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 115-130 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 131-146 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 147-162 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 163-174 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 175-186 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 187-198 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 199-210 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 211-222 */
+		4, 5, 6, 4, 5, 6, 4, 5, 6, 4, 5, 6,  /* opcodes 223-234 */
+		4, 4, 4, 4,  /* opcodes 235-238 */
+		4, 4, 4, 4,  /* opcodes 239-242 */
+		4, 4, 4, 4,  /* opcodes 243-246 */
+		1, 1, 1, 1, 1, 1, 1, 1, 1,  /* opcodes 247-255 */
+	},
+	.mode0 = {
+		0,  /* opcode 0 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 1-18 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 19-34 */
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* opcodes 35-50 */
+		2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* opcodes 51-66 */
+		3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* opcodes 67-82 */
+		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  /* opcodes 83-98 */
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,  /* opcodes 99-114 */
+		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  /* opcodes 115-130 */
+		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* opcodes 131-146 */
+		8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,  /* opcodes 147-162 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 163-174 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 175-186 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 187-198 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 199-210 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 211-222 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 223-234 */
+		0, 0, 0, 0,  /* opcodes 235-238 */
+		0, 0, 0, 0,  /* opcodes 239-242 */
+		0, 0, 0, 0,  /* opcodes 243-246 */
+		0, 1, 2, 3, 4, 5, 6, 7, 8,  /* opcodes 247-255 */
+	},
+	.mode1 = {
+		0,  /* opcode 0 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 1-18 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 19-34 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 35-50 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 51-66 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 67-82 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 83-98 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 99-114 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 115-130 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 131-146 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 147-162 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 163-174 */
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  /* opcodes 175-186 */
+		2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,  /* opcodes 187-198 */
+		3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,  /* opcodes 199-210 */
+		4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,  /* opcodes 211-222 */
+		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,  /* opcodes 223-234 */
+		6, 6, 6, 6,  /* opcodes 235-238 */
+		7, 7, 7, 7,  /* opcodes 239-242 */
+		8, 8, 8, 8,  /* opcodes 243-246 */
+		0, 0, 0, 0, 0, 0, 0, 0, 0,  /* opcodes 247-255 */
+	},
+};
+
+void vcdiff_codetable_decode(uint8_t * inst0, vcdiff_off_t * size0, uint8_t * mode0,
+                             uint8_t * inst1, vcdiff_off_t * size1, uint8_t * mode1,
                              uint8_t code) {
-	*inst0 = VCDIFF_INST_NOP;
-	*inst1 = VCDIFF_INST_NOP;
-	*size0 = 0;
-	*size1 = 0;
-	*mode0 = 0;
-	*mode1 = 0;
-
-	if (code == 0) {
-		*inst0 = VCDIFF_INST_RUN;
-	} else if (code <= 18) {
-		*inst0 = VCDIFF_INST_ADD;
-		if (code > 1) {
-			*size0 = code - 1;
+	vcdiff_codetable_lookup(&vcdiff_codetable_default,
+	                        inst0, size0, mode0,
+	                        inst1, size1, mode1, code);
+}
+
+int vcdiff_codetable_prepare(vcdiff_codetable_t *table) {
+	for (size_t i = 0; i < 256; i++) {
+		if (table->inst0[i] > VCDIFF_INST_COPY || table->inst1[i] > VCDIFF_INST_COPY) {
+			return -1;
 		}
-	} else if (code <= 162) {
-		uint8_t col = (code - 19) % 16;
-		uint8_t row = (code - 19) / 16;
-		*inst0 = VCDIFF_INST_COPY;
-		if (col != 0) {
-			*size0 = col + 3;
+
+		/* the decoders expect the first instruction to be set */
+		if (table->inst0[i] == VCDIFF_INST_NOP) {
+			table->inst0[i] = table->inst1[i];
+			table->size0[i] = table->size1[i];
+			table->mode0[i] = table->mode1[i];
+			table->inst1[i] = VCDIFF_INST_NOP;
+			table->size1[i] = 0;
+			table->mode1[i] = 0;
 		}
-		*mode0 = row;
-	} else if (code <= 234) {
-		uint8_t col = (code - 163) % 3;
-		uint8_t row = (code - 163) / 3;
-		*inst0 = VCDIFF_INST_ADD;
-		*inst1 = VCDIFF_INST_COPY;
-		*size0 = (row % 4) + 1;
-		*size1 = (col % 3) + 4;
-		*mode1 = row / 4;
-	} else if (code <= 246) {
-		uint8_t col = (code - 235) % 4;
-		uint8_t row = (code - 235) / 4;
-		*inst0 = VCDIFF_INST_ADD;
-		*inst1 = VCDIFF_INST_COPY;
-		*size0 = col + 1;
-		*size1 = 4;
-		*mode1 = row + 6;
-	} else {
-		uint8_t col = code - 247;
-		*inst0 = VCDIFF_INST_COPY;
-		*inst1 = VCDIFF_INST_ADD;
-		*size0 = 4;
-		*size1 = 1;
-		*mode0 = col;
 	}
-}
\ No newline at end of file
+
+	return 0;
+}
+uint8_t vcdiff_codetable_encode(uint8_t inst, vcdiff_off_t size, uint8_t mode) {
+	/* only single instructions are encoded; if the size cannot be expressed
+	 * by the opcode, the returned opcode has size 0 and the size must be
+	 * written explicitly */
+	if (inst == VCDIFF_INST_RUN) {
+		return 0;
+	}
+
+	if (inst == VCDIFF_INST_ADD) {
+		return (size >= 1 && size <= 17) ? size + 1 : 1;
+	}
+
+	if (size >= 4 && size <= 18) {
+		return 19 + mode * 16 + (size - 3);
+	}
+
+	return 19 + mode * 16;
+}
@@ -0,0 +1,444 @@
+#include "vcdiff/flash.h"
+#include <assert.h>
+#include <string.h>
+
+#define ALIGN_DOWN(VAL, ALIGN) ((VAL) - (VAL) % (ALIGN))
+#define ALIGN_UP(VAL, ALIGN) ALIGN_DOWN((VAL) + (ALIGN) - 1, ALIGN)
+
+void vcdiff_flash_init (vcdiff_flash_t *flash, const vcdiff_driver_t *driver, void *dev,
+                        size_t block_size, size_t page_size, uint8_t *page) {
+	assert(driver && driver->read && driver->write);
+	assert(page_size > 0 && block_size >= page_size && block_size % page_size == 0);
+
+	flash->driver = driver;
+	flash->dev = dev;
+	flash->block_size = block_size;
+	flash->page_size = page_size;
+	flash->page = page;
+	flash->page_offset = 0;
+	flash->page_valid = false;
+	flash->erased_from = 0;
+	flash->erased_until = 0;
+	flash->erase_until = 0;
+	flash->async = NULL;
+	flash->erasing = false;
+	flash->erase_cnt = 0;
+	flash->program_cnt = 0;
+	flash->readback_cnt = 0;
+	flash->erase_stalls = 0;
+	flash->stage = NULL;
+	flash->keep_cnt = 0;
+	flash->alias = false;
+	flash->stage_offset = 0;
+	flash->stage_from = 0;
+	flash->stage_until = 0;
+}
+
+void vcdiff_flash_set_async (vcdiff_flash_t *flash, const vcdiff_flash_async_t *async) {
+	assert(!async || (async->erase_start && async->erase_busy));
+	assert(!flash->erasing);
+
+	flash->async = async;
+}
+
+void vcdiff_flash_set_stage (vcdiff_flash_t *flash, uint8_t *stage) {
+	flash->stage = stage;
+}
+
+void vcdiff_flash_resume (vcdiff_flash_t *flash, vcdiff_off_t erased_until) {
+	assert(!flash->erasing && !flash->page_valid);
+	assert(erased_until % flash->block_size == 0);
+
+	/* everything below has been erased before and holds data by now */
+	flash->erased_from = 0;
+	flash->erased_until = erased_until;
+	flash->erase_until = erased_until;
+}
+
+void vcdiff_flash_set_alias (vcdiff_flash_t *flash, bool alias) {
+	assert(flash->stage_from == flash->stage_until);
+
+	flash->alias = alias;
+}
+
+static int _erase_blocks (vcdiff_flash_t *flash, vcdiff_off_t from, vcdiff_off_t until) {
+	if (from >= until || !flash->driver->erase) return 0;
+
+	int rc = flash->driver->erase(flash->dev, from, until - from);
+	if (rc < 0) return rc;
+
+	flash->erase_cnt += (until - from) / flash->block_size;
+	return 0;
+}
+
+static void _erase_done (vcdiff_flash_t *flash) {
+	flash->erasing = false;
+	flash->erased_until += flash->block_size;
+	flash->erase_cnt++;
+}
+
+static int _erase_wait (vcdiff_flash_t *flash) {
+	if (!flash->erasing) return 0;
+
+	int rc;
+	while ((rc = flash->async->erase_busy(flash->dev)) > 0);
+	if (rc < 0) return rc;
+
+	_erase_done(flash);
+	return 0;
+}
+
+static int _erase_poll (vcdiff_flash_t *flash) {
+	int rc;
+
+	if (flash->erasing) {
+		rc = flash->async->erase_busy(flash->dev);
+		if (rc != 0) return (rc < 0) ? rc : 0;
+		_erase_done(flash);
+	}
+
+	/* keep one block ahead of the write cursor erasing */
+	if (flash->erased_until < flash->erase_until) {
+		rc = flash->async->erase_start(flash->dev, flash->erased_until, flash->block_size);
+		if (rc < 0) return rc;
+		flash->erasing = true;
+	}
+
+	return 0;
+}
+
+static int _erase_before (vcdiff_flash_t *flash, vcdiff_off_t until) {
+	int rc;
+
+	if (!flash->async) return 0;
+	if (until > flash->erase_until) until = flash->erase_until;
+
+	if (flash->erased_until < until) flash->erase_stalls++;
+	while (flash->erased_until < until) {
+		if (!flash->erasing) {
+			rc = _erase_poll(flash);
+			if (rc < 0) return rc;
+		}
+		rc = _erase_wait(flash);
+		if (rc < 0) return rc;
+	}
+
+	return 0;
+}
+
+static int _program_page (vcdiff_flash_t *flash) {
+	if (!flash->page_valid) return 0;
+
+	int rc = flash->driver->write(flash->dev, flash->page, flash->page_offset, flash->page_size);
+	if (rc < 0) return rc;
+
+	flash->page_valid = false;
+	flash->program_cnt++;
+	return 0;
+}
+
+static int _flash_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	vcdiff_flash_t *flash = (vcdiff_flash_t *) dev;
+	int rc;
+
+	if (flash->async) {
+		rc = _erase_poll(flash);
+		if (rc < 0) return rc;
+	}
+
+	while (len > 0) {
+		vcdiff_off_t page_offset = ALIGN_DOWN(offset, flash->page_size);
+		size_t pos = offset - page_offset;
+		size_t chunk = flash->page_size - pos;
+		if (chunk > len) chunk = len;
+
+		if (!flash->page_valid || flash->page_offset != page_offset) {
+			rc = _program_page(flash);
+			if (rc < 0) return rc;
+
+			rc = _erase_before(flash, page_offset + flash->page_size);
+			if (rc < 0) return rc;
+
+			if (chunk != flash->page_size) {
+				/* keep the data around the written part of the page; the flash can't be read while erasing */
+				rc = _erase_wait(flash);
+				if (rc < 0) return rc;
+				rc = flash->driver->read(flash->dev, flash->page, page_offset, flash->page_size);
+				if (rc < 0) return rc;
+				flash->readback_cnt++;
+				flash->page_offset = page_offset;
+				flash->page_valid = true;
+			}
+
+			if (flash->async) {
+				rc = _erase_poll(flash);
+				if (rc < 0) return rc;
+			}
+
+			if (chunk == flash->page_size) {
+				/* whole pages bypass the buffer */
+				rc = flash->driver->write(flash->dev, src, offset, chunk);
+				if (rc < 0) return rc;
+				flash->program_cnt++;
+				src += chunk;
+				offset += chunk;
+				len -= chunk;
+				continue;
+			}
+		}
+
+		memcpy(flash->page + pos, src, chunk);
+		src += chunk;
+		offset += chunk;
+		len -= chunk;
+
+		if (pos + chunk == flash->page_size) {
+			rc = _program_page(flash);
+			if (rc < 0) return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int _erase_now (vcdiff_flash_t *flash, vcdiff_off_t from, vcdiff_off_t until) {
+	int rc;
+
+	if (!flash->async) return _erase_blocks(flash, from, until);
+
+	rc = flash->async->erase_start(flash->dev, from, until - from);
+	if (rc < 0) return rc;
+	while ((rc = flash->async->erase_busy(flash->dev)) > 0);
+	if (rc < 0) return rc;
+
+	flash->erase_cnt += (until - from) / flash->block_size;
+	return 0;
+}
+
+static int _erase_keep (vcdiff_flash_t *flash, vcdiff_off_t from, vcdiff_off_t until) {
+	vcdiff_off_t block_end = from + flash->block_size;
+	int rc;
+
+	/* without a stage buffer, [from, until) would be lost */
+	if (!flash->stage) return -1;
+
+	rc = _program_page(flash);
+	if (rc < 0) return rc;
+	rc = _erase_before(flash, flash->erase_until);
+	if (rc < 0) return rc;
+
+	rc = flash->driver->read(flash->dev, flash->stage, from, until - from);
+	if (rc < 0) return rc;
+	rc = _erase_now(flash, from, block_end);
+	if (rc < 0) return rc;
+
+	if (from == flash->erased_until) {
+		flash->erased_until = block_end;
+		flash->erase_until = block_end;
+	} else if (block_end == flash->erased_from) {
+		flash->erased_from = from;
+	} else {
+		flash->erased_from = from;
+		flash->erased_until = block_end;
+		flash->erase_until = block_end;
+	}
+	flash->keep_cnt++;
+
+	return _flash_write(flash, flash->stage, from, until - from);
+}
+
+static int _stage_program (vcdiff_flash_t *flash, vcdiff_off_t until) {
+	vcdiff_off_t from = flash->stage_from;
+
+	if (until > flash->stage_until) until = flash->stage_until;
+	if (from >= until) return 0;
+
+	flash->stage_from = until;
+	return _flash_write(flash, flash->stage + (from - flash->stage_offset), from, until - from);
+}
+
+static int _erase_alias (vcdiff_flash_t *flash, vcdiff_off_t offset, vcdiff_off_t len) {
+	vcdiff_off_t end = offset + len;
+	int rc;
+
+	if (offset >= flash->erased_from && end <= flash->erased_until) return 0;
+
+	/* continue in the block whose end is still staged */
+	if (offset >= flash->stage_from && offset < flash->stage_until) {
+		vcdiff_off_t until = (end < flash->stage_until) ? end : flash->stage_until;
+
+		/* data skipped in between stays */
+		rc = _stage_program(flash, offset);
+		if (rc < 0) return rc;
+
+		if (offset != flash->erased_until) flash->erased_from = offset;
+		flash->erased_until = until;
+		flash->erase_until = until;
+		flash->stage_from = until;
+		if (end == until) return 0;
+		offset = until;
+	}
+
+	rc = _stage_program(flash, flash->stage_until);
+	if (rc < 0) return rc;
+
+	vcdiff_off_t from = ALIGN_DOWN(offset, flash->block_size);
+	vcdiff_off_t until = ALIGN_UP(end, flash->block_size);
+	vcdiff_off_t last = until - flash->block_size;
+
+	/* everything around the range in its blocks is in use */
+	if (offset > from || end < until) {
+		if (!flash->stage) return -1;
+		rc = _program_page(flash);
+		if (rc < 0) return rc;
+	}
+
+	if (offset > from) {
+		/* the whole block is staged if the range ends in it, too */
+		rc = flash->driver->read(flash->dev, flash->stage, from, (last == from) ? flash->block_size : offset - from);
+		if (rc < 0) return rc;
+		rc = _erase_now(flash, from, from + flash->block_size);
+		if (rc < 0) return rc;
+		rc = _flash_write(flash, flash->stage, from, offset - from);
+		if (rc < 0) return rc;
+		flash->keep_cnt++;
+		from += flash->block_size;
+	}
+
+	if (end < until && from <= last) {
+		rc = flash->driver->read(flash->dev, flash->stage + (end - last), end, until - end);
+		if (rc < 0) return rc;
+		flash->keep_cnt++;
+	}
+	if (from < until) {
+		rc = _erase_now(flash, from, until);
+		if (rc < 0) return rc;
+	}
+
+	/* the end of the last block is programmed again unless it gets overwritten */
+	if (end < until) {
+		flash->stage_offset = last;
+		flash->stage_from = end;
+		flash->stage_until = until;
+	}
+
+	if (offset != flash->erased_until) flash->erased_from = offset;
+	flash->erased_until = end;
+	flash->erase_until = end;
+	return 0;
+}
+
+static int _flash_erase (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
+	vcdiff_flash_t *flash = (vcdiff_flash_t *) dev;
+	vcdiff_off_t from = ALIGN_DOWN(offset, flash->block_size);
+	vcdiff_off_t until = ALIGN_UP(offset + len, flash->block_size);
+	int rc;
+
+	if (flash->alias) return _erase_alias(flash, offset, len);
+
+	/* the start of a block that hasn't been erased by us holds data to keep */
+	if (offset > from && (from < flash->erased_from || from >= flash->erase_until)) {
+		rc = _erase_keep(flash, from, offset);
+		if (rc < 0) return rc;
+	}
+
+	if (flash->async) {
+		rc = _erase_wait(flash);
+		if (rc < 0) return rc;
+
+		if (from > flash->erase_until || until < flash->erased_from) {
+			flash->erased_from = from;
+			flash->erased_until = from;
+			flash->erase_until = from;
+		} else if (from < flash->erased_from) {
+			/* rare: grow downwards synchronously */
+			rc = _erase_now(flash, from, flash->erased_from);
+			if (rc < 0) return rc;
+			flash->erased_from = from;
+		}
+
+		/* defer the rest to writes */
+		if (until > flash->erase_until) flash->erase_until = until;
+		return _erase_poll(flash);
+	}
+
+	if (from > flash->erased_until || until < flash->erased_from) {
+		/* not adjacent to the erased area: start over */
+		rc = _erase_blocks(flash, from, until);
+		if (rc < 0) return rc;
+		flash->erased_from = from;
+		flash->erased_until = until;
+		flash->erase_until = until;
+		return 0;
+	}
+
+	/* grow the erased area; blocks inside of it may already hold data */
+	if (from < flash->erased_from) {
+		rc = _erase_blocks(flash, from, flash->erased_from);
+		if (rc < 0) return rc;
+		flash->erased_from = from;
+	}
+
+	if (until > flash->erased_until) {
+		rc = _erase_blocks(flash, flash->erased_until, until);
+		if (rc < 0) return rc;
+		flash->erased_until = until;
+		flash->erase_until = until;
+	}
+
+	return 0;
+}
+
+static int _flash_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	vcdiff_flash_t *flash = (vcdiff_flash_t *) dev;
+
+	/* flash without read-while-write returns garbage during an erase */
+	int rc = _erase_wait(flash);
+	if (rc < 0) return rc;
+
+	rc = flash->driver->read(flash->dev, dest, offset, len);
+	if (rc < 0) return rc;
+
+	/* the buffered page hasn't been programmed, yet */
+	if (flash->page_valid && offset < flash->page_offset + flash->page_size && flash->page_offset < offset + len) {
+		vcdiff_off_t from = (offset > flash->page_offset) ? offset : flash->page_offset;
+		vcdiff_off_t until = (offset + len < flash->page_offset + flash->page_size) ? offset + len : flash->page_offset + flash->page_size;
+		memcpy(dest + (from - offset), flash->page + (from - flash->page_offset), until - from);
+	}
+
+	/* the staged end of a block has been erased on the flash */
+	if (offset < flash->stage_until && flash->stage_from < offset + len) {
+		vcdiff_off_t from = (offset > flash->stage_from) ? offset : flash->stage_from;
+		vcdiff_off_t until = (offset + len < flash->stage_until) ? offset + len : flash->stage_until;
+		memcpy(dest + (from - offset), flash->stage + (from - flash->stage_offset), until - from);
+	}
+
+	return 0;
+}
+
+static int _flash_flush (void *dev) {
+	vcdiff_flash_t *flash = (vcdiff_flash_t *) dev;
+
+	int rc = _stage_program(flash, flash->stage_until);
+	if (rc < 0) return rc;
+
+	rc = _program_page(flash);
+	if (rc < 0) return rc;
+
+	/* leave the flash idle */
+	rc = _erase_before(flash, flash->erase_until);
+	if (rc < 0) return rc;
+
+	if (flash->driver->flush) {
+		return flash->driver->flush(flash->dev);
+	}
+
+	return 0;
+}
+
+const vcdiff_driver_t vcdiff_flash_driver = {
+	.read = _flash_read,
+	.write = _flash_write,
+	.flush = _flash_flush,
+	.erase = _flash_erase
+};
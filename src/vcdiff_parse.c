@@ -0,0 +1,325 @@
+#include "vcdiff/parse.h"
+#include "vcdiff/read.h"
+#include "vcdiff/addrcache.h"
+#include "vcdiff/codetable.h"
+#include <stdbool.h>
+#include <string.h>
+
+static const uint8_t magic[] = {0xd6, 0xc3, 0xc4, 0x53};
+
+#define RET_ERR(MSG) { \
+	parser->error_msg = MSG; \
+	return -1; }
+
+#define READ_BYTE(VAR, INPUT, REMAINDER) { \
+	if (vcdiff_read_byte(VAR, INPUT, REMAINDER) != VCDIFF_READ_DONE) RET_ERR("Unexpected end of delta"); }
+
+#define READ_INT(VAR, INPUT, REMAINDER) { \
+	*(VAR) = 0; \
+	if (vcdiff_read_int(VAR, INPUT, REMAINDER) != VCDIFF_READ_DONE) RET_ERR("Unexpected end of delta"); }
+
+void vcdiff_parser_init (vcdiff_parser_t *parser, vcdiff_cache_t *cache, vcdiff_codetable_t *custom_codetable,
+                         const uint8_t *delta, size_t len) {
+	parser->error_msg = NULL;
+	parser->cache = cache;
+	parser->codetable = &vcdiff_codetable_default;
+	parser->custom_codetable = custom_codetable;
+	parser->near_size = 4;
+	parser->same_size = 3;
+	parser->delta = delta;
+	parser->input = delta;
+	parser->input_remainder = len;
+	parser->inst_input = NULL;
+	parser->inst_remainder = 0;
+	parser->window_pos = 0;
+	parser->inst1 = VCDIFF_INST_NOP;
+}
+
+int vcdiff_parse_header (vcdiff_parser_t *parser) {
+	for (size_t i = 0; i < sizeof(magic); i++) {
+		uint8_t byte;
+		READ_BYTE(&byte, &parser->input, &parser->input_remainder);
+		if (byte != magic[i]) RET_ERR("Invalid magic");
+	}
+
+	uint8_t ind;
+	READ_BYTE(&ind, &parser->input, &parser->input_remainder);
+	if (ind & ~VCDIFF_VCD_CODETABLE) RET_ERR("Header indicator references unsupported features");
+
+	if (ind & VCDIFF_VCD_CODETABLE) {
+		vcdiff_off_t len;
+		if (!parser->custom_codetable) RET_ERR("Header indicator references unsupported features");
+		READ_INT(&len, &parser->input, &parser->input_remainder);
+		if (len > parser->input_remainder) RET_ERR("Unexpected end of delta");
+		if (vcdiff_parse_codetable(parser->custom_codetable, &parser->near_size, &parser->same_size,
+		                           parser->cache, parser->input, len, &parser->error_msg) < 0) {
+			return -1;
+		}
+		parser->codetable = parser->custom_codetable;
+		parser->input += len;
+		parser->input_remainder -= len;
+	}
+
+	return 0;
+}
+
+int vcdiff_parse_window (vcdiff_parser_t *parser, vcdiff_window_t *window) {
+	const uint8_t **input = &parser->input;
+	size_t *input_remainder = &parser->input_remainder;
+	vcdiff_window_t *win = &parser->window;
+
+	if (*input_remainder == 0) {
+		return 0;
+	}
+
+	win->offset = vcdiff_parser_offset(parser);
+	win->segment_len = 0;
+	win->segment_pos = 0;
+
+	READ_BYTE(&win->indicator, input, input_remainder);
+	if (win->indicator != VCDIFF_VCD_SOURCE && win->indicator != VCDIFF_VCD_TARGET && win->indicator != 0x00) {
+		RET_ERR("Unsupported window indicator");
+	}
+
+	if (win->indicator) {
+		READ_INT(&win->segment_len, input, input_remainder);
+		READ_INT(&win->segment_pos, input, input_remainder);
+	}
+
+	vcdiff_off_t delta_len;
+	READ_INT(&delta_len, input, input_remainder);
+	if (delta_len > *input_remainder) RET_ERR("Unexpected end of delta");
+
+	/* everything else is bounded by the delta length */
+	const uint8_t *body = *input;
+	size_t body_remainder = delta_len;
+	*input += delta_len;
+	*input_remainder -= delta_len;
+
+	READ_INT(&win->window_len, &body, &body_remainder);
+#if defined(VCDIFF_ADDR32) && VCDIFF_OFF_MAX > UINT32_MAX
+	/* the address cache holds addresses into the segment and the window */
+	if (win->segment_len > UINT32_MAX || win->window_len > UINT32_MAX - win->segment_len) {
+		RET_ERR("Window exceeds 32 bit address range");
+	}
+#endif
+
+	uint8_t ind;
+	READ_BYTE(&ind, &body, &body_remainder);
+	if (ind != 0x00) RET_ERR("Unsupported delta indicator");
+
+	vcdiff_off_t len;
+	READ_INT(&len, &body, &body_remainder);
+	if (len != 0) RET_ERR("Data length must be zero");
+
+	vcdiff_off_t inst_len;
+	READ_INT(&inst_len, &body, &body_remainder);
+
+	READ_INT(&len, &body, &body_remainder);
+	if (len != 0) RET_ERR("Address length must be zero");
+
+	if (inst_len != body_remainder) RET_ERR("Instruction length does not match delta length");
+	win->inst_len = body_remainder;
+	win->inst = body;
+	win->len = vcdiff_parser_offset(parser) - win->offset;
+
+	/* prepare instruction parsing */
+	parser->inst_input = body;
+	parser->inst_remainder = body_remainder;
+	parser->window_pos = 0;
+	parser->inst1 = VCDIFF_INST_NOP;
+	vcdiff_addrcache_init(parser->cache, parser->near_size, parser->same_size);
+
+	if (window) *window = *win;
+
+	return 1;
+}
+
+static int _parse_addr (vcdiff_parser_t *parser, uint8_t mode, vcdiff_off_t *addr) {
+	const uint8_t **input = &parser->inst_input;
+	size_t *input_remainder = &parser->inst_remainder;
+
+	switch (vcdiff_addrcache_get_mode(parser->cache, mode)) {
+		case VCDIFF_MODE_SELF:
+			READ_INT(addr, input, input_remainder);
+			*addr = vcdiff_addrcache_decode_self(parser->cache, *addr);
+			break;
+		case VCDIFF_MODE_HERE:
+			READ_INT(addr, input, input_remainder);
+			*addr = vcdiff_addrcache_decode_here(parser->cache, parser->window.segment_len + parser->window_pos, *addr);
+			break;
+		case VCDIFF_MODE_NEAR:
+			READ_INT(addr, input, input_remainder);
+			*addr = vcdiff_addrcache_decode_near(parser->cache, mode, *addr);
+			break;
+		case VCDIFF_MODE_SAME: {
+			uint8_t byte;
+			READ_BYTE(&byte, input, input_remainder);
+			*addr = vcdiff_addrcache_decode_same(parser->cache, mode, byte);
+			break;
+		}
+		default:
+			RET_ERR("Invalid mode");
+	}
+
+	return 0;
+}
+
+int vcdiff_parse_inst (vcdiff_parser_t *parser, vcdiff_inst_t *inst) {
+	const uint8_t **input = &parser->inst_input;
+	size_t *input_remainder = &parser->inst_remainder;
+	const vcdiff_window_t *win = &parser->window;
+
+	if (parser->window_pos >= win->window_len) {
+		/* like the decoder, a pending second instruction is dropped at the end of the window */
+		parser->inst1 = VCDIFF_INST_NOP;
+		if (*input_remainder > 0) RET_ERR("Instructions exceed the window length");
+		return 0;
+	}
+
+	if (parser->inst1 != VCDIFF_INST_NOP) {
+		inst->inst = parser->inst1;
+		inst->size = parser->size1;
+		inst->mode = parser->mode1;
+		parser->inst1 = VCDIFF_INST_NOP;
+	} else {
+		uint8_t code;
+		READ_BYTE(&code, input, input_remainder);
+		vcdiff_codetable_lookup(parser->codetable, &inst->inst, &inst->size, &inst->mode,
+		                        &parser->inst1, &parser->size1, &parser->mode1, code);
+	}
+
+	if (inst->size == 0) {
+		READ_INT(&inst->size, input, input_remainder);
+	}
+
+	if (inst->size > win->window_len - parser->window_pos) {
+		RET_ERR("Size out of bounds");
+	}
+
+	inst->addr = 0;
+	inst->data = NULL;
+	inst->window_pos = parser->window_pos;
+
+	switch (inst->inst) {
+		case VCDIFF_INST_ADD:
+			if (*input_remainder < inst->size) RET_ERR("Unexpected end of delta");
+			inst->data = *input;
+			*input += inst->size;
+			*input_remainder -= inst->size;
+			break;
+		case VCDIFF_INST_RUN:
+			if (*input_remainder < 1) RET_ERR("Unexpected end of delta");
+			inst->data = *input;
+			*input += 1;
+			*input_remainder -= 1;
+			break;
+		case VCDIFF_INST_COPY: {
+			int rc = _parse_addr(parser, inst->mode, &inst->addr);
+			if (rc < 0) return rc;
+			if (inst->addr >= win->segment_len + parser->window_pos) {
+				RET_ERR("Address is outside of available target window");
+			}
+			if (inst->addr < win->segment_len && inst->size > win->segment_len - inst->addr) {
+				RET_ERR("Address must not cross source boundary");
+			}
+			break;
+		}
+		default:
+			RET_ERR("Invalid Instruction");
+	}
+
+	parser->window_pos += inst->size;
+
+	return 1;
+}
+
+int vcdiff_parse_codetable (vcdiff_codetable_t *table, uint8_t *near_size, uint8_t *same_size,
+                            vcdiff_cache_t *cache, const uint8_t *data, size_t len, const char **error_msg) {
+	const uint8_t *source = (const uint8_t *) &vcdiff_codetable_default;
+	uint8_t *target = (uint8_t *) table;
+	size_t target_pos = 0;
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+	int rc;
+
+	if (len < 2) {
+		*error_msg = "Unexpected end of delta";
+		return -1;
+	}
+
+	*near_size = data[0];
+	*same_size = data[1];
+	if (*near_size > VCDIFF_CACHE_NEAR_SIZE || *same_size > VCDIFF_CACHE_SAME_SIZE) {
+		*error_msg = "Code table cache sizes exceed supported maximum";
+		return -1;
+	}
+
+	/* the code table itself is encoded using the default code table */
+	vcdiff_parser_init(&parser, cache, NULL, data + 2, len - 2);
+	rc = vcdiff_parse_header(&parser);
+	if (rc < 0) goto parser_err;
+
+	while ((rc = vcdiff_parse_window(&parser, &win)) == 1) {
+		const uint8_t *segment = NULL;
+		uint8_t *window = target + target_pos;
+
+		if (win.window_len > VCDIFF_CODETABLE_LEN - target_pos) {
+			*error_msg = "Code table exceeds its length";
+			return -1;
+		}
+
+		if (win.indicator == VCDIFF_VCD_SOURCE) {
+			if (win.segment_pos > VCDIFF_CODETABLE_LEN || win.segment_len > VCDIFF_CODETABLE_LEN - win.segment_pos) {
+				*error_msg = "Code table segment out of bounds";
+				return -1;
+			}
+			segment = source + win.segment_pos;
+		} else if (win.indicator == VCDIFF_VCD_TARGET) {
+			if (win.segment_pos > target_pos || win.segment_len > target_pos - win.segment_pos) {
+				*error_msg = "Code table segment out of bounds";
+				return -1;
+			}
+			segment = target + win.segment_pos;
+		}
+
+		while ((rc = vcdiff_parse_inst(&parser, &inst)) == 1) {
+			switch (inst.inst) {
+				case VCDIFF_INST_ADD:
+					memcpy(window + inst.window_pos, inst.data, inst.size);
+					break;
+				case VCDIFF_INST_RUN:
+					memset(window + inst.window_pos, *inst.data, inst.size);
+					break;
+				case VCDIFF_INST_COPY:
+					/* byte-wise, since copies from the window may overlap */
+					for (size_t i = 0; i < inst.size; i++) {
+						vcdiff_off_t addr = inst.addr + i;
+						window[inst.window_pos + i] = (addr < win.segment_len) ? segment[addr] : window[addr - win.segment_len];
+					}
+					break;
+			}
+		}
+		if (rc < 0) goto parser_err;
+
+		target_pos += win.window_len;
+	}
+	if (rc < 0) goto parser_err;
+
+	if (target_pos != VCDIFF_CODETABLE_LEN) {
+		*error_msg = "Code table has wrong length";
+		return -1;
+	}
+
+	if (vcdiff_codetable_prepare(table) < 0) {
+		*error_msg = "Code table contains invalid instructions";
+		return -1;
+	}
+
+	return 0;
+
+parser_err:
+	*error_msg = parser.error_msg;
+	return -1;
+}
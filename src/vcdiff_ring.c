@@ -0,0 +1,83 @@
+#include "vcdiff/ring.h"
+#include <assert.h>
+#include <string.h>
+
+void vcdiff_ring_init (vcdiff_ring_t *ring, uint8_t *buf, size_t size) {
+	assert(size > 0 && (size & (size - 1)) == 0);
+
+	ring->buf = buf;
+	ring->size = size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+}
+
+size_t vcdiff_ring_write_ptr (vcdiff_ring_t *ring, uint8_t **ptr) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t pos = head & (ring->size - 1);
+	size_t len = ring->size - (head - tail);
+
+	/* stop at the wrap point */
+	if (len > ring->size - pos) len = ring->size - pos;
+
+	*ptr = ring->buf + pos;
+	return len;
+}
+
+void vcdiff_ring_commit (vcdiff_ring_t *ring, size_t len) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	assert(len <= ring->size - (head - atomic_load_explicit(&ring->tail, memory_order_relaxed)));
+
+	atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+size_t vcdiff_ring_put (vcdiff_ring_t *ring, const uint8_t *data, size_t len) {
+	size_t done = 0;
+
+	/* at most two chunks: up to the wrap point and from the start */
+	for (int i = 0; i < 2 && done < len; i++) {
+		uint8_t *ptr;
+		size_t chunk = vcdiff_ring_write_ptr(ring, &ptr);
+		if (chunk == 0) break;
+		if (chunk > len - done) chunk = len - done;
+		memcpy(ptr, data + done, chunk);
+		vcdiff_ring_commit(ring, chunk);
+		done += chunk;
+	}
+
+	return done;
+}
+
+size_t vcdiff_ring_used (vcdiff_ring_t *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	return head - tail;
+}
+
+int vcdiff_ring_apply (vcdiff_t *ctx, vcdiff_ring_t *ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	/* bytes committed meanwhile are left for the next call; an instruction
+	 * stopped by a busy driver continues even without new bytes */
+	do {
+		size_t pos = tail & (ring->size - 1);
+		size_t len = head - tail;
+		if (len > ring->size - pos) len = ring->size - pos;
+
+		size_t consumed;
+		int rc = vcdiff_apply_delta_budget(ctx, ring->buf + pos, len, SIZE_MAX, &consumed);
+		if (rc < 0) return rc;
+
+		/* the decoder is done with the data: hand the space back */
+		tail += consumed;
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		/* a driver isn't ready; the rest stays in the ring */
+		if (rc == VCDIFF_YIELD) return rc;
+	} while (tail != head);
+
+	return 0;
+}
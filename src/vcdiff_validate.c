@@ -0,0 +1,76 @@
+#include "vcdiff/validate.h"
+#include "vcdiff/parse.h"
+#include <string.h>
+
+#define RET_ERR(MSG, OFFSET) { \
+	val->error_msg = MSG; \
+	val->error_offset = OFFSET; \
+	return -1; }
+
+static void _count_inst (vcdiff_validate_t *val, const vcdiff_window_t *win, const vcdiff_inst_t *inst, vcdiff_off_t *source_pos) {
+	switch (inst->inst) {
+		case VCDIFF_INST_ADD:
+			val->add_cnt++;
+			val->add_bytes += inst->size;
+			break;
+		case VCDIFF_INST_RUN:
+			val->run_cnt++;
+			val->run_bytes += inst->size;
+			break;
+		case VCDIFF_INST_COPY:
+			val->copy_cnt++;
+			val->copy_bytes += inst->size;
+			if (inst->addr >= win->segment_len || !(win->indicator & VCDIFF_VCD_SOURCE)) {
+				val->target_read_bytes += inst->size;
+			} else {
+				/* locality of source accesses */
+				vcdiff_off_t addr = win->segment_pos + inst->addr;
+				if (addr != *source_pos) {
+					val->source_seeks++;
+					val->source_seek_bytes += (addr > *source_pos) ? addr - *source_pos : *source_pos - addr;
+				}
+				*source_pos = addr + inst->size;
+				val->source_read_bytes += inst->size;
+			}
+			break;
+	}
+}
+
+int vcdiff_validate (vcdiff_validate_t *val, const uint8_t *delta, size_t len, vcdiff_off_t source_len) {
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+	vcdiff_off_t source_pos = 0;
+	int rc;
+
+	memset(&val->windows, 0, sizeof(*val) - offsetof(vcdiff_validate_t, windows));
+	val->error_msg = NULL;
+	val->error_offset = 0;
+
+	vcdiff_parser_init(&parser, &val->cache, &val->codetable, delta, len);
+	rc = vcdiff_parse_header(&parser);
+	if (rc < 0) RET_ERR(parser.error_msg, vcdiff_parser_offset(&parser));
+
+	while ((rc = vcdiff_parse_window(&parser, &win)) > 0) {
+		if (win.indicator & VCDIFF_VCD_SOURCE) {
+			if (win.segment_len > source_len || win.segment_pos > source_len - win.segment_len) {
+				RET_ERR("Source segment exceeds source", win.offset);
+			}
+		} else if (win.indicator & VCDIFF_VCD_TARGET) {
+			if (win.segment_len > val->target_len || win.segment_pos > val->target_len - win.segment_len) {
+				RET_ERR("Target segment exceeds target", win.offset);
+			}
+		}
+
+		while ((rc = vcdiff_parse_inst(&parser, &inst)) > 0) {
+			_count_inst(val, &win, &inst, &source_pos);
+		}
+		if (rc < 0) RET_ERR(parser.error_msg, parser.inst_input - delta);
+
+		val->windows++;
+		val->target_len += win.window_len;
+	}
+	if (rc < 0) RET_ERR(parser.error_msg, vcdiff_parser_offset(&parser));
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+#include "vcdiff/write.h"
+
+size_t vcdiff_write_int_len (vcdiff_off_t value) {
+	size_t len = 1;
+
+	while (value >>= 7) {
+		len++;
+	}
+
+	return len;
+}
+
+size_t vcdiff_write_int (uint8_t *dst, vcdiff_off_t value) {
+	size_t len = vcdiff_write_int_len(value);
+
+	/* the most significant group comes first; all but the last byte have the MSB set */
+	for (size_t i = len; i > 0; i--) {
+		dst[i - 1] = (value & 0x7f) | ((i == len) ? 0x00 : 0x80);
+		value >>= 7;
+	}
+
+	return len;
+}
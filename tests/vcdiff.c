@@ -8,7 +8,7 @@
 #include <string.h>
 #include <stdio.h>
 
-int target_erase (void *dev, size_t offset, size_t len) {
+int target_erase (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
 	check_expected_ptr(dev);
 	check_expected(offset);
 	check_expected(len);
@@ -21,7 +21,7 @@ int target_erase (void *dev, size_t offset, size_t len) {
 	expect_value(target_erase, len, LEN); \
 	will_return(target_erase, RC);
 
-int target_write (void *dev, uint8_t *src, size_t offset, size_t len) {
+int target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
 	check_expected_ptr(dev);
 	check_expected_ptr(src);
 	check_expected(offset);
@@ -36,7 +36,7 @@ int target_write (void *dev, uint8_t *src, size_t offset, size_t len) {
 	expect_value(target_write, len, LEN); \
 	will_return(target_write, RC);
 
-int target_read (void *dev, uint8_t *src, size_t offset, size_t len) {
+int target_read (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
 	check_expected_ptr(dev);
 	check_expected_ptr(src);
 	check_expected(offset);
@@ -72,7 +72,7 @@ static vcdiff_driver_t target_driver = {
 	.read = target_read,
 };
 
-int source_read (void *dev, uint8_t *dst, size_t offset, size_t len) {
+int source_read (void *dev, uint8_t *dst, vcdiff_off_t offset, size_t len) {
 	check_expected_ptr(dev);
 	check_expected_ptr(dst);
 	check_expected(offset);
@@ -321,6 +321,658 @@ static void test_vcdiff_win_body2 (void **state) {
 	assert_int_equal(vcdiff_finish(&ctx), 0);
 }
 
+/* header with a code table mapping opcode 0 to ADD with size 3, followed by a window using it */
+static const uint8_t codetable_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x02, 0x30,
+	0x04, 0x03, 0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x8C, 0x00, 0x00, 0x24, 0x8C, 0x00, 0x00, 0x00, 0x1E, 0x00, 0x00, 0x13, 0x01, 0x00, 0x81, 0x10, 0x03, 0x00, 0x54, 0x01, 0x00, 0x09, 0x03, 0x00, 0x81, 0x23, 0x00, 0x00, 0x54, 0x03, 0x00, 0x09, 0x01, 0x02, 0x03, 0x13, 0x87, 0x7F, 0x84, 0x01,
+	0x00, 0x09, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x61, 0x62, 0x63};
+
+static void test_vcdiff_codetable (void **state) {
+	(void) state;
+	vcdiff_t ctx;
+
+	/* read in one go */
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	if (VCDIFF_BUFFER_SIZE < 0x30) {
+		assert_int_equal(vcdiff_apply_delta(&ctx, codetable_delta, sizeof(codetable_delta)), -1);
+		assert_string_equal("Code table exceeds buffer", vcdiff_error_str(&ctx));
+		return;
+	}
+	for (uint32_t offset = 0; offset < 3; offset += VCDIFF_BUFFER_SIZE) {
+		expect_target_write(0, 0x42, ctx.buffer, offset, (3 - offset > VCDIFF_BUFFER_SIZE) ? VCDIFF_BUFFER_SIZE : 3 - offset);
+	}
+	assert_int_equal(vcdiff_apply_delta(&ctx, codetable_delta, sizeof(codetable_delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_ptr_equal(ctx.codetable, &ctx.custom_codetable);
+	assert_int_equal(ctx.custom_codetable.inst0[0], VCDIFF_INST_ADD);
+	assert_int_equal(ctx.custom_codetable.size0[0], 3);
+	assert_memory_equal(ctx.custom_codetable.inst0 + 1, vcdiff_codetable_default.inst0 + 1, 2 * 256 - 1);
+	assert_memory_equal(ctx.custom_codetable.size0 + 1, vcdiff_codetable_default.size0 + 1, 4 * 256 - 1);
+
+	/* read byte-wise */
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	for (uint32_t offset = 0; offset < 3; offset += VCDIFF_BUFFER_SIZE) {
+		expect_target_write(0, 0x42, ctx.buffer, offset, (3 - offset > VCDIFF_BUFFER_SIZE) ? VCDIFF_BUFFER_SIZE : 3 - offset);
+	}
+	for (size_t i = 0; i < sizeof(codetable_delta); i++) {
+		assert_int_equal(vcdiff_apply_delta(&ctx, &codetable_delta[i], 1), 0);
+	}
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+}
+
+static void test_vcdiff_codetable_registered (void **state) {
+	(void) state;
+	uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x00, 0x09, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x61, 0x62, 0x63};
+	vcdiff_codetable_t table = vcdiff_codetable_default;
+	vcdiff_t ctx;
+
+	table.inst0[0] = VCDIFF_INST_ADD;
+	table.size0[0] = 3;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, VCDIFF_CACHE_NEAR_SIZE + 1, 3), -1);
+	assert_string_equal("Code table cache sizes exceed supported maximum", vcdiff_error_str(&ctx));
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 3), 0);
+	for (uint32_t offset = 0; offset < 3; offset += VCDIFF_BUFFER_SIZE) {
+		expect_target_write(0, 0x42, ctx.buffer, offset, (3 - offset > VCDIFF_BUFFER_SIZE) ? VCDIFF_BUFFER_SIZE : 3 - offset);
+	}
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+}
+
+static void test_vcdiff_checkpoint_setup (void **state) {
+	(void) state;
+	uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x00, 0x09, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x61, 0x62, 0x63};
+	uint8_t checkpoint[VCDIFF_CHECKPOINT_MAX_LEN];
+	vcdiff_codetable_t table = vcdiff_codetable_default;
+	vcdiff_codetable_t other = vcdiff_codetable_default;
+	vcdiff_t ctx;
+	int len;
+
+	table.inst0[0] = VCDIFF_INST_ADD;
+	table.size0[0] = 3;
+	other.inst0[0] = VCDIFF_INST_ADD;
+	other.size0[0] = 4;
+
+	/* checkpoint after the header, decoding with a registered table */
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 3), 0);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, 5), 0);
+	len = vcdiff_checkpoint_save(&ctx, checkpoint, sizeof(checkpoint));
+	assert_in_range(len, 1, sizeof(checkpoint));
+
+	/* the table, its cache sizes, the hash and the flags must be set up again */
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+	assert_string_equal("Checkpoint taken with a different code table, hash or flags", vcdiff_error_str(&ctx));
+	assert_string_equal("STATE_ERR", vcdiff_state_str(&ctx));
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &other, 4, 3), 0);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 2), 0);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+
+	vcdiff_init(&ctx);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 3), 0);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 3), 0);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	assert_int_equal(vcdiff_set_codetable(&ctx, &table, 4, 3), 0);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), 0);
+	for (uint32_t offset = 0; offset < 3; offset += VCDIFF_BUFFER_SIZE) {
+		expect_target_write(0, 0x42, ctx.buffer, offset, (3 - offset > VCDIFF_BUFFER_SIZE) ? VCDIFF_BUFFER_SIZE : 3 - offset);
+	}
+	assert_int_equal(vcdiff_apply_delta(&ctx, &data[ctx.delta_offset], sizeof(data) - ctx.delta_offset), 0);
+}
+
+static void test_vcdiff_win_body_pair (void **state) {
+	(void) state;
+	/* opcode 163: ADD with size 1 followed by COPY with size 4 */
+	uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x04, 0x00, 0x08, 0x05, 0x00, 0x00, 0x03, 0x00, 0xA3, 0x58, 0x00};
+	vcdiff_t ctx;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	expect_target_write(0, 0x42, ctx.buffer, 0, 1);
+	for (uint32_t offset = 0; offset < 4; offset += VCDIFF_BUFFER_SIZE) {
+		uint32_t chunk = (4 - offset > VCDIFF_BUFFER_SIZE) ? VCDIFF_BUFFER_SIZE : 4 - offset;
+		expect_source_read(0, 0x43, ctx.buffer, offset, chunk);
+		expect_target_write(0, 0x42, ctx.buffer, 1 + offset, chunk);
+	}
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+}
+
+static void test_vcdiff_checkpoint (void **state) {
+	(void) state;
+	uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x81, 0x89, 0x28, 0x00, 0x1D, 0x81, 0x89, 0x28, 0x00, 0x00, 0x16, 0x00, 0x11, 0x52, 0x49, 0x4F, 0x54, 0xDF, 0x1A, 0x99, 0x60, 0x00, 0x14, 0x00, 0x08, 0x1A, 0x35, 0xC3, 0x1A, 0x13, 0x81, 0x89, 0x18, 0x10};
+	uint8_t checkpoint[VCDIFF_CHECKPOINT_MAX_LEN];
+	vcdiff_t ctx;
+	int len;
+
+	/* process the headers and take a checkpoint */
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver_full, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	expect_target_erase(0, 0x42, 0, 0x44a8);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, 18), 0);
+	assert_int_equal(ctx.delta_offset, 18);
+	len = vcdiff_checkpoint_save(&ctx, checkpoint, sizeof(checkpoint));
+	assert_in_range(len, 1, sizeof(checkpoint));
+	assert_int_equal(vcdiff_checkpoint_save(&ctx, checkpoint, 10), -1);
+	assert_string_equal("Checkpoint buffer too small", vcdiff_error_str(&ctx));
+
+	/* no checkpoints while ADD data is buffered */
+	if (VCDIFF_BUFFER_SIZE > 3) {
+		assert_int_equal(vcdiff_apply_delta(&ctx, &data[18], 4), 0);
+		assert_int_equal(vcdiff_checkpoint_save(&ctx, checkpoint + len, sizeof(checkpoint) - len), -1);
+		assert_string_equal("Cannot checkpoint while ADD data is buffered", vcdiff_error_str(&ctx));
+	}
+
+	/* resume from the checkpoint with a fresh context */
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver_full, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), 0);
+	assert_string_equal("STATE_WIN_BODY_INST", vcdiff_state_str(&ctx));
+	assert_int_equal(ctx.delta_offset, 18);
+	assert_int_equal(ctx.win_window_len, 0x44a8);
+	uint32_t remaining = 0x10;
+	uint32_t offset = 0x0;
+	while (remaining) {
+		uint32_t chunk = remaining > VCDIFF_BUFFER_SIZE ? VCDIFF_BUFFER_SIZE : remaining;
+		expect_target_write(0, 0x42, ctx.buffer, offset, chunk);
+		remaining -= chunk;
+		offset += chunk;
+	}
+	remaining = 0x4498;
+	while (remaining) {
+		uint32_t chunk = remaining > VCDIFF_BUFFER_SIZE ? VCDIFF_BUFFER_SIZE : remaining;
+		expect_source_read(0, 0x43, ctx.buffer, offset, chunk);
+		expect_target_write(0, 0x42, ctx.buffer, offset, chunk);
+		remaining -= chunk;
+		offset += chunk;
+	}
+	assert_int_equal(vcdiff_apply_delta(&ctx, &data[ctx.delta_offset], sizeof(data) - ctx.delta_offset), 0);
+	assert_int_equal(ctx.delta_offset, sizeof(data));
+	expect_target_flush(0, 0x42);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+
+	/* reject corrupted checkpoints */
+	checkpoint[len / 2] ^= 0x01;
+	vcdiff_init(&ctx);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+	assert_string_equal("Corrupted checkpoint", vcdiff_error_str(&ctx));
+	assert_string_equal("STATE_ERR", vcdiff_state_str(&ctx));
+	checkpoint[0] = 0x00;
+	vcdiff_init(&ctx);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), -1);
+	assert_string_equal("Incompatible checkpoint", vcdiff_error_str(&ctx));
+}
+
+/* target kept in memory */
+static uint8_t mem[300];
+static size_t mem_erase_offset;
+static size_t mem_erase_len;
+static size_t mem_written;
+static size_t mem_reads;
+
+static int mem_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(mem));
+	memcpy(dest, &mem[offset], len);
+	mem_reads++;
+	return 0;
+}
+
+static int mem_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(mem));
+	memcpy(&mem[offset], src, len);
+	mem_written += len;
+	return 0;
+}
+
+static int mem_erase (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(mem));
+	memset(&mem[offset], 0xff, len);
+
+	/* erases are expected to form one range */
+	if (mem_erase_len == 0) mem_erase_offset = offset;
+	assert_int_equal(offset, mem_erase_offset + mem_erase_len);
+	mem_erase_len += len;
+	return 0;
+}
+
+static const vcdiff_driver_t mem_driver = {
+	.read = mem_read,
+	.write = mem_write,
+	.erase = mem_erase
+};
+
+/* three windows of 100 bytes: RUN 0x11; ADD "abc" + RUN 0x22; RUN 0x33 */
+static const uint8_t runs_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+	0x00, 0x0C, 0x64, 0x00, 0x00, 0x07, 0x00, 0x04, 0x61, 0x62, 0x63, 0x00, 0x61, 0x22,
+	0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x33};
+
+static void runs_expected (uint8_t *expected) {
+	memset(expected, 0x11, 100);
+	memcpy(&expected[100], "abc", 3);
+	memset(&expected[103], 0x22, 97);
+	memset(&expected[200], 0x33, 100);
+}
+
+static void test_vcdiff_write_if_different (void **state) {
+	(void) state;
+	uint8_t expected[300];
+	vcdiff_t ctx;
+
+	runs_expected(expected);
+
+	/* only a single byte in the second window differs */
+	memcpy(mem, expected, sizeof(mem));
+	mem[150] = 0x00;
+	mem_erase_len = 0;
+	mem_written = 0;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_WRITE_IF_DIFFERENT);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, sizeof(runs_delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(mem, expected, sizeof(mem));
+
+	/* the rest of the second window is erased from the first differing chunk */
+	assert_in_range(mem_erase_offset, 103, 150);
+	assert_int_equal(mem_erase_offset + mem_erase_len, 200);
+	assert_int_equal(mem_written, mem_erase_len);
+}
+
+static void test_vcdiff_hash (void **state) {
+	(void) state;
+	uint8_t sha256[] = {0x77, 0x43, 0x5a, 0x0a, 0x6d, 0x06, 0xf8, 0x1d, 0x0f, 0xd6, 0x6e, 0x75, 0xea, 0x55, 0xe5, 0x76,
+	                    0xe6, 0xd4, 0x48, 0x2a, 0x52, 0xee, 0xf4, 0xef, 0xde, 0x5c, 0xd7, 0x2b, 0xc0, 0xab, 0xba, 0x89};
+	uint8_t crc32[] = {0x47, 0x4b, 0x79, 0x34};
+	uint8_t checkpoint[VCDIFF_CHECKPOINT_MAX_LEN];
+	vcdiff_t ctx;
+	int len;
+
+	mem_erase_len = 0;
+	vcdiff_init(&ctx);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_SHA256, sha256);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, sizeof(runs_delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(ctx.digest, sha256, sizeof(sha256));
+
+	/* the hash state survives checkpoints */
+	mem_erase_len = 0;
+	vcdiff_init(&ctx);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, NULL);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, 15), 0);
+	len = vcdiff_checkpoint_save(&ctx, checkpoint, sizeof(checkpoint));
+	assert_in_range(len, 1, sizeof(checkpoint));
+	mem_erase_len = 0;
+	vcdiff_init(&ctx);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, crc32);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), 0);
+	assert_int_equal(vcdiff_apply_delta(&ctx, &runs_delta[15], sizeof(runs_delta) - 15), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(ctx.digest, crc32, sizeof(crc32));
+
+	/* mismatches fail the operation */
+	crc32[3] ^= 0x01;
+	mem_erase_len = 0;
+	vcdiff_init(&ctx);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, crc32);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, sizeof(runs_delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), -1);
+	assert_string_equal("Target hash mismatch", vcdiff_error_str(&ctx));
+}
+
+static void test_vcdiff_budget (void **state) {
+	(void) state;
+	uint8_t expected[300];
+	vcdiff_t ctx;
+	size_t pos = 0;
+	size_t calls = 0;
+	int rc;
+
+	runs_expected(expected);
+	memset(mem, 0x00, sizeof(mem));
+	mem_erase_len = 0;
+	mem_written = 0;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	do {
+		size_t written = mem_written;
+		size_t consumed;
+		rc = vcdiff_apply_delta_budget(&ctx, &runs_delta[pos], sizeof(runs_delta) - pos, 7, &consumed);
+		assert_true(rc >= 0);
+		assert_true(mem_written - written <= 7);
+		pos += consumed;
+		calls++;
+	} while (rc == VCDIFF_YIELD);
+	assert_int_equal(pos, sizeof(runs_delta));
+	assert_int_equal(ctx.delta_offset, sizeof(runs_delta));
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(mem, expected, sizeof(mem));
+	assert_in_range(calls, 300 / 7, 300 / 7 + 4);
+}
+
+/* every other write would block */
+static size_t busy_writes;
+
+static int busy_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	if (busy_writes++ % 2 == 0) return VCDIFF_AGAIN;
+	return mem_write(dev, src, offset, len);
+}
+
+static const vcdiff_driver_t busy_driver = {
+	.read = mem_read,
+	.write = busy_write,
+	.erase = mem_erase
+};
+
+static void test_vcdiff_again (void **state) {
+	(void) state;
+	uint8_t expected[300];
+	uint8_t crc32[] = {0x47, 0x4b, 0x79, 0x34};
+	uint8_t buf[2];
+	vcdiff_t ctx;
+	size_t pos = 0;
+	size_t yields = 0;
+	int rc;
+
+	runs_expected(expected);
+	memset(mem, 0x00, sizeof(mem));
+	mem_erase_len = 0;
+	mem_written = 0;
+	busy_writes = 0;
+
+	/* a tiny external buffer splits the ADD, so it blocks in the middle */
+	vcdiff_init(&ctx);
+	vcdiff_set_buffer(&ctx, buf, sizeof(buf));
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, crc32);
+	vcdiff_set_target_driver(&ctx, &busy_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	do {
+		size_t consumed;
+		rc = vcdiff_apply_delta_budget(&ctx, &runs_delta[pos], sizeof(runs_delta) - pos, SIZE_MAX, &consumed);
+		assert_true(rc >= 0);
+		pos += consumed;
+		if (rc == VCDIFF_YIELD) yields++;
+	} while (rc == VCDIFF_YIELD);
+	assert_int_equal(pos, sizeof(runs_delta));
+	/* 2 byte chunks; "abc" is split into 2 + 1 bytes */
+	assert_int_equal(yields, 151);
+	assert_int_equal(mem_written, sizeof(mem));
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(mem, expected, sizeof(mem));
+}
+
+static void test_vcdiff_verify (void **state) {
+	(void) state;
+	uint8_t expected[300];
+	vcdiff_t ctx;
+
+	runs_expected(expected);
+	memcpy(mem, expected, sizeof(mem));
+	mem_erase_len = 0;
+	mem_written = 0;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_VERIFY);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, sizeof(runs_delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_int_equal(ctx.mismatch_offset, VCDIFF_OFF_MAX);
+
+	/* stop at the first difference */
+	mem[150] = 0x00;
+	mem[250] = 0x00;
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_VERIFY);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, runs_delta, sizeof(runs_delta)), -1);
+	assert_string_equal("Target differs", vcdiff_error_str(&ctx));
+	assert_int_equal(ctx.mismatch_offset, 150);
+
+	/* nothing has been touched */
+	assert_int_equal(mem_erase_len, 0);
+	assert_int_equal(mem_written, 0);
+}
+
+static void test_vcdiff_alias (void **state) {
+	(void) state;
+	/* COPY 50 from source 0; ADD "abcdefghij"; COPY 40 from source 60 */
+	uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x01, 0x64, 0x00, 0x16, 0x64, 0x00, 0x00, 0x11, 0x00,
+		0x13, 0x32, 0x00,
+		0x0B, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A,
+		0x13, 0x28, 0x3C};
+	uint8_t expected[100];
+	vcdiff_t ctx;
+
+	for (size_t i = 0; i < sizeof(mem); i++) mem[i] = i;
+	memcpy(expected, mem, sizeof(expected));
+	memcpy(&expected[50], "abcdefghij", 10);
+	mem_erase_len = 0;
+	mem_written = 0;
+	mem_reads = 0;
+
+	/* in-place COPYs neither read, erase nor write */
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &mem_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(mem, expected, sizeof(expected));
+	assert_int_equal(mem_reads, 0);
+	assert_int_equal(mem_erase_offset, 50);
+	assert_int_equal(mem_erase_len, 10);
+	assert_int_equal(mem_written, 10);
+
+	/* hashing reads in-place data, but still doesn't write it */
+	uint8_t crc32[] = {0xec, 0xf6, 0x97, 0x3d};
+	for (size_t i = 0; i < sizeof(mem); i++) mem[i] = i;
+	mem_erase_len = 0;
+	mem_written = 0;
+	mem_reads = 0;
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_hash(&ctx, VCDIFF_HASH_CRC32, crc32);
+	vcdiff_set_target_driver(&ctx, &mem_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &mem_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(mem, expected, sizeof(expected));
+	assert_true(mem_reads > 0);
+	assert_int_equal(mem_written, 10);
+}
+
+static void test_vcdiff_empty_window (void **state) {
+	(void) state;
+	/* a single window producing nothing, e.g. for an empty file */
+	const uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x03, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00};
+	vcdiff_t ctx;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver_full, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	expect_target_erase(0, 0x42, 0, 0);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), 0);
+	expect_target_flush(0, 0x42);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_int_equal(ctx.target_offset, 0);
+}
+
+static void test_vcdiff_hot_fields (void **state) {
+	(void) state;
+	/* the fields touched by every instruction share the first cache line */
+	assert_true(offsetof(vcdiff_t, codetable) + sizeof(const vcdiff_codetable_t *) <= 64);
+	assert_true(offsetof(vcdiff_t, win_window_pos) + sizeof(vcdiff_off_t) <= 64);
+}
+
+#if VCDIFF_OFF_MAX > UINT32_MAX && !defined(VCDIFF_ADDR32)
+/* synthetic images larger than 4 GiB: the source is computed from the offset
+ * and only the window written at 5 GiB is kept */
+#define BIG_TARGET_OFFSET (UINT64_C(5) << 30)
+static uint8_t big_target[40];
+
+static uint8_t big_source_byte (vcdiff_off_t offset) {
+	return (uint8_t) (offset ^ (offset >> 29));
+}
+
+static int big_source_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	for (size_t i = 0; i < len; i++) dest[i] = big_source_byte(offset + i);
+	return 0;
+}
+
+static int big_target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset >= BIG_TARGET_OFFSET && offset - BIG_TARGET_OFFSET + len <= sizeof(big_target));
+	memcpy(dest, &big_target[offset - BIG_TARGET_OFFSET], len);
+	return 0;
+}
+
+static int big_target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset >= BIG_TARGET_OFFSET && offset - BIG_TARGET_OFFSET + len <= sizeof(big_target));
+	memcpy(&big_target[offset - BIG_TARGET_OFFSET], src, len);
+	return 0;
+}
+
+static int big_target_erase (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
+	(void) dev;
+	assert_true(offset == BIG_TARGET_OFFSET);
+	assert_true(len == sizeof(big_target));
+	memset(big_target, 0xff, sizeof(big_target));
+	return 0;
+}
+
+static const vcdiff_driver_t big_source_driver = {
+	.read = big_source_read
+};
+
+static const vcdiff_driver_t big_target_driver = {
+	.read = big_target_read,
+	.write = big_target_write,
+	.erase = big_target_erase
+};
+
+static void test_vcdiff_large_offsets (void **state) {
+	(void) state;
+	/* segment of 5 GiB + 16 at 6 GiB:
+	 * COPY 16 SELF 4 GiB + 0x123; COPY 8 SAME 2/0x23; COPY 8 NEAR 0 +16; COPY 8 SELF from the window */
+	const uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x01, 0x94, 0x80, 0x80, 0x80, 0x10, 0x98, 0x80, 0x80, 0x80, 0x00, 0x15, 0x28, 0x00, 0x00, 0x10, 0x00,
+		0x20, 0x90, 0x80, 0x80, 0x82, 0x23,
+		0x98, 0x23,
+		0x38, 0x10,
+		0x18, 0x94, 0x80, 0x80, 0x80, 0x10};
+	const vcdiff_off_t copy_offset = (UINT64_C(6) << 30) + (UINT64_C(4) << 30) + 0x123;
+	uint8_t checkpoint[VCDIFF_CHECKPOINT_MAX_LEN];
+	uint8_t expected[40];
+	vcdiff_t ctx;
+	int len;
+
+	big_source_read(NULL, expected, copy_offset, 16);
+	big_source_read(NULL, &expected[16], copy_offset, 8);
+	big_source_read(NULL, &expected[24], copy_offset + 16, 8);
+	memcpy(&expected[32], expected, 8);
+
+	/* the address cache and window bookkeeping survive checkpoints */
+	vcdiff_init(&ctx);
+	vcdiff_set_target_offset(&ctx, BIG_TARGET_OFFSET);
+	vcdiff_set_target_driver(&ctx, &big_target_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &big_source_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, 30), 0);
+	len = vcdiff_checkpoint_save(&ctx, checkpoint, sizeof(checkpoint));
+	assert_in_range(len, 1, sizeof(checkpoint));
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &big_target_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &big_source_driver, NULL);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), 0);
+	assert_true(ctx.target_offset == BIG_TARGET_OFFSET);
+	assert_int_equal(vcdiff_apply_delta(&ctx, &data[ctx.delta_offset], sizeof(data) - ctx.delta_offset), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_true(ctx.target_offset == BIG_TARGET_OFFSET + sizeof(big_target));
+	assert_memory_equal(big_target, expected, sizeof(expected));
+}
+#endif
+
+#if VCDIFF_OFF_MAX > UINT32_MAX && defined(VCDIFF_ADDR32)
+static void test_vcdiff_addr32_range (void **state) {
+	(void) state;
+	/* segment of 5 GiB + 16 at 6 GiB: its addresses don't fit into the cache */
+	const uint8_t data[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x01, 0x94, 0x80, 0x80, 0x80, 0x10, 0x98, 0x80, 0x80, 0x80, 0x00, 0x15, 0x28, 0x00, 0x00, 0x10, 0x00};
+	/* window of 4 GiB after a segment of 16 bytes */
+	const uint8_t data_window[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x01, 0x10, 0x00, 0x15, 0x90, 0x80, 0x80, 0x80, 0x00, 0x00, 0x00, 0x10, 0x00};
+	vcdiff_t ctx;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data, sizeof(data)), -1);
+	assert_string_equal("Window exceeds 32 bit address range", vcdiff_error_str(&ctx));
+
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, (void*) 0x42);
+	vcdiff_set_source_driver(&ctx, &source_driver, (void*) 0x43);
+	assert_int_equal(vcdiff_apply_delta(&ctx, data_window, sizeof(data_window)), -1);
+	assert_string_equal("Window exceeds 32 bit address range", vcdiff_error_str(&ctx));
+}
+#endif
+
 /* Missing tests:
 - RUN
 - 2nd INST
@@ -333,6 +985,25 @@ int main (void) {
 		cmocka_unit_test(test_vcdiff_win_header_seg),
 		cmocka_unit_test(test_vcdiff_win_body1),
 		cmocka_unit_test(test_vcdiff_win_body2),
+		cmocka_unit_test(test_vcdiff_codetable),
+		cmocka_unit_test(test_vcdiff_codetable_registered),
+		cmocka_unit_test(test_vcdiff_win_body_pair),
+		cmocka_unit_test(test_vcdiff_checkpoint),
+		cmocka_unit_test(test_vcdiff_checkpoint_setup),
+		cmocka_unit_test(test_vcdiff_write_if_different),
+		cmocka_unit_test(test_vcdiff_hash),
+		cmocka_unit_test(test_vcdiff_budget),
+		cmocka_unit_test(test_vcdiff_again),
+		cmocka_unit_test(test_vcdiff_verify),
+		cmocka_unit_test(test_vcdiff_alias),
+		cmocka_unit_test(test_vcdiff_empty_window),
+		cmocka_unit_test(test_vcdiff_hot_fields),
+#if VCDIFF_OFF_MAX > UINT32_MAX && !defined(VCDIFF_ADDR32)
+		cmocka_unit_test(test_vcdiff_large_offsets),
+#endif
+#if VCDIFF_OFF_MAX > UINT32_MAX && defined(VCDIFF_ADDR32)
+		cmocka_unit_test(test_vcdiff_addr32_range),
+#endif
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,93 @@
+#include "vcdiff/addrcache.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+static void test_vcdiff_addrcache_decode (void **state) {
+	(void) state;
+	vcdiff_cache_t cache;
+
+	vcdiff_addrcache_init(&cache, 4, 3);
+	assert_int_equal(vcdiff_addrcache_decode_self(&cache, 1000), 1000);
+	assert_int_equal(vcdiff_addrcache_decode_here(&cache, 3000, 1000), 2000);
+
+	/* near: mode 2 references the first slot */
+	assert_int_equal(vcdiff_addrcache_decode_near(&cache, 2, 10), 1010);
+	assert_int_equal(vcdiff_addrcache_decode_near(&cache, 3, 10), 2010);
+
+	/* same: 1000 is stored at 1000 % 768 = 232 */
+	assert_int_equal(vcdiff_addrcache_decode_same(&cache, 6, 232), 1000);
+	assert_int_equal(vcdiff_addrcache_decode_same(&cache, 7, 2010 % 768 - 256), 2010);
+}
+
+static void test_vcdiff_addrcache_reset (void **state) {
+	(void) state;
+	vcdiff_cache_t cache;
+
+	/* start with garbage to make sure init doesn't rely on zeroed memory */
+	memset(&cache, 0xa5, sizeof(cache));
+	vcdiff_addrcache_init(&cache, 4, 3);
+	for (size_t i = 0; i < VCDIFF_CACHE_SAME_SIZE * 256; i++) {
+		assert_int_equal(vcdiff_addrcache_get_same(&cache, i), 0);
+	}
+	for (size_t i = 0; i < VCDIFF_CACHE_NEAR_SIZE; i++) {
+		assert_int_equal(cache.near[i], 0);
+	}
+
+	/* entries of the previous window must vanish */
+	vcdiff_addrcache_update(&cache, 1000);
+	assert_int_equal(vcdiff_addrcache_get_same(&cache, 232), 1000);
+	vcdiff_addrcache_init(&cache, 4, 3);
+	assert_int_equal(vcdiff_addrcache_get_same(&cache, 232), 0);
+	assert_int_equal(vcdiff_addrcache_decode_same(&cache, 6, 232), 0);
+	assert_int_equal(cache.near[0], 0);
+}
+
+static void test_vcdiff_addrcache_get_mode (void **state) {
+	(void) state;
+	vcdiff_cache_t cache;
+
+	vcdiff_addrcache_init(&cache, 4, 3);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 0), VCDIFF_MODE_SELF);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 1), VCDIFF_MODE_HERE);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 2), VCDIFF_MODE_NEAR);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 5), VCDIFF_MODE_NEAR);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 6), VCDIFF_MODE_SAME);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 8), VCDIFF_MODE_SAME);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 9), VCDIFF_MODE_ERROR);
+}
+
+static void test_vcdiff_addrcache_custom_size (void **state) {
+	(void) state;
+	vcdiff_cache_t cache;
+
+	/* code tables given in the header may shrink the caches */
+	vcdiff_addrcache_init(&cache, 1, 1);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 2), VCDIFF_MODE_NEAR);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 3), VCDIFF_MODE_SAME);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 4), VCDIFF_MODE_ERROR);
+
+	assert_int_equal(vcdiff_addrcache_decode_self(&cache, 300), 300);
+	assert_int_equal(vcdiff_addrcache_decode_self(&cache, 500), 500);
+	assert_int_equal(vcdiff_addrcache_decode_near(&cache, 2, 1), 501);
+	assert_int_equal(vcdiff_addrcache_decode_same(&cache, 3, 501 % 256), 501);
+
+	/* no caches at all */
+	vcdiff_addrcache_init(&cache, 0, 0);
+	assert_int_equal(vcdiff_addrcache_get_mode(&cache, 2), VCDIFF_MODE_ERROR);
+	assert_int_equal(vcdiff_addrcache_decode_self(&cache, 300), 300);
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_addrcache_decode),
+		cmocka_unit_test(test_vcdiff_addrcache_reset),
+		cmocka_unit_test(test_vcdiff_addrcache_get_mode),
+		cmocka_unit_test(test_vcdiff_addrcache_custom_size),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
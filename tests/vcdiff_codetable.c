@@ -148,7 +148,7 @@ static const uint8_t codetable[6][256] =
 static void test_vcdiff_codtable_decode (void **state) {
 	(void) state;
 	uint8_t inst0, inst1;
-	size_t size0, size1;
+	vcdiff_off_t size0, size1;
 	uint8_t mode0, mode1;
 	for (size_t i = 0; i <= 255; i++) {
 		vcdiff_codetable_decode(&inst0, &size0, &mode0,
@@ -162,9 +162,31 @@ static void test_vcdiff_codtable_decode (void **state) {
 	}
 }
 
+static void test_vcdiff_codtable_encode (void **state) {
+	(void) state;
+	uint8_t inst0, inst1;
+	vcdiff_off_t size0, size1;
+	uint8_t mode0, mode1;
+	const uint8_t insts[] = {VCDIFF_INST_ADD, VCDIFF_INST_RUN, VCDIFF_INST_COPY};
+	for (size_t i = 0; i < sizeof(insts); i++) {
+		for (uint8_t mode = 0; mode < ((insts[i] == VCDIFF_INST_COPY) ? 9 : 1); mode++) {
+			for (size_t size = 0; size < 32; size++) {
+				uint8_t code = vcdiff_codetable_encode(insts[i], size, mode);
+				vcdiff_codetable_decode(&inst0, &size0, &mode0,
+				                        &inst1, &size1, &mode1, code);
+				assert_int_equal(inst0, insts[i]);
+				assert_int_equal(inst1, VCDIFF_INST_NOP);
+				assert_int_equal(mode0, mode);
+				assert_true(size0 == 0 || size0 == size);
+			}
+		}
+	}
+}
+
 int main (void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_vcdiff_codtable_decode),
+		cmocka_unit_test(test_vcdiff_codtable_encode),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,460 @@
+#include "vcdiff.h"
+#include "vcdiff/flash.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#define BLOCK_SIZE 256
+#define PAGE_SIZE 64
+#define FLASH_SIZE (4 * BLOCK_SIZE)
+
+/* simulated NOR flash: programming can only clear bits */
+static uint8_t sim_mem[FLASH_SIZE];
+static size_t sim_erases[FLASH_SIZE / BLOCK_SIZE];
+
+static int sim_busy;
+
+static int sim_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	/* no read-while-write */
+	assert_int_equal(sim_busy, 0);
+	assert_true(offset + len <= FLASH_SIZE);
+	memcpy(dest, &sim_mem[offset], len);
+	return 0;
+}
+
+static int sim_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_int_equal(offset % PAGE_SIZE, 0);
+	assert_int_equal(len, PAGE_SIZE);
+	assert_true(offset + len <= FLASH_SIZE);
+	for (size_t i = 0; i < len; i++) {
+		assert_int_equal(sim_mem[offset + i] & src[i], src[i]);
+		sim_mem[offset + i] = src[i];
+	}
+	return 0;
+}
+
+static int sim_erase (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
+	(void) dev;
+	assert_int_equal(offset % BLOCK_SIZE, 0);
+	assert_int_equal(len % BLOCK_SIZE, 0);
+	assert_true(offset + len <= FLASH_SIZE);
+	memset(&sim_mem[offset], 0xff, len);
+	for (size_t i = offset / BLOCK_SIZE; i < (offset + len) / BLOCK_SIZE; i++) {
+		sim_erases[i]++;
+	}
+	return 0;
+}
+
+static const vcdiff_driver_t sim_driver = {
+	.read = sim_read,
+	.write = sim_write,
+	.erase = sim_erase
+};
+
+/* background erase finishing after a few polls */
+#define SIM_ERASE_POLLS 3
+static size_t sim_erase_offset;
+static size_t sim_erase_len;
+
+static int sim_erase_start (void *dev, vcdiff_off_t offset, vcdiff_off_t len) {
+	(void) dev;
+	assert_int_equal(sim_busy, 0);
+	assert_int_equal(offset % BLOCK_SIZE, 0);
+	assert_int_equal(len % BLOCK_SIZE, 0);
+	sim_erase_offset = offset;
+	sim_erase_len = len;
+	sim_busy = SIM_ERASE_POLLS;
+	return 0;
+}
+
+static int sim_erase_busy (void *dev) {
+	assert_true(sim_busy > 0);
+	if (--sim_busy > 0) return 1;
+	return sim_erase(dev, sim_erase_offset, sim_erase_len);
+}
+
+static const vcdiff_flash_async_t sim_async = {
+	.erase_start = sim_erase_start,
+	.erase_busy = sim_erase_busy
+};
+
+static int source_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) dest;
+	(void) offset;
+	(void) len;
+	return -1;
+}
+
+static const vcdiff_driver_t source_driver = {
+	.read = source_read
+};
+
+static void sim_reset (void) {
+	memset(sim_mem, 0x00, sizeof(sim_mem));
+	memset(sim_erases, 0, sizeof(sim_erases));
+	sim_busy = 0;
+}
+
+static void test_vcdiff_flash_erase (void **state) {
+	(void) state;
+	uint8_t page[PAGE_SIZE];
+	uint8_t stage[BLOCK_SIZE];
+	vcdiff_flash_t flash;
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+
+	/* windows sharing a block erase it once */
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 0, 100), 0);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 100, 100), 0);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 200, 100), 0);
+	assert_int_equal(flash.erase_cnt, 2);
+	assert_int_equal(sim_erases[0], 1);
+	assert_int_equal(sim_erases[1], 1);
+	assert_int_equal(sim_erases[2], 0);
+
+	/* a distant window starts a new erased area; the data in front of it needs a stage buffer */
+	assert_true(vcdiff_flash_driver.erase(&flash, 3 * BLOCK_SIZE + 10, 10) < 0);
+	assert_int_equal(sim_erases[3], 0);
+	vcdiff_flash_set_stage(&flash, stage);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 3 * BLOCK_SIZE + 10, 10), 0);
+	assert_int_equal(flash.erase_cnt, 3);
+	assert_int_equal(flash.keep_cnt, 1);
+	assert_int_equal(sim_erases[3], 1);
+	assert_int_equal(vcdiff_flash_driver.flush(&flash), 0);
+	assert_int_equal(sim_mem[3 * BLOCK_SIZE + 9], 0x00);
+	assert_int_equal(sim_mem[3 * BLOCK_SIZE + 10], 0xff);
+}
+
+static void test_vcdiff_flash_write (void **state) {
+	(void) state;
+	uint8_t page[PAGE_SIZE];
+	uint8_t data[3 * PAGE_SIZE];
+	uint8_t buf[3 * PAGE_SIZE];
+	vcdiff_flash_t flash;
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = i;
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 0, sizeof(data)), 0);
+
+	/* partial page: buffered, but readable */
+	assert_int_equal(vcdiff_flash_driver.write(&flash, data, 0, 10), 0);
+	assert_int_equal(flash.program_cnt, 0);
+	assert_int_equal(flash.readback_cnt, 1);
+	assert_int_equal(vcdiff_flash_driver.read(&flash, buf, 5, 10), 0);
+	assert_memory_equal(buf, &data[5], 5);
+	assert_int_equal(buf[5], 0xff);
+
+	/* completing the page programs it; the next whole page bypasses the buffer */
+	assert_int_equal(vcdiff_flash_driver.write(&flash, &data[10], 10, 2 * PAGE_SIZE - 10 + 5), 0);
+	assert_int_equal(flash.program_cnt, 2);
+	assert_int_equal(flash.readback_cnt, 2);
+
+	/* the remainder is programmed on flush */
+	assert_int_equal(vcdiff_flash_driver.write(&flash, &data[2 * PAGE_SIZE + 5], 2 * PAGE_SIZE + 5, PAGE_SIZE - 5), 0);
+	assert_int_equal(flash.program_cnt, 3);
+	assert_int_equal(vcdiff_flash_driver.flush(&flash), 0);
+	assert_int_equal(flash.program_cnt, 3);
+	assert_memory_equal(sim_mem, data, sizeof(data));
+}
+
+static void test_vcdiff_flash_erase_ahead (void **state) {
+	(void) state;
+	uint8_t page[PAGE_SIZE];
+	uint8_t data[FLASH_SIZE];
+	vcdiff_flash_t flash;
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = i ^ (i >> 8);
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_flash_set_async(&flash, &sim_async);
+
+	/* the erase is only started */
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 0, sizeof(data)), 0);
+	assert_int_equal(flash.erase_cnt, 0);
+	assert_true(flash.erasing);
+
+	/* only the first block is waited for; the others are erased while writing */
+	for (size_t i = 0; i < sizeof(data); i += PAGE_SIZE) {
+		assert_int_equal(vcdiff_flash_driver.write(&flash, &data[i], i, PAGE_SIZE), 0);
+	}
+	assert_int_equal(vcdiff_flash_driver.flush(&flash), 0);
+	assert_int_equal(flash.erase_stalls, 1);
+	assert_int_equal(flash.erase_cnt, 4);
+	assert_int_equal(flash.program_cnt, 16);
+	assert_false(flash.erasing);
+	assert_memory_equal(sim_mem, data, sizeof(data));
+	for (size_t i = 0; i < FLASH_SIZE / BLOCK_SIZE; i++) {
+		assert_int_equal(sim_erases[i], 1);
+	}
+}
+
+static void test_vcdiff_flash_read_erasing (void **state) {
+	(void) state;
+	uint8_t page[PAGE_SIZE];
+	uint8_t data[PAGE_SIZE];
+	uint8_t buf[PAGE_SIZE];
+	vcdiff_flash_t flash;
+
+	memset(data, 0x5a, sizeof(data));
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_flash_set_async(&flash, &sim_async);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 0, 2 * BLOCK_SIZE), 0);
+	assert_int_equal(vcdiff_flash_driver.write(&flash, data, 0, PAGE_SIZE), 0);
+	assert_true(flash.erasing);
+
+	/* reading back waits for the erase of the next block */
+	assert_int_equal(vcdiff_flash_driver.read(&flash, buf, 0, PAGE_SIZE), 0);
+	assert_false(flash.erasing);
+	assert_memory_equal(buf, data, sizeof(data));
+	assert_int_equal(flash.erase_cnt, 2);
+}
+
+static void test_vcdiff_flash_write_unaligned_async (void **state) {
+	(void) state;
+	uint8_t page[PAGE_SIZE];
+	uint8_t data[FLASH_SIZE];
+	vcdiff_flash_t flash;
+
+	for (size_t i = 0; i < sizeof(data); i++) data[i] = i ^ (i >> 8);
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_flash_set_async(&flash, &sim_async);
+	assert_int_equal(vcdiff_flash_driver.erase(&flash, 0, sizeof(data)), 0);
+
+	/* partial pages are read back, which sim_read only allows while no erase is running */
+	for (size_t i = 0, len = 10; i < sizeof(data); i += len, len = (len * 7) % 97 + 1) {
+		if (len > sizeof(data) - i) len = sizeof(data) - i;
+		assert_int_equal(vcdiff_flash_driver.write(&flash, &data[i], i, len), 0);
+	}
+	assert_int_equal(vcdiff_flash_driver.flush(&flash), 0);
+	assert_true(flash.readback_cnt > 0);
+	assert_int_equal(flash.erase_cnt, 4);
+	assert_memory_equal(sim_mem, data, sizeof(data));
+}
+
+static void decode (bool async) {
+	/* three windows of 100 bytes: RUN 0x11; ADD "abc" + RUN 0x22; RUN 0x33 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+		0x00, 0x0C, 0x64, 0x00, 0x00, 0x07, 0x00, 0x04, 0x61, 0x62, 0x63, 0x00, 0x61, 0x22,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x33};
+	uint8_t expected[300];
+	uint8_t page[PAGE_SIZE];
+	vcdiff_flash_t flash;
+	static vcdiff_t ctx;
+
+	memset(expected, 0x11, 100);
+	memcpy(&expected[100], "abc", 3);
+	memset(&expected[103], 0x22, 97);
+	memset(&expected[200], 0x33, 100);
+
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	if (async) vcdiff_flash_set_async(&flash, &sim_async);
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &vcdiff_flash_driver, &flash);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, delta, sizeof(delta)), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+
+	assert_memory_equal(sim_mem, expected, sizeof(expected));
+	assert_int_equal(sim_mem[sizeof(expected)], 0xff);
+	assert_int_equal(sim_erases[0], 1);
+	assert_int_equal(sim_erases[1], 1);
+	assert_int_equal(flash.erase_cnt, 2);
+	assert_int_equal(flash.program_cnt, 5);
+}
+
+static void test_vcdiff_flash_decode (void **state) {
+	(void) state;
+	decode(false);
+}
+
+static void test_vcdiff_flash_decode_async (void **state) {
+	(void) state;
+	decode(true);
+}
+
+static int decode_resume (bool resume) {
+	/* two windows of 100 bytes in one block: RUN 0x11; RUN 0x22 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x22};
+	uint8_t checkpoint[VCDIFF_CHECKPOINT_MAX_LEN];
+	uint8_t page[PAGE_SIZE];
+	vcdiff_off_t erased_until;
+	vcdiff_flash_t flash;
+	static vcdiff_t ctx;
+	int len, rc;
+
+	/* checkpoint at the window boundary */
+	sim_reset();
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &vcdiff_flash_driver, &flash);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, delta, 15), 0);
+	assert_int_equal(vcdiff_flash_driver.flush(&flash), 0);
+	len = vcdiff_checkpoint_save(&ctx, checkpoint, sizeof(checkpoint));
+	assert_true(len > 0);
+	erased_until = flash.erased_until;
+
+	/* reboot */
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	if (resume) vcdiff_flash_resume(&flash, erased_until);
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &vcdiff_flash_driver, &flash);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+	assert_int_equal(vcdiff_checkpoint_restore(&ctx, checkpoint, len), 0);
+	rc = vcdiff_apply_delta(&ctx, &delta[ctx.delta_offset], sizeof(delta) - ctx.delta_offset);
+	if (rc < 0) return rc;
+	return vcdiff_finish(&ctx);
+}
+
+static void test_vcdiff_flash_resume (void **state) {
+	(void) state;
+	uint8_t expected[200];
+
+	memset(expected, 0x11, 100);
+	memset(&expected[100], 0x22, 100);
+
+	/* the block of the first window isn't erased again */
+	assert_int_equal(decode_resume(true), 0);
+	assert_memory_equal(sim_mem, expected, sizeof(expected));
+	assert_int_equal(sim_erases[0], 1);
+
+	/* a fresh adapter would wipe the first window */
+	assert_true(decode_resume(false) < 0);
+	assert_int_equal(sim_erases[0], 1);
+}
+
+static int decode_write_if_different (uint8_t *stage) {
+	/* one window of 512 bytes: RUN 0x11 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x00, 0x0A, 0x84, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x84, 0x00, 0x11};
+	uint8_t page[PAGE_SIZE];
+	uint8_t buf[128];
+	vcdiff_flash_t flash;
+	static vcdiff_t ctx;
+	int rc;
+
+	/* the target differs in the second chunk only */
+	sim_reset();
+	memset(sim_mem, 0x11, 2 * BLOCK_SIZE);
+	sim_mem[100] = 0x10;
+
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_flash_set_stage(&flash, stage);
+	vcdiff_init(&ctx);
+	vcdiff_set_buffer(&ctx, buf, sizeof(buf));
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_WRITE_IF_DIFFERENT);
+	vcdiff_set_target_driver(&ctx, &vcdiff_flash_driver, &flash);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+	rc = vcdiff_apply_delta(&ctx, delta, sizeof(delta));
+	if (rc < 0) return rc;
+	rc = vcdiff_finish(&ctx);
+	if (rc < 0) return rc;
+
+	assert_int_equal(flash.keep_cnt, 1);
+	return 0;
+}
+
+static void test_vcdiff_flash_write_if_different (void **state) {
+	(void) state;
+	uint8_t stage[BLOCK_SIZE];
+	uint8_t expected[2 * BLOCK_SIZE];
+
+	/* the erase starts at the second chunk, the first one is kept */
+	memset(expected, 0x11, sizeof(expected));
+	assert_int_equal(decode_write_if_different(stage), 0);
+	assert_memory_equal(sim_mem, expected, sizeof(expected));
+	assert_int_equal(sim_erases[0], 1);
+	assert_int_equal(sim_erases[1], 1);
+
+	/* without a stage buffer, the first chunk would be lost */
+	assert_true(decode_write_if_different(NULL) < 0);
+	assert_int_equal(sim_erases[0], 0);
+}
+
+static int decode_alias (uint8_t *stage) {
+	/* COPY 250 from 0; RUN 20 0x22; COPY 10 from 400; COPY 232 from 280 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x01, 0x84, 0x00, 0x00, 0x16, 0x84, 0x00, 0x00, 0x00, 0x10, 0x00,
+		0x13, 0x81, 0x7A, 0x00,
+		0x00, 0x14, 0x22,
+		0x13, 0x0A, 0x83, 0x10,
+		0x13, 0x81, 0x68, 0x82, 0x18};
+	uint8_t page[PAGE_SIZE];
+	vcdiff_flash_t flash;
+	static vcdiff_t ctx;
+	int rc;
+
+	sim_reset();
+	for (size_t i = 0; i < 2 * BLOCK_SIZE; i++) sim_mem[i] = i ^ (i >> 8);
+
+	vcdiff_flash_init(&flash, &sim_driver, NULL, BLOCK_SIZE, PAGE_SIZE, page);
+	vcdiff_flash_set_stage(&flash, stage);
+	vcdiff_flash_set_alias(&flash, true);
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_ALIAS);
+	vcdiff_set_target_driver(&ctx, &vcdiff_flash_driver, &flash);
+	vcdiff_set_source_driver(&ctx, &vcdiff_flash_driver, &flash);
+	rc = vcdiff_apply_delta(&ctx, delta, sizeof(delta));
+	if (rc < 0) return rc;
+	rc = vcdiff_finish(&ctx);
+	if (rc < 0) return rc;
+
+	assert_int_equal(flash.keep_cnt, 2);
+	assert_int_equal(flash.erase_cnt, 2);
+	return 0;
+}
+
+static void test_vcdiff_flash_alias (void **state) {
+	(void) state;
+	uint8_t stage[BLOCK_SIZE];
+	uint8_t expected[2 * BLOCK_SIZE];
+
+	for (size_t i = 0; i < sizeof(expected); i++) expected[i] = i ^ (i >> 8);
+	memset(&expected[250], 0x22, 20);
+	for (size_t i = 0; i < 10; i++) expected[270 + i] = (400 + i) ^ ((400 + i) >> 8);
+
+	/* the skipped data around the written ranges survives the block erases */
+	assert_int_equal(decode_alias(stage), 0);
+	assert_memory_equal(sim_mem, expected, sizeof(expected));
+	assert_int_equal(sim_erases[0], 1);
+	assert_int_equal(sim_erases[1], 1);
+
+	/* without a stage buffer, it would be lost */
+	assert_true(decode_alias(NULL) < 0);
+	assert_int_equal(sim_erases[0], 0);
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_flash_erase),
+		cmocka_unit_test(test_vcdiff_flash_write),
+		cmocka_unit_test(test_vcdiff_flash_erase_ahead),
+		cmocka_unit_test(test_vcdiff_flash_read_erasing),
+		cmocka_unit_test(test_vcdiff_flash_write_unaligned_async),
+		cmocka_unit_test(test_vcdiff_flash_decode),
+		cmocka_unit_test(test_vcdiff_flash_decode_async),
+		cmocka_unit_test(test_vcdiff_flash_resume),
+		cmocka_unit_test(test_vcdiff_flash_write_if_different),
+		cmocka_unit_test(test_vcdiff_flash_alias),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,70 @@
+#include "vcdiff/hash.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+static void test_vcdiff_hash_crc32 (void **state) {
+	(void) state;
+	uint8_t digest[VCDIFF_HASH_MAX_LEN];
+	uint8_t expected[] = {0xcb, 0xf4, 0x39, 0x26};
+	vcdiff_hash_t hash;
+
+	vcdiff_hash_init(&hash, VCDIFF_HASH_CRC32);
+	vcdiff_hash_update(&hash, (const uint8_t *) "1234", 4);
+	vcdiff_hash_update(&hash, (const uint8_t *) "56789", 5);
+	assert_int_equal(vcdiff_hash_final(&hash, digest), 4);
+	assert_memory_equal(digest, expected, sizeof(expected));
+}
+
+static void test_vcdiff_hash_sha256 (void **state) {
+	(void) state;
+	uint8_t digest[VCDIFF_HASH_MAX_LEN];
+	uint8_t expected_empty[] = {0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+	                            0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55};
+	uint8_t expected_abc[] = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	                          0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+	uint8_t expected_56[] = {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+	                         0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1};
+	uint8_t expected_million[] = {0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+	                              0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0};
+	const char *msg56 = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	uint8_t a[1000];
+	vcdiff_hash_t hash;
+
+	vcdiff_hash_init(&hash, VCDIFF_HASH_SHA256);
+	assert_int_equal(vcdiff_hash_final(&hash, digest), 32);
+	assert_memory_equal(digest, expected_empty, 32);
+
+	vcdiff_hash_init(&hash, VCDIFF_HASH_SHA256);
+	vcdiff_hash_update(&hash, (const uint8_t *) "abc", 3);
+	vcdiff_hash_final(&hash, digest);
+	assert_memory_equal(digest, expected_abc, 32);
+
+	/* padding spills into a second block */
+	vcdiff_hash_init(&hash, VCDIFF_HASH_SHA256);
+	vcdiff_hash_update(&hash, (const uint8_t *) msg56, strlen(msg56));
+	vcdiff_hash_final(&hash, digest);
+	assert_memory_equal(digest, expected_56, 32);
+
+	/* updates not aligned to blocks */
+	memset(a, 'a', sizeof(a));
+	vcdiff_hash_init(&hash, VCDIFF_HASH_SHA256);
+	for (size_t i = 0, n = 1; i < 1000000; i += n, n = (n % 997) + 1) {
+		if (i + n > 1000000) n = 1000000 - i;
+		vcdiff_hash_update(&hash, a, n);
+	}
+	vcdiff_hash_final(&hash, digest);
+	assert_memory_equal(digest, expected_million, 32);
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_hash_crc32),
+		cmocka_unit_test(test_vcdiff_hash_sha256),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,123 @@
+#include "inplace.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IMAGE "0123456789ABCDEF"
+
+/* all deltas read from a source segment spanning the whole image */
+
+/* ADD "abcd"; COPY 4 from 0; COPY 4 from 4: each COPY must run before the command in front of it */
+static const uint8_t chain_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x01, 0x10, 0x00, 0x0E, 0x0C, 0x00, 0x00, 0x09, 0x00,
+	0x05, 0x61, 0x62, 0x63, 0x64,
+	0x14, 0x00,
+	0x14, 0x04};
+
+/* COPY 4 from 4; COPY 4 from 0: both read what the other one writes */
+static const uint8_t swap_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x01, 0x10, 0x00, 0x09, 0x08, 0x00, 0x00, 0x04, 0x00,
+	0x14, 0x04,
+	0x14, 0x00};
+
+/* ADD "abcd"; COPY 8 from 0: the COPY overlaps its own destination */
+static const uint8_t overlap_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x01, 0x10, 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x07, 0x00,
+	0x05, 0x61, 0x62, 0x63, 0x64,
+	0x18, 0x00};
+
+static FILE *image_open (void) {
+	FILE *f = tmpfile();
+	assert_non_null(f);
+	assert_int_equal(pwrite(fileno(f), IMAGE, strlen(IMAGE), 0), strlen(IMAGE));
+	return f;
+}
+
+static void image_check (FILE *f, const char *expected) {
+	char buf[64];
+	size_t len = strlen(expected);
+
+	assert_int_equal(lseek(fileno(f), 0, SEEK_END), len);
+	assert_int_equal(pread(fileno(f), buf, sizeof(buf), 0), len);
+	assert_memory_equal(buf, expected, len);
+	fclose(f);
+}
+
+static void test_vcdiff_inplace_chain (void **state) {
+	(void) state;
+	struct inplace_stats stats;
+	const char *error_msg = NULL;
+	FILE *f = image_open();
+
+	/* acyclic: runs in reverse delta order without staging */
+	assert_int_equal(inplace_apply(fileno(f), chain_delta, sizeof(chain_delta), 0, &stats, &error_msg), 0);
+	assert_int_equal(stats.cmds, 3);
+	assert_int_equal(stats.edges, 2);
+	assert_int_equal(stats.staged, 0);
+	assert_int_equal(stats.staged_bytes, 0);
+	image_check(f, "abcd01234567");
+}
+
+static void test_vcdiff_inplace_cycle (void **state) {
+	(void) state;
+	struct inplace_stats stats;
+	const char *error_msg = NULL;
+	FILE *f = image_open();
+
+	/* one COPY of the cycle is staged */
+	assert_int_equal(inplace_apply(fileno(f), swap_delta, sizeof(swap_delta), 4, &stats, &error_msg), 0);
+	assert_int_equal(stats.cmds, 2);
+	assert_int_equal(stats.edges, 2);
+	assert_int_equal(stats.staged, 1);
+	assert_int_equal(stats.staged_bytes, 4);
+	image_check(f, "45670123");
+}
+
+static void test_vcdiff_inplace_self_overlap (void **state) {
+	(void) state;
+	struct inplace_stats stats;
+	const char *error_msg = NULL;
+	FILE *f = image_open();
+
+	/* overlapping with itself is no constraint; the COPY moves the data backwards */
+	assert_int_equal(inplace_apply(fileno(f), overlap_delta, sizeof(overlap_delta), 0, &stats, &error_msg), 0);
+	assert_int_equal(stats.cmds, 2);
+	assert_int_equal(stats.edges, 1);
+	assert_int_equal(stats.staged, 0);
+	image_check(f, "abcd01234567");
+}
+
+static void test_vcdiff_inplace_scratch (void **state) {
+	(void) state;
+	struct inplace_stats stats;
+	const char *error_msg = NULL;
+	FILE *f = image_open();
+
+	/* the image is left untouched if the cycle cannot be broken */
+	assert_int_equal(inplace_apply(fileno(f), swap_delta, sizeof(swap_delta), 3, &stats, &error_msg), -ENOSPC);
+	assert_string_equal(error_msg, "Scratch area too small");
+	assert_int_equal(stats.staged, 0);
+	image_check(f, IMAGE);
+
+	/* as it is for invalid deltas */
+	f = image_open();
+	assert_int_equal(inplace_apply(fileno(f), swap_delta, sizeof(swap_delta) - 1, 4, NULL, &error_msg), -EINVAL);
+	image_check(f, IMAGE);
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_inplace_chain),
+		cmocka_unit_test(test_vcdiff_inplace_cycle),
+		cmocka_unit_test(test_vcdiff_inplace_self_overlap),
+		cmocka_unit_test(test_vcdiff_inplace_scratch),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
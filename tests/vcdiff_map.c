@@ -0,0 +1,173 @@
+#include "vcdiff.h"
+#include "map.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+/* B: ADD "abcdefgh"; COPY 8 from B 0; COPY 16 from B 0 */
+static const uint8_t delta_ab[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x00, 0x12, 0x20, 0x00, 0x00, 0x0D, 0x00,
+	0x09, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x18, 0x00,
+	0x20, 0x00};
+
+/* C: COPY 32 from B 0; ADD "xy" */
+static const uint8_t delta_bc[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x01, 0x20, 0x00, 0x0B, 0x22, 0x00, 0x00, 0x06, 0x00,
+	0x13, 0x20, 0x00,
+	0x03, 0x78, 0x79};
+
+static uint8_t target[64];
+
+static int target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(target));
+	memcpy(dest, &target[offset], len);
+	return 0;
+}
+
+static int target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(target));
+	memcpy(&target[offset], src, len);
+	return 0;
+}
+
+static const vcdiff_driver_t target_driver = {
+	.read = target_read,
+	.write = target_write
+};
+
+static int source_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) dest;
+	(void) offset;
+	(void) len;
+	return -1;
+}
+
+static const vcdiff_driver_t source_driver = {
+	.read = source_read
+};
+
+/* applies the window to an empty source */
+static void decode_window (const struct emit_window *out, size_t window_len) {
+	struct emit_buf delta = {0};
+	static vcdiff_t ctx;
+
+	emit_header(&delta);
+	emit_window(&delta, out, window_len);
+
+	memset(target, 0, sizeof(target));
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+	assert_int_equal(vcdiff_apply_delta(&ctx, delta.data, delta.len), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_int_equal(ctx.target_offset, window_len);
+
+	free(delta.data);
+}
+
+static void test_vcdiff_map_build (void **state) {
+	(void) state;
+	struct map map = {0};
+	const char *error_msg = NULL;
+
+	assert_int_equal(map_build(&map, delta_ab, sizeof(delta_ab), &error_msg), 0);
+	assert_int_equal(map.cnt, 3);
+	assert_int_equal(map.window_cnt, 1);
+	assert_int_equal(map.windows[0], 32);
+	assert_int_equal(map.pieces[0].kind, MAP_ADD);
+	assert_ptr_equal(map.pieces[0].data, &delta_ab[13]);
+	assert_int_equal(map.pieces[2].kind, MAP_COPY_SAME);
+	assert_int_equal(map.pieces[2].offset, 16);
+	assert_int_equal(map.pieces[2].arg, 0);
+	assert_int_equal(map_find(&map, 15), 1);
+	assert_int_equal(map_find(&map, 32), map.cnt);
+	map_free(&map);
+
+	assert_true(map_build(&map, delta_ab, sizeof(delta_ab) - 1, &error_msg) < 0);
+	assert_non_null(error_msg);
+	map_free(&map);
+}
+
+static void test_vcdiff_map_self_copy (void **state) {
+	(void) state;
+	struct map map = {0};
+	struct emit_window out = {0};
+	const char *error_msg;
+
+	assert_int_equal(map_build(&map, delta_ab, sizeof(delta_ab), &error_msg), 0);
+
+	/* copies of data emitted before are copied in the output, too */
+	assert_int_equal(map_resolve(&map, 0, 32, &out, NULL, NULL), 0);
+	assert_int_equal(out.pos, 32);
+	assert_int_equal(out.cnt, 3);
+	assert_int_equal(out.insts[0].kind, EMIT_ADD);
+	assert_int_equal(out.insts[1].kind, EMIT_COPY_TARGET);
+	assert_int_equal(out.insts[1].arg, 0);
+	assert_int_equal(out.insts[2].kind, EMIT_COPY_TARGET);
+	assert_int_equal(out.insts[2].arg, 0);
+	decode_window(&out, 32);
+	assert_memory_equal(target, "abcdefghabcdefghabcdefghabcdefgh", 32);
+
+	/* data before the range is resolved once */
+	out.cnt = 0;
+	out.pos = 0;
+	assert_int_equal(map_resolve(&map, 8, 24, &out, NULL, NULL), 0);
+	assert_int_equal(out.pos, 24);
+	assert_int_equal(out.cnt, 3);
+	assert_int_equal(out.insts[0].kind, EMIT_ADD);
+	assert_int_equal(out.insts[0].len, 8);
+	assert_int_equal(out.insts[1].kind, EMIT_ADD);
+	assert_int_equal(out.insts[2].kind, EMIT_COPY_TARGET);
+	decode_window(&out, 24);
+	assert_memory_equal(target, "abcdefghabcdefghabcdefgh", 24);
+
+	free(out.insts);
+	map_free(&map);
+}
+
+static void test_vcdiff_map_compose (void **state) {
+	(void) state;
+	struct map map_b = {0};
+	struct map map_c = {0};
+	struct emit_window out = {0};
+	const char *error_msg;
+
+	/* A->B and B->C compose into A->C without B's data growing */
+	assert_int_equal(map_build(&map_b, delta_ab, sizeof(delta_ab), &error_msg), 0);
+	assert_int_equal(map_build(&map_c, delta_bc, sizeof(delta_bc), &error_msg), 0);
+	map_c.prev = &map_b;
+
+	assert_int_equal(map_resolve(&map_c, 0, 34, &out, NULL, NULL), 0);
+	assert_int_equal(out.cnt, 4);
+	assert_int_equal(out.insts[0].kind, EMIT_ADD);
+	assert_int_equal(out.insts[0].len, 8);
+	assert_int_equal(out.insts[3].kind, EMIT_ADD);
+	assert_int_equal(out.insts[3].len, 2);
+	decode_window(&out, 34);
+	assert_memory_equal(target, "abcdefghabcdefghabcdefghabcdefghxy", 34);
+
+	/* the range must be covered */
+	assert_true(map_resolve(&map_c, 30, 5, &out, NULL, NULL) < 0);
+
+	free(out.insts);
+	map_free(&map_b);
+	map_free(&map_c);
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_map_build),
+		cmocka_unit_test(test_vcdiff_map_self_copy),
+		cmocka_unit_test(test_vcdiff_map_compose),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,156 @@
+#include "vcdiff/parse.h"
+#include "vcdiff/codetable.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+static const uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x00, 0x00, 0x16, 0x82, 0x44, 0x00, 0x00, 0x10, 0x00, 0x02, 0x61, 0x73, 0x82, 0x17, 0x00, 0x05, 0x0A, 0x31, 0x32, 0x33, 0x23, 0x27, 0x03, 0x02, 0x0A};
+
+static vcdiff_cache_t cache;
+
+#define assert_inst(PARSER, INST, SIZE, POS, ADDR) { \
+	vcdiff_inst_t inst; \
+	assert_int_equal(vcdiff_parse_inst(PARSER, &inst), 1); \
+	assert_int_equal(inst.inst, INST); \
+	assert_int_equal(inst.size, SIZE); \
+	assert_int_equal(inst.window_pos, POS); \
+	assert_int_equal(inst.addr, ADDR); }
+
+static void test_vcdiff_parse (void **state) {
+	(void) state;
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+
+	vcdiff_parser_init(&parser, &cache, NULL, delta, sizeof(delta));
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_int_equal(vcdiff_parser_offset(&parser), 5);
+
+	assert_int_equal(vcdiff_parse_window(&parser, &win), 1);
+	assert_int_equal(win.indicator, VCDIFF_VCD_SOURCE);
+	assert_int_equal(win.segment_len, 0);
+	assert_int_equal(win.segment_pos, 0);
+	assert_int_equal(win.window_len, 0x144);
+	assert_int_equal(win.inst_len, 0x10);
+	assert_int_equal(win.offset, 5);
+	assert_int_equal(win.len, sizeof(delta) - 5);
+
+	assert_inst(&parser, VCDIFF_INST_ADD, 1, 0x000, 0);
+	assert_inst(&parser, VCDIFF_INST_COPY, 279, 0x001, 0x000);
+	assert_inst(&parser, VCDIFF_INST_ADD, 4, 0x118, 0);
+	assert_inst(&parser, VCDIFF_INST_COPY, 39, 0x11c, 0x119);
+	assert_inst(&parser, VCDIFF_INST_ADD, 1, 0x143, 0);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 0);
+
+	assert_int_equal(vcdiff_parse_window(&parser, &win), 0);
+}
+
+static void test_vcdiff_parse_add_data (void **state) {
+	(void) state;
+	vcdiff_parser_t parser;
+	vcdiff_inst_t inst;
+
+	vcdiff_parser_init(&parser, &cache, NULL, delta, sizeof(delta));
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_ptr_equal(inst.data, &delta[16]);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_ptr_equal(inst.data, NULL);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_memory_equal(inst.data, "\n123", 4);
+}
+
+static void test_vcdiff_parse_errors (void **state) {
+	(void) state;
+	vcdiff_parser_t parser;
+	vcdiff_inst_t inst;
+	uint8_t data[sizeof(delta)];
+
+	/* truncated delta */
+	vcdiff_parser_init(&parser, &cache, NULL, delta, sizeof(delta) - 1);
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), -1);
+	assert_string_equal(parser.error_msg, "Unexpected end of delta");
+
+	/* wrong magic */
+	memcpy(data, delta, sizeof(data));
+	data[0] = 0x00;
+	vcdiff_parser_init(&parser, &cache, NULL, data, sizeof(data));
+	assert_int_equal(vcdiff_parse_header(&parser), -1);
+	assert_string_equal(parser.error_msg, "Invalid magic");
+
+	/* copy from a target position that has not been written so far */
+	memcpy(data, delta, sizeof(data));
+	data[28] = 0x00;
+	vcdiff_parser_init(&parser, &cache, NULL, data, sizeof(data));
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), -1);
+	assert_string_equal(parser.error_msg, "Address is outside of available target window");
+
+	/* instruction exceeding the window */
+	memcpy(data, delta, sizeof(data));
+	data[9] = 0x81;
+	vcdiff_parser_init(&parser, &cache, NULL, data, sizeof(data));
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), -1);
+	assert_string_equal(parser.error_msg, "Size out of bounds");
+}
+
+static const uint8_t codetable_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x02, 0x30,
+	0x04, 0x03, 0xD6, 0xC3, 0xC4, 0x53, 0x00, 0x01, 0x8C, 0x00, 0x00, 0x24, 0x8C, 0x00, 0x00, 0x00, 0x1E, 0x00, 0x00, 0x13, 0x01, 0x00, 0x81, 0x10, 0x03, 0x00, 0x54, 0x01, 0x00, 0x09, 0x03, 0x00, 0x81, 0x23, 0x00, 0x00, 0x54, 0x03, 0x00, 0x09, 0x01, 0x02, 0x03, 0x13, 0x87, 0x7F, 0x84, 0x01,
+	0x00, 0x09, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x61, 0x62, 0x63};
+
+static void test_vcdiff_parse_codetable (void **state) {
+	(void) state;
+	vcdiff_parser_t parser;
+	vcdiff_codetable_t table;
+	vcdiff_inst_t inst;
+
+	/* opcode 0 means ADD with size 3 */
+	vcdiff_parser_init(&parser, &cache, &table, codetable_delta, sizeof(codetable_delta));
+	assert_int_equal(vcdiff_parse_header(&parser), 0);
+	assert_ptr_equal(parser.codetable, &table);
+	assert_int_equal(parser.near_size, 4);
+	assert_int_equal(parser.same_size, 3);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), 1);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 1);
+	assert_int_equal(inst.inst, VCDIFF_INST_ADD);
+	assert_int_equal(inst.size, 3);
+	assert_memory_equal(inst.data, "abc", 3);
+	assert_int_equal(vcdiff_parse_inst(&parser, &inst), 0);
+	assert_int_equal(vcdiff_parse_window(&parser, NULL), 0);
+
+	/* without storage for the table */
+	vcdiff_parser_init(&parser, &cache, NULL, codetable_delta, sizeof(codetable_delta));
+	assert_int_equal(vcdiff_parse_header(&parser), -1);
+	assert_string_equal(parser.error_msg, "Header indicator references unsupported features");
+
+	/* near cache larger than supported */
+	uint8_t data[sizeof(codetable_delta)];
+	memcpy(data, codetable_delta, sizeof(data));
+	data[6] = VCDIFF_CACHE_NEAR_SIZE + 1;
+	vcdiff_parser_init(&parser, &cache, &table, data, sizeof(data));
+	assert_int_equal(vcdiff_parse_header(&parser), -1);
+	assert_string_equal(parser.error_msg, "Code table cache sizes exceed supported maximum");
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_parse),
+		cmocka_unit_test(test_vcdiff_parse_add_data),
+		cmocka_unit_test(test_vcdiff_parse_errors),
+		cmocka_unit_test(test_vcdiff_parse_codetable),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -28,7 +28,7 @@ static void test_vcdiff_read_int (void **state) {
 	const uint8_t data[] = {0x80 + 58, 0x80 + 111, 0x80 + 26, 21};
 	const uint8_t *ptr = data;
 	size_t remaining_bytes = 3;
-	size_t res = 0;
+	vcdiff_off_t res = 0;
 
 	/* read first three bytes */
 	assert_int_equal(vcdiff_read_int(&res, &ptr, &remaining_bytes), VCDIFF_READ_CONT);
@@ -0,0 +1,246 @@
+#include "vcdiff.h"
+#include "vcdiff/ring.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+static uint8_t target[300];
+
+static int target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(target));
+	memcpy(&target[offset], src, len);
+	return 0;
+}
+
+static int target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	assert_true(offset + len <= sizeof(target));
+	memcpy(dest, &target[offset], len);
+	return 0;
+}
+
+static const vcdiff_driver_t target_driver = {
+	.read = target_read,
+	.write = target_write
+};
+
+/* every other write finds the target busy */
+static int target_busy;
+
+static int target_write_again (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	if (target_busy ^= 1) return VCDIFF_AGAIN;
+	return target_write(dev, src, offset, len);
+}
+
+static const vcdiff_driver_t target_driver_again = {
+	.read = target_read,
+	.write = target_write_again
+};
+
+static int source_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) dest;
+	(void) offset;
+	(void) len;
+	return -1;
+}
+
+static const vcdiff_driver_t source_driver = {
+	.read = source_read
+};
+
+static void test_vcdiff_ring_put (void **state) {
+	(void) state;
+	uint8_t buf[8];
+	uint8_t *ptr;
+	vcdiff_ring_t ring;
+
+	vcdiff_ring_init(&ring, buf, sizeof(buf));
+	assert_int_equal(vcdiff_ring_write_ptr(&ring, &ptr), 8);
+	assert_ptr_equal(ptr, buf);
+
+	/* a full ring takes nothing */
+	assert_int_equal(vcdiff_ring_put(&ring, (uint8_t *) "abcdefghij", 10), 8);
+	assert_int_equal(vcdiff_ring_used(&ring), 8);
+	assert_int_equal(vcdiff_ring_write_ptr(&ring, &ptr), 0);
+	assert_int_equal(vcdiff_ring_put(&ring, (uint8_t *) "x", 1), 0);
+
+	/* free space wraps around */
+	atomic_store(&ring.tail, 6);
+	assert_int_equal(vcdiff_ring_write_ptr(&ring, &ptr), 6);
+	assert_ptr_equal(ptr, buf);
+	assert_int_equal(vcdiff_ring_put(&ring, (uint8_t *) "klm", 3), 3);
+	assert_memory_equal(buf, "klmdefgh", 8);
+	assert_int_equal(vcdiff_ring_used(&ring), 5);
+}
+
+static void test_vcdiff_ring_apply (void **state) {
+	(void) state;
+	/* three windows of 100 bytes: RUN 0x11; ADD "abc" + RUN 0x22; RUN 0x33 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+		0x00, 0x0C, 0x64, 0x00, 0x00, 0x07, 0x00, 0x04, 0x61, 0x62, 0x63, 0x00, 0x61, 0x22,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x33};
+	uint8_t expected[300];
+	uint8_t buf[16];
+	vcdiff_ring_t ring;
+	static vcdiff_t ctx;
+
+	memset(expected, 0x11, 100);
+	memcpy(&expected[100], "abc", 3);
+	memset(&expected[103], 0x22, 97);
+	memset(&expected[200], 0x33, 100);
+
+	memset(target, 0, sizeof(target));
+	vcdiff_ring_init(&ring, buf, sizeof(buf));
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+
+	/* odd-sized receptions make the data wrap at varying positions */
+	for (size_t offset = 0; offset < sizeof(delta);) {
+		size_t len = sizeof(delta) - offset;
+		if (len > 7) len = 7;
+		offset += vcdiff_ring_put(&ring, &delta[offset], len);
+		assert_int_equal(vcdiff_ring_apply(&ctx, &ring), 0);
+		assert_int_equal(vcdiff_ring_used(&ring), 0);
+	}
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(target, expected, sizeof(expected));
+}
+
+static void test_vcdiff_ring_again (void **state) {
+	(void) state;
+	/* three windows of 100 bytes: RUN 0x11; ADD "abc" + RUN 0x22; RUN 0x33 */
+	uint8_t delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+		0x00, 0x0C, 0x64, 0x00, 0x00, 0x07, 0x00, 0x04, 0x61, 0x62, 0x63, 0x00, 0x61, 0x22,
+		0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x33};
+	uint8_t expected[300];
+	uint8_t buf[64];
+	vcdiff_ring_t ring;
+	static vcdiff_t ctx;
+	size_t yields = 0;
+	int rc;
+
+	memset(expected, 0x11, 100);
+	memcpy(&expected[100], "abc", 3);
+	memset(&expected[103], 0x22, 97);
+	memset(&expected[200], 0x33, 100);
+
+	memset(target, 0, sizeof(target));
+	target_busy = 0;
+	vcdiff_ring_init(&ring, buf, sizeof(buf));
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &target_driver_again, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+
+	/* data not consumed when the target is busy stays in the ring */
+	assert_int_equal(vcdiff_ring_put(&ring, delta, sizeof(delta)), sizeof(delta));
+	while ((rc = vcdiff_ring_apply(&ctx, &ring)) == VCDIFF_YIELD) {
+		assert_int_equal(vcdiff_ring_used(&ring), sizeof(delta) - ctx.delta_offset);
+		yields++;
+	}
+	assert_int_equal(rc, 0);
+	assert_int_equal(vcdiff_ring_used(&ring), 0);
+	assert_true(yields >= 3);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+	assert_memory_equal(target, expected, sizeof(expected));
+}
+
+/* windows of ADD data, received in odd-sized chunks by another thread */
+#define CONCURRENT_WINDOWS 2000
+#define CONCURRENT_WINDOW_LEN 100
+#define CONCURRENT_DELTA_WINDOW_LEN (9 + CONCURRENT_WINDOW_LEN)
+static uint8_t concurrent_delta[5 + CONCURRENT_WINDOWS * CONCURRENT_DELTA_WINDOW_LEN];
+static uint8_t concurrent_target[CONCURRENT_WINDOWS * CONCURRENT_WINDOW_LEN];
+
+static int concurrent_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	memcpy(&concurrent_target[offset], src, len);
+	return 0;
+}
+
+static int concurrent_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	memcpy(dest, &concurrent_target[offset], len);
+	return 0;
+}
+
+static const vcdiff_driver_t concurrent_driver = {
+	.read = concurrent_read,
+	.write = concurrent_write
+};
+
+static void *concurrent_producer (void *arg) {
+	vcdiff_ring_t *ring = arg;
+	size_t len = 1;
+
+	for (size_t offset = 0; offset < sizeof(concurrent_delta);) {
+		len = len % 13 + 1;
+		if (len > sizeof(concurrent_delta) - offset) len = sizeof(concurrent_delta) - offset;
+		size_t put = vcdiff_ring_put(ring, &concurrent_delta[offset], len);
+		if (put == 0) sched_yield();
+		offset += put;
+	}
+
+	return NULL;
+}
+
+static void test_vcdiff_ring_concurrent (void **state) {
+	(void) state;
+	uint8_t *delta = concurrent_delta;
+	uint8_t buf[64];
+	vcdiff_ring_t ring;
+	static vcdiff_t ctx;
+	pthread_t producer;
+
+	memcpy(delta, "\xD6\xC3\xC4\x53\x00", 5);
+	delta += 5;
+	for (size_t i = 0; i < CONCURRENT_WINDOWS; i++) {
+		/* ADD of the whole window */
+		const uint8_t hdr[] = {0x00, CONCURRENT_DELTA_WINDOW_LEN - 2, CONCURRENT_WINDOW_LEN, 0x00, 0x00, CONCURRENT_WINDOW_LEN + 2, 0x00, 0x01, CONCURRENT_WINDOW_LEN};
+		memcpy(delta, hdr, sizeof(hdr));
+		delta += sizeof(hdr);
+		for (size_t j = 0; j < CONCURRENT_WINDOW_LEN; j++) *delta++ = i * 7 + j;
+	}
+
+	memset(concurrent_target, 0, sizeof(concurrent_target));
+	vcdiff_ring_init(&ring, buf, sizeof(buf));
+	vcdiff_init(&ctx);
+	vcdiff_set_target_driver(&ctx, &concurrent_driver, NULL);
+	vcdiff_set_source_driver(&ctx, &source_driver, NULL);
+
+	/* the consumer decodes whatever has been committed so far */
+	assert_int_equal(pthread_create(&producer, NULL, concurrent_producer, &ring), 0);
+	while (ctx.delta_offset < sizeof(concurrent_delta)) {
+		assert_int_equal(vcdiff_ring_apply(&ctx, &ring), 0);
+		if (vcdiff_ring_used(&ring) == 0) sched_yield();
+	}
+	assert_int_equal(pthread_join(producer, NULL), 0);
+	assert_int_equal(vcdiff_ring_used(&ring), 0);
+	assert_int_equal(vcdiff_finish(&ctx), 0);
+
+	for (size_t i = 0; i < CONCURRENT_WINDOWS; i++) {
+		for (size_t j = 0; j < CONCURRENT_WINDOW_LEN; j++) {
+			assert_int_equal(concurrent_target[i * CONCURRENT_WINDOW_LEN + j], (uint8_t) (i * 7 + j));
+		}
+	}
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_ring_put),
+		cmocka_unit_test(test_vcdiff_ring_apply),
+		cmocka_unit_test(test_vcdiff_ring_again),
+		cmocka_unit_test(test_vcdiff_ring_concurrent),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,87 @@
+#include "vcdiff/validate.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+static vcdiff_validate_t val;
+
+/* three windows of 100 bytes: RUN 0x11; ADD "abc" + RUN 0x22; RUN 0x33 */
+static const uint8_t runs_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x11,
+	0x00, 0x0C, 0x64, 0x00, 0x00, 0x07, 0x00, 0x04, 0x61, 0x62, 0x63, 0x00, 0x61, 0x22,
+	0x00, 0x08, 0x64, 0x00, 0x00, 0x03, 0x00, 0x00, 0x64, 0x33};
+
+/* COPY 50 from source 0; ADD "abcdefghij"; COPY 40 from source 60 */
+static const uint8_t copy_delta[] = {0xD6, 0xC3, 0xC4, 0x53, 0x00,
+	0x01, 0x64, 0x00, 0x16, 0x64, 0x00, 0x00, 0x11, 0x00,
+	0x13, 0x32, 0x00,
+	0x0B, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A,
+	0x13, 0x28, 0x3C};
+
+static void test_vcdiff_validate_stats (void **state) {
+	(void) state;
+
+	assert_int_equal(vcdiff_validate(&val, runs_delta, sizeof(runs_delta), 0), 0);
+	assert_int_equal(val.windows, 3);
+	assert_int_equal(val.target_len, 300);
+	assert_int_equal(val.add_cnt, 1);
+	assert_int_equal(val.add_bytes, 3);
+	assert_int_equal(val.run_cnt, 3);
+	assert_int_equal(val.run_bytes, 297);
+	assert_int_equal(val.copy_cnt, 0);
+
+	assert_int_equal(vcdiff_validate(&val, copy_delta, sizeof(copy_delta), 100), 0);
+	assert_int_equal(val.target_len, 100);
+	assert_int_equal(val.copy_cnt, 2);
+	assert_int_equal(val.copy_bytes, 90);
+	assert_int_equal(val.source_read_bytes, 90);
+	assert_int_equal(val.target_read_bytes, 0);
+	assert_int_equal(val.source_seeks, 1);
+	assert_int_equal(val.source_seek_bytes, 10);
+}
+
+static void test_vcdiff_validate_bounds (void **state) {
+	(void) state;
+	uint8_t delta[sizeof(copy_delta)];
+
+	/* the source is too short */
+	assert_int_equal(vcdiff_validate(&val, copy_delta, sizeof(copy_delta), 99), -1);
+	assert_string_equal(val.error_msg, "Source segment exceeds source");
+	assert_int_equal(val.error_offset, 5);
+
+	/* target segments must have been written before */
+	memcpy(delta, copy_delta, sizeof(delta));
+	delta[5] = 0x02;
+	assert_int_equal(vcdiff_validate(&val, delta, sizeof(delta), VCDIFF_OFF_MAX), -1);
+	assert_string_equal(val.error_msg, "Target segment exceeds target");
+
+	/* COPY beyond the segment */
+	memcpy(delta, copy_delta, sizeof(delta));
+	delta[30] = 0x3D;
+	assert_int_equal(vcdiff_validate(&val, delta, sizeof(delta), VCDIFF_OFF_MAX), -1);
+	assert_string_equal(val.error_msg, "Address must not cross source boundary");
+	assert_int_equal(val.error_offset, 31);
+}
+
+static void test_vcdiff_validate_truncated (void **state) {
+	(void) state;
+
+	for (size_t len = 1; len < sizeof(runs_delta); len++) {
+		if (len == 5 || len == 15 || len == 29) continue;
+		assert_int_equal(vcdiff_validate(&val, runs_delta, len, VCDIFF_OFF_MAX), -1);
+		assert_non_null(val.error_msg);
+	}
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_validate_stats),
+		cmocka_unit_test(test_vcdiff_validate_bounds),
+		cmocka_unit_test(test_vcdiff_validate_truncated),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,54 @@
+#include "vcdiff/write.h"
+#include "vcdiff/read.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+static void test_vcdiff_write_int (void **state) {
+	(void) state;
+	const uint8_t expected[] = {0x80 + 58, 0x80 + 111, 0x80 + 26, 21};
+	uint8_t buf[VCDIFF_WRITE_INT_MAX_LEN];
+
+	/* encode the example given by RFC 3284 */
+	assert_int_equal(vcdiff_write_int_len(123456789), sizeof(expected));
+	assert_int_equal(vcdiff_write_int(buf, 123456789), sizeof(expected));
+	assert_memory_equal(buf, expected, sizeof(expected));
+
+	/* single byte values */
+	assert_int_equal(vcdiff_write_int(buf, 0), 1);
+	assert_int_equal(buf[0], 0x00);
+	assert_int_equal(vcdiff_write_int(buf, 127), 1);
+	assert_int_equal(buf[0], 0x7f);
+	assert_int_equal(vcdiff_write_int(buf, 128), 2);
+	assert_int_equal(buf[0], 0x81);
+	assert_int_equal(buf[1], 0x00);
+}
+
+static void test_vcdiff_write_int_roundtrip (void **state) {
+	(void) state;
+	const vcdiff_off_t values[] = {0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0xffffffff, VCDIFF_OFF_MAX};
+	uint8_t buf[VCDIFF_WRITE_INT_MAX_LEN];
+
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		size_t len = vcdiff_write_int(buf, values[i]);
+		const uint8_t *ptr = buf;
+		size_t remaining_bytes = len;
+		vcdiff_off_t res = 0;
+		assert_in_range(len, 1, VCDIFF_WRITE_INT_MAX_LEN);
+		assert_int_equal(vcdiff_read_int(&res, &ptr, &remaining_bytes), VCDIFF_READ_DONE);
+		assert_int_equal(remaining_bytes, 0);
+		assert_int_equal(res, values[i]);
+	}
+}
+
+int main (void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vcdiff_write_int),
+		cmocka_unit_test(test_vcdiff_write_int_roundtrip),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
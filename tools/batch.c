@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vcdiff.h"
+#include "batch.h"
+
+struct batch_pool {
+	const struct batch_map *source;
+	struct batch_job *jobs;
+	size_t job_cnt;
+	atomic_size_t next_job;
+};
+
+struct target_file {
+	int fd;
+	size_t len;
+};
+
+int batch_map_file (struct batch_map *map, const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int rc = -errno;
+		close(fd);
+		return rc;
+	}
+
+	/* off_t may exceed the address space on 32 bit platforms */
+	if ((off_t) (size_t) st.st_size != st.st_size) {
+		close(fd);
+		return -EFBIG;
+	}
+
+	map->len = st.st_size;
+	map->data = NULL;
+	if (map->len > 0) {
+		void *data = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			int rc = -errno;
+			close(fd);
+			return rc;
+		}
+		madvise(data, map->len, MADV_WILLNEED);
+		map->data = data;
+	}
+
+	close(fd);
+	return 0;
+}
+
+void batch_unmap_file (struct batch_map *map) {
+	if (map->data) {
+		munmap((void *) map->data, map->len);
+	}
+	map->data = NULL;
+	map->len = 0;
+}
+
+static int _mem_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	const struct batch_map *map = (const struct batch_map *) dev;
+
+	if (offset > map->len || len > map->len - offset) {
+		return -EIO;
+	}
+
+	memcpy(dest, map->data + offset, len);
+	return 0;
+}
+
+static int _mem_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	const struct batch_map *map = (const struct batch_map *) dev;
+
+	if (offset > map->len || len > map->len - offset) {
+		return -EIO;
+	}
+
+	/* only memory owned by the caller is written, never a file mapping */
+	memcpy((uint8_t *) map->data + offset, src, len);
+	return 0;
+}
+
+const vcdiff_driver_t batch_mem_driver = {
+	.read = _mem_read,
+	.write = _mem_write
+};
+
+static int _target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	struct target_file *target = (struct target_file *) dev;
+
+	while (len > 0) {
+		ssize_t rc = pwrite(target->fd, src, len, offset);
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		src += rc;
+		offset += rc;
+		len -= rc;
+	}
+
+	if (offset > target->len) {
+		target->len = offset;
+	}
+
+	return 0;
+}
+
+static int _target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	struct target_file *target = (struct target_file *) dev;
+
+	while (len > 0) {
+		ssize_t rc = pread(target->fd, dest, len, offset);
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		if (rc == 0) {
+			return -EIO;
+		}
+		dest += rc;
+		offset += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+static const vcdiff_driver_t target_driver = {
+	.read = _target_read,
+	.write = _target_write
+};
+
+static double _now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the rename is only durable once the directory entry is */
+static int _sync_dir (const char *path) {
+	char dir_path[PATH_MAX];
+	const char *sep = strrchr(path, '/');
+
+	if (sep == NULL) {
+		strcpy(dir_path, ".");
+	} else if (sep == path) {
+		strcpy(dir_path, "/");
+	} else if ((size_t) (sep - path) < sizeof(dir_path)) {
+		memcpy(dir_path, path, sep - path);
+		dir_path[sep - path] = '\0';
+	} else {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) return -1;
+
+	int rc = fsync(fd);
+	int err = errno;
+	close(fd);
+	errno = err;
+	return rc;
+}
+
+static void _apply_job (vcdiff_t *ctx, const struct batch_map *source, struct batch_job *job) {
+	struct batch_map delta = {0};
+	struct batch_map own_source = {0};
+	struct target_file target = {.fd = -1};
+	char tmp_path[PATH_MAX];
+	const char *path = job->target_path;
+	double start = _now();
+
+	if (job->source_path) {
+		/* a missing source is empty: the file is new */
+		job->rc = batch_map_file(&own_source, job->source_path);
+		if (job->rc < 0 && job->rc != -ENOENT) {
+			job->error_msg = "Cannot open source";
+			goto exit;
+		}
+		source = &own_source;
+	}
+
+	if (job->delta) {
+		delta.data = job->delta;
+		delta.len = job->delta_size;
+	} else {
+		job->rc = batch_map_file(&delta, job->delta_path);
+		if (job->rc < 0) {
+			job->error_msg = "Cannot open delta";
+			goto exit_unmap_source;
+		}
+	}
+
+	if (job->atomic) {
+		if (snprintf(tmp_path, sizeof(tmp_path), "%s.vcdiff-tmp", job->target_path) >= (int) sizeof(tmp_path)) {
+			job->rc = -ENAMETOOLONG;
+			job->error_msg = "Target path too long";
+			goto exit_unmap;
+		}
+		path = tmp_path;
+	}
+
+	target.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, job->mode ? job->mode : 0644);
+	if (target.fd < 0) {
+		job->rc = -errno;
+		job->error_msg = "Cannot open target";
+		goto exit_unmap;
+	}
+
+	vcdiff_init(ctx);
+	vcdiff_set_source_driver(ctx, &batch_mem_driver, (void *) source);
+	vcdiff_set_target_driver(ctx, &target_driver, (void *) &target);
+
+	job->rc = vcdiff_apply_delta(ctx, delta.data, delta.len);
+	if (job->rc == 0) {
+		job->rc = vcdiff_finish(ctx);
+	}
+	if (job->rc < 0) {
+		job->error_msg = vcdiff_error_str(ctx);
+	}
+
+	job->delta_len = delta.len;
+	job->target_len = target.len;
+
+	if (job->atomic) {
+		/* only complete targets replace the old file */
+		if (job->rc == 0 && target.len != job->expected_len) {
+			job->rc = -EINVAL;
+			job->error_msg = "Target length differs from the expected one";
+		}
+		if (job->rc == 0 && (fchmod(target.fd, job->mode ? job->mode : 0644) < 0 || fsync(target.fd) < 0)) {
+			job->rc = -errno;
+			job->error_msg = "Cannot sync target";
+		}
+		if (job->rc == 0 && rename(tmp_path, job->target_path) < 0) {
+			job->rc = -errno;
+			job->error_msg = "Cannot rename target";
+		}
+		if (job->rc == 0 && _sync_dir(job->target_path) < 0) {
+			job->rc = -errno;
+			job->error_msg = "Cannot sync target directory";
+		}
+		if (job->rc < 0) {
+			unlink(tmp_path);
+		}
+	}
+
+	close(target.fd);
+exit_unmap:
+	if (job->delta == NULL) batch_unmap_file(&delta);
+exit_unmap_source:
+	batch_unmap_file(&own_source);
+exit:
+	job->seconds = _now() - start;
+}
+
+static void *_worker (void *arg) {
+	struct batch_pool *pool = (struct batch_pool *) arg;
+
+	/* one pooled context per worker; it is re-initialised for every job */
+	vcdiff_t *ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	size_t i;
+	while ((i = atomic_fetch_add(&pool->next_job, 1)) < pool->job_cnt) {
+		_apply_job(ctx, pool->source, &pool->jobs[i]);
+	}
+
+	free(ctx);
+	return NULL;
+}
+
+int batch_apply (const struct batch_map *source, struct batch_job *jobs, size_t job_cnt, unsigned workers) {
+	struct batch_pool pool = {
+		.source = source,
+		.jobs = jobs,
+		.job_cnt = job_cnt,
+	};
+	atomic_init(&pool.next_job, 0);
+
+	for (size_t i = 0; i < job_cnt; i++) {
+		jobs[i].rc = -ECANCELED;
+		jobs[i].error_msg = "Job has not been processed";
+	}
+
+	if (workers == 0) workers = 1;
+	if (workers > job_cnt) workers = job_cnt;
+
+	pthread_t *threads = calloc(workers, sizeof(*threads));
+	if (threads == NULL) {
+		return -ENOMEM;
+	}
+
+	unsigned started;
+	for (started = 0; started < workers; started++) {
+		if (pthread_create(&threads[started], NULL, _worker, &pool) != 0) {
+			break;
+		}
+	}
+
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+
+	if (started == 0 && job_cnt > 0) {
+		return -EAGAIN;
+	}
+
+	for (size_t i = 0; i < job_cnt; i++) {
+		if (jobs[i].rc < 0) return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "vcdiff.h"
+
+/**
+ * @brief   A single delta to be applied to the shared source
+ */
+struct batch_job {
+	const char *delta_path;  /**< Path of the delta file; unused if delta is set */
+	const char *target_path; /**< Path of the target file to be created */
+	const char *source_path; /**< Source of this job or NULL for the shared source */
+	const uint8_t *delta;    /**< Delta in memory, e.g. inside a bundle, or NULL */
+	size_t delta_size;       /**< Length of delta */
+	unsigned mode;           /**< Permission bits of the target; 0 for 0644 */
+	bool atomic;             /**< Write to a temporary file and rename it to target_path
+	                              once the target is complete and has expected_len */
+	size_t expected_len;     /**< Length required for renaming an atomic target */
+
+	int rc;                  /**< Result: `0` on success, `<0` on error */
+	const char *error_msg;   /**< Error description if rc is non-zero */
+	size_t delta_len;        /**< Amount of delta bytes processed */
+	size_t target_len;       /**< Amount of target bytes written */
+	double seconds;          /**< Wall clock time spend on this job */
+};
+
+/**
+ * @brief   Read-only memory mapping of a file
+ */
+struct batch_map {
+	const uint8_t *data;
+	size_t len;
+};
+
+/**
+ * @brief   Maps the given file read-only into memory
+ *
+ * @param[out] map       Resulting mapping
+ * @param[in]  path      Path to the file
+ * @return `0` on success, `<0` on error
+ */
+int batch_map_file (struct batch_map *map, const char *path);
+
+/**
+ * @brief   Releases a mapping created by batch_map_file()
+ */
+void batch_unmap_file (struct batch_map *map);
+
+/**
+ * @brief   Driver for data in memory; the device is a struct batch_map
+ *
+ * Reads from and writes to the data of the map. Writing requires the data to
+ * be memory owned by the caller instead of a mapping from batch_map_file().
+ */
+extern const vcdiff_driver_t batch_mem_driver;
+
+/**
+ * @brief   Applies all jobs against the same source using a pool of workers
+ *
+ * The source is shared read-only between all workers. Each worker owns one
+ * decoder context that is reused for all jobs the worker picks up. Jobs with
+ * their own source_path map it while they are processed.
+ *
+ * @param[in]     source    Shared source image; may be NULL if all jobs bring their own
+ * @param[in,out] jobs      Jobs to process; results are stored in the job
+ * @param[in]     job_cnt   Amount of jobs
+ * @param[in]     workers   Amount of worker threads
+ * @return `0` if all jobs succeeded, `<0` if a job failed or the pool could not be started
+ */
+int batch_apply (const struct batch_map *source, struct batch_job *jobs, size_t job_cnt, unsigned workers);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "vcdiff.h"
+#include "batch.h"
+
+/* measures the per-call overhead when the delta arrives in small packets */
+
+#define PACKETS (sizeof(packets) / sizeof(packets[0]))
+
+static double now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main (int argc, char *argv[]) {
+	static vcdiff_t ctx;
+	/* the whole delta at once comes last and serves as reference */
+	static const size_t packets[] = {1, 4, 20, 1024, SIZE_MAX};
+	double best[PACKETS];
+	struct batch_map source, delta, target;
+	int rc;
+
+	if (argc < 4) {
+		fprintf(stderr, "Usage: bench-bytewise source_path delta_path target_len [runs]\n");
+		return 1;
+	}
+	if ((rc = batch_map_file(&source, argv[1])) < 0 || (rc = batch_map_file(&delta, argv[2])) < 0) {
+		fprintf(stderr, "Cannot map source_path or delta_path: %s\n", strerror(-rc));
+		return 1;
+	}
+	target.len = strtoul(argv[3], NULL, 0);
+	target.data = malloc(target.len ? target.len : 1);
+	if (target.data == NULL) {
+		perror("Cannot allocate target");
+		return 1;
+	}
+	size_t runs = (argc > 4) ? strtoul(argv[4], NULL, 0) : 10;
+
+	for (size_t p = 0; p < PACKETS; p++) {
+		size_t packet = packets[p];
+
+		for (size_t run = 0; run < runs; run++) {
+			vcdiff_init(&ctx);
+			vcdiff_set_source_driver(&ctx, &batch_mem_driver, &source);
+			vcdiff_set_target_driver(&ctx, &batch_mem_driver, &target);
+
+			double start = now();
+			for (size_t pos = 0; pos < delta.len; pos += packet) {
+				size_t len = (delta.len - pos < packet) ? delta.len - pos : packet;
+				if (vcdiff_apply_delta(&ctx, delta.data + pos, len) < 0) {
+					fprintf(stderr, "Error while applying delta: %s\n", vcdiff_error_str(&ctx));
+					return 1;
+				}
+			}
+			if (vcdiff_finish(&ctx) < 0) {
+				fprintf(stderr, "Error while finishing delta: %s\n", vcdiff_error_str(&ctx));
+				return 1;
+			}
+			double seconds = now() - start;
+			if (run == 0 || seconds < best[p]) best[p] = seconds;
+		}
+	}
+
+	/* the time exceeding the reference is spent on entering and leaving the decoder */
+	for (size_t p = 0; p < PACKETS; p++) {
+		char packet[24] = "all";
+		size_t calls = 1;
+		if (packets[p] != SIZE_MAX) {
+			snprintf(packet, sizeof(packet), "%zu", packets[p]);
+			calls = (delta.len + packets[p] - 1) / packets[p];
+		}
+		printf("PACKET=%-6s NS_PER_DELTA_BYTE=%-8.2f NS_OVERHEAD_PER_CALL=%.2f\n", packet,
+		       best[p] * 1e9 / delta.len, (best[p] - best[PACKETS - 1]) * 1e9 / calls);
+	}
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Compares writing the target through the page cache against O_DIRECT.
+# Usage: tools/bench-direct.sh source_path delta_path [runs]
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 source_path delta_path [runs]" >&2
+	exit 1
+fi
+
+SOURCE=$1
+DELTA=$2
+RUNS=${3:-3}
+DECODE=${DECODE:-./vcdiff-decode}
+TARGET=${TARGET:-./bench-direct.out}
+
+cached_kb () {
+	awk '/^Cached:/ { print $2 }' /proc/meminfo
+}
+
+drop_caches () {
+	sync
+	if [ -w /proc/sys/vm/drop_caches ]; then echo 3 >/proc/sys/vm/drop_caches; fi
+}
+
+for mode in buffered direct; do
+	flag=
+	[ $mode = direct ] && flag=-D
+	run=1
+	while [ $run -le $RUNS ]; do
+		rm -f "$TARGET"
+		drop_caches
+		before=$(cached_kb)
+		stats=$($DECODE -s 1 -d "$DELTA" -o "$TARGET" $flag "$SOURCE" 2>&1 | grep '^FILE')
+		after=$(cached_kb)
+		echo "$mode run=$run $(echo "$stats" | grep -o 'TIME=[^ ]* THROUGHPUT=[^ ]*') PAGE_CACHE_GROWTH=$((after - before))kB"
+		run=$((run + 1))
+	done
+done
+
+rm -f "$TARGET"
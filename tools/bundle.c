@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include "vcdiff/read.h"
+#include "bundle.h"
+
+static int _read_size (size_t *dst, const uint8_t **input, size_t *remainder) {
+	vcdiff_off_t value = 0;
+	if (vcdiff_read_int(&value, input, remainder) != VCDIFF_READ_DONE) return -EINVAL;
+	if (value != (size_t) value) return -EINVAL;
+	*dst = value;
+	return 0;
+}
+
+static bool _path_valid (const char *path) {
+	size_t len = strlen(path);
+	if (len == 0 || path[0] == '/') return false;
+
+	/* reject "..", "." and empty components; the same file has one path */
+	for (size_t i = 0; i <= len; ) {
+		size_t end = i;
+		while (end < len && path[end] != '/') end++;
+		if (end == i) return false;
+		if (end - i == 1 && path[i] == '.') return false;
+		if (end - i == 2 && path[i] == '.' && path[i + 1] == '.') return false;
+		i = end + 1;
+	}
+
+	return true;
+}
+
+static int _cmp_paths (const void *a, const void *b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int bundle_check_paths (const struct bundle_file *files, size_t cnt, const char **error_msg) {
+	for (size_t i = 0; i < cnt; i++) {
+		if (!_path_valid(files[i].path)) {
+			*error_msg = "Invalid path in manifest";
+			return -EINVAL;
+		}
+	}
+
+	/* two jobs writing the same file would race on its temporary file */
+	char **paths = malloc((cnt ? cnt : 1) * sizeof(*paths));
+	if (paths == NULL) {
+		*error_msg = "Out of memory";
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < cnt; i++) {
+		paths[i] = files[i].path;
+	}
+	qsort(paths, cnt, sizeof(*paths), _cmp_paths);
+
+	int rc = 0;
+	for (size_t i = 1; i < cnt; i++) {
+		if (strcmp(paths[i - 1], paths[i]) == 0) {
+			*error_msg = "Duplicate path in manifest";
+			rc = -EINVAL;
+			break;
+		}
+	}
+
+	free(paths);
+	return rc;
+}
+
+int bundle_open (struct bundle *bundle, const char *path, const char **error_msg) {
+	memset(bundle, 0, sizeof(*bundle));
+
+	int rc = batch_map_file(&bundle->map, path);
+	if (rc < 0) {
+		*error_msg = "Cannot open bundle";
+		return rc;
+	}
+
+	const uint8_t *input = bundle->map.data;
+	size_t remainder = bundle->map.len;
+	if (remainder < BUNDLE_MAGIC_LEN || memcmp(input, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN)) {
+		*error_msg = "Not a bundle";
+		goto err;
+	}
+	input += BUNDLE_MAGIC_LEN;
+	remainder -= BUNDLE_MAGIC_LEN;
+
+	size_t cnt;
+	if (_read_size(&cnt, &input, &remainder) < 0 || cnt > remainder) {
+		*error_msg = "Invalid file count";
+		goto err;
+	}
+	bundle->files = calloc(cnt ? cnt : 1, sizeof(*bundle->files));
+	if (bundle->files == NULL) {
+		*error_msg = "Out of memory";
+		rc = -ENOMEM;
+		goto err_rc;
+	}
+	bundle->file_cnt = cnt;
+
+	for (size_t i = 0; i < cnt; i++) {
+		struct bundle_file *file = &bundle->files[i];
+		size_t path_len, mode;
+
+		if (_read_size(&path_len, &input, &remainder) < 0 || path_len > remainder) {
+			*error_msg = "Truncated manifest";
+			goto err;
+		}
+		if (memchr(input, '\0', path_len)) {
+			*error_msg = "Invalid path in manifest";
+			goto err;
+		}
+		file->path = strndup((const char *) input, path_len);
+		if (file->path == NULL) {
+			*error_msg = "Out of memory";
+			rc = -ENOMEM;
+			goto err_rc;
+		}
+		input += path_len;
+		remainder -= path_len;
+
+		if (_read_size(&mode, &input, &remainder) < 0 ||
+		    _read_size(&file->target_len, &input, &remainder) < 0 ||
+		    _read_size(&file->delta_len, &input, &remainder) < 0) {
+			*error_msg = "Truncated manifest";
+			goto err;
+		}
+		file->mode = mode & 07777;
+	}
+
+	rc = bundle_check_paths(bundle->files, cnt, error_msg);
+	if (rc < 0) goto err_rc;
+
+	/* the deltas follow the manifest */
+	for (size_t i = 0; i < cnt; i++) {
+		struct bundle_file *file = &bundle->files[i];
+		if (file->delta_len > remainder) {
+			*error_msg = "Truncated bundle";
+			goto err;
+		}
+		file->delta = input;
+		input += file->delta_len;
+		remainder -= file->delta_len;
+	}
+
+	return 0;
+
+err:
+	rc = -EINVAL;
+err_rc:
+	bundle_close(bundle);
+	return rc;
+}
+
+void bundle_close (struct bundle *bundle) {
+	for (size_t i = 0; i < bundle->file_cnt; i++) {
+		free(bundle->files[i].path);
+	}
+	free(bundle->files);
+	bundle->files = NULL;
+	bundle->file_cnt = 0;
+	batch_unmap_file(&bundle->map);
+}
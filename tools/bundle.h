@@ -0,0 +1,64 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "batch.h"
+
+/**
+ * @brief   Bundle of deltas updating many files at once
+ *
+ * All integers are encoded like VCDIFF integers:
+ *
+ *     magic "VCDB" and version 0x00
+ *     file count
+ *     per file: path length, path, mode, target length, delta length
+ *     the deltas of all files in the order of the manifest
+ *
+ * Paths are relative to the source and target directories, must not contain
+ * "..", "." or empty components and must be unique. The delta of a file is applied to the file with
+ * the same path in the source directory; missing sources are empty.
+ */
+#define BUNDLE_MAGIC "VCDB\x00"
+#define BUNDLE_MAGIC_LEN 5
+
+struct bundle_file {
+	char *path;               /**< Relative path; NUL-terminated */
+	unsigned mode;            /**< Permission bits of the target */
+	size_t target_len;        /**< Length of the target */
+	const uint8_t *delta;     /**< Delta inside the bundle */
+	size_t delta_len;
+};
+
+struct bundle {
+	struct batch_map map;     /**< The whole bundle */
+	struct bundle_file *files;
+	size_t file_cnt;
+};
+
+/**
+ * @brief   Checks that all paths are valid and unique
+ *
+ * @param[in]  files      Files of the manifest
+ * @param[in]  cnt        Amount of files
+ * @param[out] error_msg  Description of the error if a path is rejected
+ * @return `0` if all paths are valid, `<0` otherwise
+ */
+int bundle_check_paths (const struct bundle_file *files, size_t cnt, const char **error_msg);
+
+/**
+ * @brief   Maps a bundle read-only into memory and parses its manifest
+ *
+ * @param[out] bundle     Resulting bundle
+ * @param[in]  path       Path to the bundle
+ * @param[out] error_msg  Description of the error if parsing failed
+ * @return `0` on success, `<0` on error
+ */
+int bundle_open (struct bundle *bundle, const char *path, const char **error_msg);
+
+/**
+ * @brief   Releases a bundle opened by bundle_open()
+ */
+void bundle_close (struct bundle *bundle);
+
+#endif
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include "vcdiff.h"
+#include "vcdiff/read.h"
+#include "batch.h"
+#include "chain.h"
+
+#define VCD_SOURCE 0x1
+#define VCD_TARGET 0x2
+
+#define VCD_CODETABLE 0x2
+
+static const uint8_t delta_magic[] = {0xd6, 0xc3, 0xc4, 0x53};
+
+struct chain_entry;
+
+struct chain_window {
+	size_t delta_offset;         /**< Offset of the window header inside the delta */
+	size_t delta_len;            /**< Length of the window inside the delta */
+	vcdiff_off_t target_offset;  /**< Offset of the window inside the intermediate image */
+	size_t target_len;           /**< Length of the window inside the intermediate image */
+	struct chain_entry *entry;   /**< Cached window data or NULL */
+};
+
+struct chain_level {
+	struct chain *chain;
+	struct batch_map delta;
+	size_t hdr_len;              /**< Length of the delta header including any code table */
+	struct chain_window *windows;
+	size_t window_cnt;
+	const vcdiff_driver_t *source_driver;
+	void *source_dev;
+};
+
+struct chain_entry {
+	struct chain_window *window;
+	struct chain_entry *prev;    /**< Towards most recently used */
+	struct chain_entry *next;    /**< Towards least recently used */
+	bool pinned;                 /**< Entry is currently being decoded */
+	uint8_t data[];
+};
+
+struct chain_ctx {
+	struct chain_ctx *next;
+	vcdiff_t ctx;
+};
+
+struct chain {
+	const vcdiff_driver_t *source_driver;
+	void *source_dev;
+
+	struct chain_level **levels;
+	size_t level_cnt;
+
+	struct chain_ctx *ctx_pool;
+
+	struct chain_entry *mru;
+	struct chain_entry *lru;
+	size_t cache_used;
+	size_t cache_size;
+
+	size_t stat_hits;
+	size_t stat_misses;
+	size_t stat_evictions;
+};
+
+struct window_target {
+	struct chain_level *level;
+	struct chain_entry *entry;
+};
+
+static int _level_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len);
+
+static int _index_delta (struct chain_level *level) {
+	const uint8_t *input = level->delta.data;
+	size_t remainder = level->delta.len;
+	vcdiff_off_t target_offset = 0;
+	size_t capacity = 0;
+
+	if (remainder < sizeof(delta_magic) || memcmp(input, delta_magic, sizeof(delta_magic))) {
+		return -EINVAL;
+	}
+	input += sizeof(delta_magic);
+	remainder -= sizeof(delta_magic);
+
+	/* every window is decoded behind the original header, so a custom code table applies to all of them */
+	uint8_t hdr_indicator;
+	if (vcdiff_read_byte(&hdr_indicator, &input, &remainder) != VCDIFF_READ_DONE) return -EINVAL;
+	if (hdr_indicator & ~VCD_CODETABLE) return -EINVAL;
+	if (hdr_indicator & VCD_CODETABLE) {
+		vcdiff_off_t codetable_len = 0;
+		if (vcdiff_read_int(&codetable_len, &input, &remainder) != VCDIFF_READ_DONE) return -EINVAL;
+		if (codetable_len > remainder) return -EINVAL;
+		input += codetable_len;
+		remainder -= codetable_len;
+	}
+	level->hdr_len = level->delta.len - remainder;
+
+	while (remainder > 0) {
+		size_t win_start = level->delta.len - remainder;
+		uint8_t win_indicator;
+		vcdiff_off_t seg_len = 0, seg_pos = 0, delta_len = 0, window_len = 0;
+
+		vcdiff_read_byte(&win_indicator, &input, &remainder);
+		if (win_indicator & (VCD_SOURCE | VCD_TARGET)) {
+			if (vcdiff_read_int(&seg_len, &input, &remainder) != VCDIFF_READ_DONE) return -EINVAL;
+			if (vcdiff_read_int(&seg_pos, &input, &remainder) != VCDIFF_READ_DONE) return -EINVAL;
+		}
+		if (vcdiff_read_int(&delta_len, &input, &remainder) != VCDIFF_READ_DONE) return -EINVAL;
+		if (delta_len > remainder) return -EINVAL;
+
+		/* the window length is the first field of the delta encoding */
+		const uint8_t *body = input;
+		size_t body_remainder = delta_len;
+		if (vcdiff_read_int(&window_len, &body, &body_remainder) != VCDIFF_READ_DONE) return -EINVAL;
+		/* windows are cached in memory as a whole */
+		if (window_len != (size_t) window_len) return -EINVAL;
+		if (window_len > level->chain->cache_size) return -EFBIG;
+
+		input += delta_len;
+		remainder -= delta_len;
+
+		if (level->window_cnt == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			struct chain_window *windows = realloc(level->windows, capacity * sizeof(*windows));
+			if (windows == NULL) return -ENOMEM;
+			level->windows = windows;
+		}
+
+		level->windows[level->window_cnt++] = (struct chain_window) {
+			.delta_offset = win_start,
+			.delta_len = level->delta.len - remainder - win_start,
+			.target_offset = target_offset,
+			.target_len = window_len,
+		};
+		target_offset += window_len;
+	}
+
+	return 0;
+}
+
+static vcdiff_t *_ctx_get (struct chain *chain) {
+	struct chain_ctx *c = chain->ctx_pool;
+	if (c) {
+		chain->ctx_pool = c->next;
+	} else {
+		c = malloc(sizeof(*c));
+		if (c == NULL) return NULL;
+	}
+	return &c->ctx;
+}
+
+static void _ctx_put (struct chain *chain, vcdiff_t *ctx) {
+	struct chain_ctx *c = (struct chain_ctx *) ((uint8_t *) ctx - offsetof(struct chain_ctx, ctx));
+	c->next = chain->ctx_pool;
+	chain->ctx_pool = c;
+}
+
+static void _lru_unlink (struct chain *chain, struct chain_entry *entry) {
+	if (entry->prev) entry->prev->next = entry->next;
+	else chain->mru = entry->next;
+	if (entry->next) entry->next->prev = entry->prev;
+	else chain->lru = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void _lru_push (struct chain *chain, struct chain_entry *entry) {
+	entry->prev = NULL;
+	entry->next = chain->mru;
+	if (chain->mru) chain->mru->prev = entry;
+	chain->mru = entry;
+	if (chain->lru == NULL) chain->lru = entry;
+}
+
+static void _entry_free (struct chain *chain, struct chain_entry *entry) {
+	_lru_unlink(chain, entry);
+	entry->window->entry = NULL;
+	chain->cache_used -= entry->window->target_len;
+	free(entry);
+}
+
+static int _evict (struct chain *chain, size_t required) {
+	struct chain_entry *entry = chain->lru;
+	while (entry && chain->cache_used + required > chain->cache_size) {
+		struct chain_entry *prev = entry->prev;
+		if (!entry->pinned) {
+			_entry_free(chain, entry);
+			chain->stat_evictions++;
+		}
+		entry = prev;
+	}
+
+	/* pinned windows are still being decoded */
+	return (chain->cache_used + required > chain->cache_size) ? -ENOSPC : 0;
+}
+
+static int _window_target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	struct window_target *target = (struct window_target *) dev;
+	struct chain_window *window = target->entry->window;
+
+	if (offset < window->target_offset || offset - window->target_offset + len > window->target_len) {
+		return -EIO;
+	}
+
+	memcpy(&target->entry->data[offset - window->target_offset], src, len);
+	return 0;
+}
+
+static int _window_target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	struct window_target *target = (struct window_target *) dev;
+	struct chain_window *window = target->entry->window;
+
+	if (offset < window->target_offset) {
+		/* VCD_TARGET segment: data lives in a previous window of the same level */
+		size_t before = window->target_offset - offset;
+		if (before > len) before = len;
+		int rc = _level_read(target->level, dest, offset, before);
+		if (rc < 0) return rc;
+		dest += before;
+		offset += before;
+		len -= before;
+	}
+
+	if (len > 0) {
+		if (offset - window->target_offset + len > window->target_len) {
+			return -EIO;
+		}
+		memcpy(dest, &target->entry->data[offset - window->target_offset], len);
+	}
+
+	return 0;
+}
+
+static const vcdiff_driver_t window_target_driver = {
+	.read = _window_target_read,
+	.write = _window_target_write
+};
+
+static struct chain_entry *_window_get (struct chain_level *level, struct chain_window *window) {
+	struct chain *chain = level->chain;
+
+	if (window->entry) {
+		chain->stat_hits++;
+		_lru_unlink(chain, window->entry);
+		_lru_push(chain, window->entry);
+		return window->entry;
+	}
+
+	chain->stat_misses++;
+	if (_evict(chain, window->target_len) < 0) {
+		fprintf(stderr, "Cannot cache intermediate window at %" VCDIFF_PRIoff ": %zukB of windows in use, cache size too small\n",
+			window->target_offset, chain->cache_used / 1024);
+		return NULL;
+	}
+
+	struct chain_entry *entry = malloc(sizeof(*entry) + window->target_len);
+	if (entry == NULL) return NULL;
+	entry->window = window;
+	entry->pinned = true;
+	window->entry = entry;
+	chain->cache_used += window->target_len;
+	_lru_push(chain, entry);
+
+	vcdiff_t *ctx = _ctx_get(chain);
+	if (ctx == NULL) {
+		_entry_free(chain, entry);
+		return NULL;
+	}
+
+	struct window_target target = {.level = level, .entry = entry};
+	vcdiff_init(ctx);
+	vcdiff_set_source_driver(ctx, level->source_driver, level->source_dev);
+	vcdiff_set_target_driver(ctx, &window_target_driver, &target);
+
+	/* decode the window as if it was the only one in a delta starting at its target offset */
+	int rc = vcdiff_apply_delta(ctx, level->delta.data, level->hdr_len);
+	if (rc == 0) {
+		vcdiff_set_target_offset(ctx, window->target_offset);
+		rc = vcdiff_apply_delta(ctx, &level->delta.data[window->delta_offset], window->delta_len);
+	}
+	if (rc == 0) {
+		rc = vcdiff_finish(ctx);
+	}
+	if (rc < 0) {
+		fprintf(stderr, "Cannot decode intermediate window at %" VCDIFF_PRIoff ": %s\n", window->target_offset, vcdiff_error_str(ctx));
+	}
+
+	_ctx_put(chain, ctx);
+	entry->pinned = false;
+
+	if (rc < 0) {
+		_entry_free(chain, entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static int _level_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	struct chain_level *level = (struct chain_level *) dev;
+
+	while (len > 0) {
+		/* find the window containing offset */
+		size_t lo = 0, hi = level->window_cnt;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			struct chain_window *w = &level->windows[mid];
+			if (offset < w->target_offset) hi = mid;
+			else if (offset >= w->target_offset + w->target_len) lo = mid + 1;
+			else lo = hi = mid;
+		}
+		if (lo >= level->window_cnt) {
+			return -EIO;
+		}
+
+		struct chain_window *window = &level->windows[lo];
+		struct chain_entry *entry = _window_get(level, window);
+		if (entry == NULL) {
+			return -EIO;
+		}
+
+		size_t pos = offset - window->target_offset;
+		size_t n = window->target_len - pos;
+		if (n > len) n = len;
+		memcpy(dest, &entry->data[pos], n);
+
+		dest += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+const vcdiff_driver_t chain_driver = {
+	.read = _level_read
+};
+
+struct chain *chain_create (const vcdiff_driver_t *source_driver, void *source_dev, size_t cache_size) {
+	struct chain *chain = calloc(1, sizeof(*chain));
+	if (chain == NULL) return NULL;
+
+	chain->source_driver = source_driver;
+	chain->source_dev = source_dev;
+	chain->cache_size = cache_size;
+
+	return chain;
+}
+
+int chain_append (struct chain *chain, const char *path) {
+	struct chain_level **levels = realloc(chain->levels, (chain->level_cnt + 1) * sizeof(*levels));
+	if (levels == NULL) return -ENOMEM;
+	chain->levels = levels;
+
+	struct chain_level *level = calloc(1, sizeof(*level));
+	if (level == NULL) return -ENOMEM;
+	level->chain = chain;
+
+	int rc = batch_map_file(&level->delta, path);
+	if (rc < 0) {
+		free(level);
+		return rc;
+	}
+
+	rc = _index_delta(level);
+	if (rc < 0) {
+		batch_unmap_file(&level->delta);
+		free(level->windows);
+		free(level);
+		return rc;
+	}
+
+	if (chain->level_cnt == 0) {
+		level->source_driver = chain->source_driver;
+		level->source_dev = chain->source_dev;
+	} else {
+		level->source_driver = &chain_driver;
+		level->source_dev = chain->levels[chain->level_cnt - 1];
+	}
+
+	chain->levels[chain->level_cnt++] = level;
+	return 0;
+}
+
+void *chain_dev (struct chain *chain) {
+	if (chain->level_cnt == 0) return NULL;
+	return chain->levels[chain->level_cnt - 1];
+}
+
+void chain_print_stats (const struct chain *chain) {
+	fprintf(stderr, "CHAIN LEVELS=%zu HITS=%zu MISSES=%zu EVICTIONS=%zu CACHED=%zukB\n",
+		chain->level_cnt, chain->stat_hits, chain->stat_misses, chain->stat_evictions,
+		chain->cache_used / 1024);
+}
+
+void chain_destroy (struct chain *chain) {
+	while (chain->mru) {
+		_entry_free(chain, chain->mru);
+	}
+
+	while (chain->ctx_pool) {
+		struct chain_ctx *c = chain->ctx_pool;
+		chain->ctx_pool = c->next;
+		free(c);
+	}
+
+	for (size_t i = 0; i < chain->level_cnt; i++) {
+		batch_unmap_file(&chain->levels[i]->delta);
+		free(chain->levels[i]->windows);
+		free(chain->levels[i]);
+	}
+
+	free(chain->levels);
+	free(chain);
+}
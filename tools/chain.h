@@ -0,0 +1,66 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vcdiff.h"
+
+/**
+ * @brief   Chain of deltas that are resolved on demand
+ *
+ * Every delta of the chain is exposed as a virtual source image. Reading from
+ * it decodes the covering windows of the delta, which in turn read from the
+ * previous delta of the chain or the base source. Decoded windows are kept in
+ * a cache of bounded size; intermediate versions are never written anywhere.
+ *
+ * Windows are cached as a whole and stay in the cache while they are decoded,
+ * so the cache must hold one window of every level at once. Reading fails if
+ * it does not; deltas with windows larger than the cache are rejected.
+ */
+struct chain;
+
+/**
+ * @brief   Creates a chain on top of the given base source
+ *
+ * @param[in]  source_driver Driver of the base source
+ * @param[in]  source_dev    Context of the base source driver
+ * @param[in]  cache_size    Upper bound in bytes for cached intermediate windows
+ * @return Chain or `NULL` if out of memory
+ */
+struct chain *chain_create (const vcdiff_driver_t *source_driver, void *source_dev, size_t cache_size);
+
+/**
+ * @brief   Appends a delta to the chain
+ *
+ * The delta is applied to the output of the previously appended delta.
+ *
+ * @param      chain     Chain
+ * @param[in]  path      Path to the delta file
+ * @return `0` on success, `-EFBIG` if a window exceeds the cache size, `<0` if
+ *         the delta cannot be opened or indexed
+ */
+int chain_append (struct chain *chain, const char *path);
+
+/**
+ * @brief   Driver for reading the output of the last appended delta
+ *
+ * Use this together with chain_dev() as source driver for the final delta.
+ */
+extern const vcdiff_driver_t chain_driver;
+
+/**
+ * @brief   Driver context for the output of the last appended delta
+ */
+void *chain_dev (struct chain *chain);
+
+/**
+ * @brief   Prints cache statistics to stderr
+ */
+void chain_print_stats (const struct chain *chain);
+
+/**
+ * @brief   Releases all resources of the chain
+ */
+void chain_destroy (struct chain *chain);
+
+#endif
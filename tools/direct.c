@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "direct.h"
+
+#define ALIGN_DOWN(VAL, ALIGN) ((VAL) - (VAL) % (ALIGN))
+#define ALIGN_UP(VAL, ALIGN) ALIGN_DOWN((VAL) + (ALIGN) - 1, ALIGN)
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+#define DEFAULT_ALIGN 4096
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+void *direct_alloc (size_t len, bool *huge) {
+	void *ptr;
+
+#ifdef MAP_HUGETLB
+	/* explicit hugepages have to be reserved by the administrator */
+	ptr = mmap(NULL, ALIGN_UP(len, HUGEPAGE_SIZE), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED) {
+		*huge = true;
+		return ptr;
+	}
+#endif
+
+	*huge = false;
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+	return ptr;
+}
+
+void direct_free (void *ptr, size_t len, bool huge) {
+	if (ptr) munmap(ptr, huge ? ALIGN_UP(len, HUGEPAGE_SIZE) : len);
+}
+
+static size_t _dio_align (int fd) {
+#if defined(STATX_DIOALIGN)
+	struct statx stx;
+	if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+	    stx.stx_dio_offset_align > 0) {
+		size_t align = stx.stx_dio_offset_align;
+		if (align < stx.stx_dio_mem_align) align = stx.stx_dio_mem_align;
+		return align;
+	}
+#else
+	(void) fd;
+#endif
+	return DEFAULT_ALIGN;
+}
+
+int direct_open (struct direct_target *target, const char *path, bool direct, size_t stage_size) {
+	memset(target, 0, sizeof(*target));
+
+	target->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+	if (target->fd < 0) return -errno;
+
+	target->direct = direct;
+	target->align = direct ? _dio_align(target->fd) : 1;
+	target->stage_size = ALIGN_UP(stage_size, target->align);
+
+	/* staging and bounce buffer share one allocation */
+	target->stage = direct_alloc(2 * target->stage_size, &target->hugepages);
+	if (target->stage == NULL) {
+		close(target->fd);
+		return -ENOMEM;
+	}
+	target->bounce = target->stage + target->stage_size;
+
+	return 0;
+}
+
+static int _pwrite_all (struct direct_target *target, const uint8_t *src, vcdiff_off_t offset, size_t len) {
+	target->writes++;
+	while (len > 0) {
+		ssize_t n = pwrite(target->fd, src, len, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return (n < 0) ? -errno : -EIO;
+		src += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* reads whole blocks; missing data beyond the end of file reads as zeros */
+static int _pread_blocks (struct direct_target *target, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	while (len > 0) {
+		ssize_t n = pread(target->fd, dest, len, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -errno;
+		if (n == 0) {
+			memset(dest, 0, len);
+			return 0;
+		}
+		dest += n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* writes the staged data; a partial last block stays staged */
+static int _stage_flush (struct direct_target *target) {
+	if (target->stage_len == 0) return 0;
+
+	size_t len = ALIGN_UP(target->stage_len, target->align);
+	vcdiff_off_t end = target->stage_offset + target->stage_len;
+	int rc;
+
+	/* pad the last block with what is already behind the staged data */
+	if (len > target->stage_len && end < target->len) {
+		rc = _pread_blocks(target, target->bounce, ALIGN_DOWN(end, target->align), target->align);
+		if (rc < 0) return rc;
+		target->rmw_reads++;
+		memcpy(target->stage + target->stage_len, target->bounce + end % target->align, len - target->stage_len);
+	} else {
+		memset(target->stage + target->stage_len, 0, len - target->stage_len);
+	}
+
+	rc = _pwrite_all(target, target->stage, target->stage_offset, len);
+	if (rc < 0) return rc;
+
+	size_t full = ALIGN_DOWN(target->stage_len, target->align);
+	memmove(target->stage, target->stage + full, target->stage_len - full);
+	target->stage_offset += full;
+	target->stage_len -= full;
+	return 0;
+}
+
+/* moves the staging buffer to the block containing offset */
+static int _stage_seek (struct direct_target *target, vcdiff_off_t offset) {
+	int rc = _stage_flush(target);
+	if (rc < 0) return rc;
+
+	target->stage_offset = ALIGN_DOWN(offset, target->align);
+	target->stage_len = offset - target->stage_offset;
+	if (target->stage_len > 0) {
+		/* keep the data in front of offset within its block */
+		rc = _pread_blocks(target, target->stage, target->stage_offset, target->align);
+		if (rc < 0) return rc;
+		target->rmw_reads++;
+	}
+
+	return 0;
+}
+
+static int _direct_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	struct direct_target *target = (struct direct_target *) dev;
+	int rc;
+
+	if (offset != target->stage_offset + target->stage_len) {
+		rc = _stage_seek(target, offset);
+		if (rc < 0) return rc;
+	}
+
+	while (len > 0) {
+		/* aligned data bypasses the staging buffer */
+		if (target->stage_len == 0 && (uintptr_t) src % target->align == 0 && len >= target->align) {
+			size_t n = ALIGN_DOWN(len, target->align);
+			rc = _pwrite_all(target, src, offset, n);
+			if (rc < 0) return rc;
+			target->direct_bytes += n;
+			target->stage_offset += n;
+			src += n;
+			offset += n;
+			len -= n;
+			continue;
+		}
+
+		size_t n = MIN(len, target->stage_size - target->stage_len);
+		memcpy(target->stage + target->stage_len, src, n);
+		target->stage_len += n;
+		src += n;
+		offset += n;
+		len -= n;
+
+		if (target->stage_len == target->stage_size) {
+			rc = _stage_flush(target);
+			if (rc < 0) return rc;
+		}
+	}
+
+	if (offset > target->len) target->len = offset;
+	return 0;
+}
+
+static int _direct_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	struct direct_target *target = (struct direct_target *) dev;
+	vcdiff_off_t stage_end = target->stage_offset + target->stage_len;
+
+	while (len > 0) {
+		if (offset >= target->stage_offset && offset < stage_end) {
+			/* not written to the file, yet */
+			size_t n = MIN(len, stage_end - offset);
+			memcpy(dest, target->stage + (offset - target->stage_offset), n);
+			dest += n;
+			offset += n;
+			len -= n;
+			continue;
+		}
+
+		/* aligned read through the bounce buffer up to the staged data */
+		vcdiff_off_t end = offset + len;
+		if (offset < target->stage_offset && end > target->stage_offset) end = target->stage_offset;
+		vcdiff_off_t from = ALIGN_DOWN(offset, target->align);
+		vcdiff_off_t until = MIN(ALIGN_UP(end, target->align), from + target->stage_size);
+		int rc = _pread_blocks(target, target->bounce, from, until - from);
+		if (rc < 0) return rc;
+
+		size_t n = MIN(end, until) - offset;
+		memcpy(dest, target->bounce + (offset - from), n);
+		dest += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int _direct_flush (void *dev) {
+	struct direct_target *target = (struct direct_target *) dev;
+
+	return _stage_flush(target);
+}
+
+int direct_close (struct direct_target *target) {
+	int rc = _stage_flush(target);
+
+	/* drop the padding of the last block */
+	if (rc == 0 && ftruncate(target->fd, target->len) < 0) rc = -errno;
+	if (close(target->fd) < 0 && rc == 0) rc = -errno;
+
+	direct_free(target->stage, 2 * target->stage_size, target->hugepages);
+
+	return rc;
+}
+
+const vcdiff_driver_t direct_driver = {
+	.read = _direct_read,
+	.write = _direct_write,
+	.flush = _direct_flush
+};
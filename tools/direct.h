@@ -0,0 +1,76 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "vcdiff.h"
+
+/**
+ * @brief   Target file written with O_DIRECT, bypassing the page cache
+ *
+ * O_DIRECT requires offsets, lengths and memory to be aligned. Writes of the
+ * decoder are collected in an aligned staging buffer and written in whole
+ * stage sizes. A write starting in the middle of a block reads that block
+ * back first (read-modify-write). The last partial block is padded and the
+ * file is truncated to its real length when closing it. Aligned writes from
+ * aligned memory bypass the staging buffer.
+ *
+ * Without O_DIRECT, the same staging is done on top of the page cache.
+ */
+struct direct_target {
+	int fd;
+	bool direct;         /**< Opened with O_DIRECT */
+	size_t align;        /**< Alignment required by O_DIRECT */
+
+	uint8_t *stage;      /**< Aligned staging buffer */
+	size_t stage_size;
+	vcdiff_off_t stage_offset; /**< File offset of stage[0]; aligned */
+	size_t stage_len;    /**< Valid bytes in the staging buffer */
+	uint8_t *bounce;     /**< Aligned buffer for reading back */
+	vcdiff_off_t len;    /**< Length of the target */
+
+	size_t writes;       /**< Amount of write calls */
+	size_t rmw_reads;    /**< Blocks read back for read-modify-write */
+	size_t direct_bytes; /**< Bytes written bypassing the staging buffer */
+	bool hugepages;      /**< Buffers are backed by hugepages */
+};
+
+/**
+ * @brief   Allocates page-aligned memory, preferably from hugepages
+ *
+ * @param[in]  len       Size in bytes
+ * @param[out] huge      Set if the memory is backed by explicit hugepages
+ * @return Memory to be released with direct_free(), or NULL
+ */
+void *direct_alloc (size_t len, bool *huge);
+
+/**
+ * @brief   Releases memory allocated by direct_alloc()
+ */
+void direct_free (void *ptr, size_t len, bool huge);
+
+/**
+ * @brief   Creates the target file
+ *
+ * @param[out] target     Target context
+ * @param[in]  path       Path of the target file; it is truncated
+ * @param[in]  direct     Open with O_DIRECT
+ * @param[in]  stage_size Size of the staging buffer; multiple of the alignment
+ * @return `0` on success, `<0` on error
+ */
+int direct_open (struct direct_target *target, const char *path, bool direct, size_t stage_size);
+
+/**
+ * @brief   Writes outstanding data, truncates and closes the target file
+ *
+ * @return `0` on success, `<0` on error
+ */
+int direct_close (struct direct_target *target);
+
+/**
+ * @brief   Driver to be used with vcdiff_set_target_driver() and the direct_target as device
+ */
+extern const vcdiff_driver_t direct_driver;
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "vcdiff/parse.h"
+#include "vcdiff/write.h"
+#include "vcdiff/codetable.h"
+#include "emit.h"
+
+static const uint8_t delta_hdr[] = {0xd6, 0xc3, 0xc4, 0x53, 0x00};
+
+void *emit_grow (void *ptr, size_t *cap, size_t cnt, size_t size) {
+	if (cnt < *cap) return ptr;
+	size_t new_cap = *cap ? *cap * 2 : 64;
+	void *new_ptr = realloc(ptr, new_cap * size);
+	if (new_ptr == NULL) {
+		perror("Out of memory");
+		exit(1);
+	}
+	*cap = new_cap;
+	return new_ptr;
+}
+
+void emit_buf_append (struct emit_buf *buf, const uint8_t *data, size_t len) {
+	while (buf->len + len > buf->cap) {
+		buf->data = emit_grow(buf->data, &buf->cap, buf->cap, 1);
+	}
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+}
+
+void emit_buf_append_int (struct emit_buf *buf, size_t value) {
+	uint8_t tmp[VCDIFF_WRITE_INT_MAX_LEN];
+	emit_buf_append(buf, tmp, vcdiff_write_int(tmp, value));
+}
+
+void emit_buf_append_byte (struct emit_buf *buf, uint8_t byte) {
+	emit_buf_append(buf, &byte, 1);
+}
+
+void emit_header (struct emit_buf *buf) {
+	emit_buf_append(buf, delta_hdr, sizeof(delta_hdr));
+}
+
+void emit_inst (struct emit_window *out, uint8_t kind, size_t len, size_t arg, const uint8_t *data) {
+	if (len == 0) return;
+
+	if (out->cnt > 0) {
+		/* coalesce with the previous instruction if possible */
+		struct emit_inst *last = &out->insts[out->cnt - 1];
+		if (last->kind == kind && (
+		    (kind == EMIT_ADD && last->data + last->len == data) ||
+		    (kind == EMIT_RUN && last->arg == arg) ||
+		    (kind == EMIT_COPY_SOURCE && last->arg + last->len == arg) ||
+		    (kind == EMIT_COPY_TARGET && last->arg + last->len == arg))) {
+			last->len += len;
+			out->pos += len;
+			return;
+		}
+	}
+
+	out->insts = emit_grow(out->insts, &out->cap, out->cnt, sizeof(*out->insts));
+	out->insts[out->cnt++] = (struct emit_inst) {
+		.kind = kind, .len = len, .arg = arg, .data = data
+	};
+	out->pos += len;
+}
+
+void emit_window (struct emit_buf *buf, const struct emit_window *out, size_t window_len) {
+	size_t seg_start = SIZE_MAX;
+	size_t seg_end = 0;
+	struct emit_buf inst = {0};
+
+	for (size_t i = 0; i < out->cnt; i++) {
+		const struct emit_inst *o = &out->insts[i];
+		if (o->kind != EMIT_COPY_SOURCE) continue;
+		if (o->arg < seg_start) seg_start = o->arg;
+		if (o->arg + o->len > seg_end) seg_end = o->arg + o->len;
+	}
+	size_t seg_len = (seg_end > 0) ? seg_end - seg_start : 0;
+
+	size_t here = seg_len;
+	for (size_t i = 0; i < out->cnt; i++) {
+		const struct emit_inst *o = &out->insts[i];
+		uint8_t code;
+		uint8_t inst0, inst1, mode0, mode1;
+		vcdiff_off_t size0, size1;
+
+		if (o->kind == EMIT_ADD || o->kind == EMIT_RUN) {
+			code = vcdiff_codetable_encode((o->kind == EMIT_ADD) ? VCDIFF_INST_ADD : VCDIFF_INST_RUN, o->len, 0);
+			vcdiff_codetable_decode(&inst0, &size0, &mode0, &inst1, &size1, &mode1, code);
+			emit_buf_append_byte(&inst, code);
+			if (size0 == 0) emit_buf_append_int(&inst, o->len);
+			if (o->kind == EMIT_ADD) emit_buf_append(&inst, o->data, o->len);
+			else emit_buf_append_byte(&inst, o->arg);
+		} else {
+			size_t addr = (o->kind == EMIT_COPY_SOURCE)
+				? o->arg - seg_start
+				: seg_len + o->arg - out->target_offset;
+			uint8_t mode = 0;
+			if (vcdiff_write_int_len(here - addr) < vcdiff_write_int_len(addr)) {
+				mode = 1;
+				addr = here - addr;
+			}
+			code = vcdiff_codetable_encode(VCDIFF_INST_COPY, o->len, mode);
+			vcdiff_codetable_decode(&inst0, &size0, &mode0, &inst1, &size1, &mode1, code);
+			emit_buf_append_byte(&inst, code);
+			if (size0 == 0) emit_buf_append_int(&inst, o->len);
+			emit_buf_append_int(&inst, addr);
+		}
+		here += o->len;
+	}
+
+	struct emit_buf body = {0};
+	emit_buf_append_int(&body, window_len);
+	emit_buf_append_byte(&body, 0x00); /* delta indicator */
+	emit_buf_append_int(&body, 0);     /* data length */
+	emit_buf_append_int(&body, inst.len);
+	emit_buf_append_int(&body, 0);     /* address length */
+	emit_buf_append(&body, inst.data, inst.len);
+
+	if (seg_len > 0) {
+		emit_buf_append_byte(buf, VCDIFF_VCD_SOURCE);
+		emit_buf_append_int(buf, seg_len);
+		emit_buf_append_int(buf, seg_start);
+	} else {
+		emit_buf_append_byte(buf, 0x00);
+	}
+	emit_buf_append_int(buf, body.len);
+	emit_buf_append(buf, body.data, body.len);
+
+	free(inst.data);
+	free(body.data);
+}
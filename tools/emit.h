@@ -0,0 +1,86 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief   Growing byte buffer
+ */
+struct emit_buf {
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+};
+
+enum {
+	EMIT_ADD,
+	EMIT_RUN,
+	EMIT_COPY_SOURCE,       /**< Copy from the source */
+	EMIT_COPY_TARGET        /**< Copy from the current window of the target */
+};
+
+/**
+ * @brief   Instruction of a window to be written
+ */
+struct emit_inst {
+	uint8_t kind;
+	size_t len;
+	size_t arg;             /**< RUN: byte; COPY: absolute offset in the source or target */
+	const uint8_t *data;    /**< ADD: data */
+};
+
+/**
+ * @brief   Instructions of a window to be written
+ */
+struct emit_window {
+	struct emit_inst *insts;
+	size_t cnt;
+	size_t cap;
+	size_t target_offset;   /**< Offset of the window in the target */
+	size_t pos;             /**< Absolute offset in the target of the next emitted byte */
+};
+
+/**
+ * @brief   Grows an array to hold at least cnt + 1 elements
+ *
+ * Exits the process if no memory is left.
+ *
+ * @param[in]     ptr    Array or NULL
+ * @param[in,out] cap    Capacity of the array in elements
+ * @param[in]     cnt    Amount of used elements
+ * @param[in]     size   Size of one element
+ * @return The (possibly moved) array
+ */
+void *emit_grow (void *ptr, size_t *cap, size_t cnt, size_t size);
+
+void emit_buf_append (struct emit_buf *buf, const uint8_t *data, size_t len);
+
+void emit_buf_append_int (struct emit_buf *buf, size_t value);
+
+void emit_buf_append_byte (struct emit_buf *buf, uint8_t byte);
+
+/**
+ * @brief   Appends the delta header for the default code table
+ */
+void emit_header (struct emit_buf *buf);
+
+/**
+ * @brief   Appends an instruction to the window
+ *
+ * Instructions continuing the previous one are coalesced with it.
+ */
+void emit_inst (struct emit_window *out, uint8_t kind, size_t len, size_t arg, const uint8_t *data);
+
+/**
+ * @brief   Encodes the window with the default code table and appends it
+ *
+ * The source segment spans all EMIT_COPY_SOURCE instructions.
+ *
+ * @param[out] buf          Delta to append the window to
+ * @param[in]  out          Instructions of the window
+ * @param[in]  window_len   Length of the window in the target
+ */
+void emit_window (struct emit_buf *buf, const struct emit_window *out, size_t window_len);
+
+#endif
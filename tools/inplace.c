@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vcdiff/parse.h"
+#include "inplace.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+enum cmd_type {
+	CMD_COPY,        /**< Copy from the original image */
+	CMD_TARGET_COPY, /**< Copy from target data written by other commands */
+	CMD_ADD,
+	CMD_RUN
+};
+
+struct cmd {
+	uint8_t type;
+	bool staged;             /**< Source data is read into the scratch buffer beforehand */
+	bool done;
+	size_t dst;
+	size_t len;
+	size_t src;              /**< COPY: offset to read from */
+	size_t scratch;          /**< Staged COPY: offset inside the scratch buffer */
+	const uint8_t *data;     /**< ADD: data to write; RUN: byte to repeat */
+	size_t indegree;         /**< Amount of unsatisfied constraints */
+	size_t visit;            /**< Stamp of the last cycle search */
+	size_t pred_edge;        /**< Edge the cycle search went along */
+};
+
+struct edge {
+	size_t from;
+	size_t to;
+	bool war;                /**< from reads data that to overwrites */
+	bool removed;            /**< Constraint dropped by staging from */
+};
+
+struct op {
+	size_t cmd;
+	bool stage;              /**< Read source data into scratch instead of executing */
+};
+
+struct plan {
+	struct cmd *cmds;
+	size_t cmd_cnt;
+	size_t cmd_cap;
+
+	struct edge *edges;
+	size_t edge_cnt;
+	size_t edge_cap;
+
+	/* edge indices grouped by tail and by head */
+	size_t *out_start;
+	size_t *out;
+	size_t *in_start;
+	size_t *in;
+
+	struct op *ops;
+	size_t op_cnt;
+
+	size_t target_len;
+	size_t scratch_used;
+	size_t staged;
+	size_t stamp;
+};
+
+static int _add_cmd (struct plan *plan, const struct cmd *cmd) {
+	if (cmd->len == 0) return 0;
+
+	if (plan->cmd_cnt == plan->cmd_cap) {
+		size_t cap = plan->cmd_cap ? plan->cmd_cap * 2 : 1024;
+		struct cmd *cmds = realloc(plan->cmds, cap * sizeof(*cmds));
+		if (cmds == NULL) return -ENOMEM;
+		plan->cmds = cmds;
+		plan->cmd_cap = cap;
+	}
+
+	plan->cmds[plan->cmd_cnt++] = *cmd;
+	return 0;
+}
+
+static int _add_edge (struct plan *plan, size_t from, size_t to, bool war) {
+	if (plan->edge_cnt == plan->edge_cap) {
+		size_t cap = plan->edge_cap ? plan->edge_cap * 2 : 1024;
+		struct edge *edges = realloc(plan->edges, cap * sizeof(*edges));
+		if (edges == NULL) return -ENOMEM;
+		plan->edges = edges;
+		plan->edge_cap = cap;
+	}
+
+	plan->edges[plan->edge_cnt++] = (struct edge) {.from = from, .to = to, .war = war};
+	plan->cmds[to].indegree++;
+	return 0;
+}
+
+static int _build_cmds (struct plan *plan, const uint8_t *delta, size_t delta_len, size_t image_len, const char **error_msg) {
+	static vcdiff_cache_t cache;
+	static vcdiff_codetable_t codetable;
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+	size_t target_offset = 0;
+	int rc;
+
+	vcdiff_parser_init(&parser, &cache, &codetable, delta, delta_len);
+	rc = vcdiff_parse_header(&parser);
+	while (rc == 0 && (rc = vcdiff_parse_window(&parser, &win)) > 0) {
+		if ((win.indicator & VCDIFF_VCD_SOURCE) && (win.segment_len > image_len || win.segment_pos > image_len - win.segment_len)) {
+			*error_msg = "Source segment exceeds image";
+			return -EINVAL;
+		}
+		if ((win.indicator & VCDIFF_VCD_TARGET) && (win.segment_len > target_offset || win.segment_pos > target_offset - win.segment_len)) {
+			*error_msg = "Target segment exceeds written data";
+			return -EINVAL;
+		}
+
+		while ((rc = vcdiff_parse_inst(&parser, &inst)) > 0) {
+			struct cmd cmd = {.dst = target_offset + inst.window_pos, .len = inst.size, .data = inst.data};
+			if (inst.inst == VCDIFF_INST_ADD) {
+				cmd.type = CMD_ADD;
+			} else if (inst.inst == VCDIFF_INST_RUN) {
+				cmd.type = CMD_RUN;
+			} else if (inst.addr < win.segment_len) {
+				cmd.type = (win.indicator & VCDIFF_VCD_SOURCE) ? CMD_COPY : CMD_TARGET_COPY;
+				cmd.src = win.segment_pos + inst.addr;
+			} else {
+				cmd.type = CMD_TARGET_COPY;
+				cmd.src = target_offset + inst.addr - win.segment_len;
+			}
+			if (_add_cmd(plan, &cmd) < 0) {
+				*error_msg = "Out of memory";
+				return -ENOMEM;
+			}
+		}
+
+		target_offset += win.window_len;
+	}
+
+	if (rc < 0) {
+		*error_msg = parser.error_msg;
+		return -EINVAL;
+	}
+
+	plan->target_len = target_offset;
+	return 0;
+}
+
+/* commands are ordered by their target offset and never overlap */
+static size_t _first_writer (const struct plan *plan, size_t offset) {
+	size_t lo = 0;
+	size_t hi = plan->cmd_cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (plan->cmds[mid].dst + plan->cmds[mid].len <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static size_t *_group_edges (const struct plan *plan, bool by_tail, size_t **start) {
+	size_t *idx = malloc((plan->edge_cnt + 1) * sizeof(*idx));
+	*start = calloc(plan->cmd_cnt + 1, sizeof(**start));
+	if (idx == NULL || *start == NULL) {
+		free(idx);
+		return NULL;
+	}
+
+	/* counting sort: edges of node i end up at idx[start[i]] to idx[start[i + 1] - 1] */
+	for (size_t e = 0; e < plan->edge_cnt; e++) {
+		(*start)[(by_tail ? plan->edges[e].from : plan->edges[e].to) + 1]++;
+	}
+	for (size_t i = 0; i < plan->cmd_cnt; i++) {
+		(*start)[i + 1] += (*start)[i];
+	}
+	for (size_t e = 0; e < plan->edge_cnt; e++) {
+		idx[(*start)[by_tail ? plan->edges[e].from : plan->edges[e].to]++] = e;
+	}
+	for (size_t i = plan->cmd_cnt; i > 0; i--) {
+		(*start)[i] = (*start)[i - 1];
+	}
+	(*start)[0] = 0;
+
+	return idx;
+}
+
+static int _build_edges (struct plan *plan) {
+	for (size_t u = 0; u < plan->cmd_cnt; u++) {
+		const struct cmd *cmd = &plan->cmds[u];
+		if (cmd->type != CMD_COPY && cmd->type != CMD_TARGET_COPY) continue;
+
+		for (size_t w = _first_writer(plan, cmd->src); w < plan->cmd_cnt && plan->cmds[w].dst < cmd->src + cmd->len; w++) {
+			int rc;
+			/* overlapping with itself is taken care of while copying */
+			if (w == u) continue;
+			if (cmd->type == CMD_COPY) {
+				/* read the source before it is overwritten */
+				rc = _add_edge(plan, u, w, true);
+			} else {
+				/* read the target after it has been written */
+				rc = _add_edge(plan, w, u, false);
+			}
+			if (rc < 0) return rc;
+		}
+	}
+
+	plan->out = _group_edges(plan, true, &plan->out_start);
+	plan->in = _group_edges(plan, false, &plan->in_start);
+	if (plan->out == NULL || plan->in == NULL) return -ENOMEM;
+
+	return 0;
+}
+
+static void _emit (struct plan *plan, size_t u, bool stage, size_t *queue, size_t *tail) {
+	plan->ops[plan->op_cnt++] = (struct op) {.cmd = u, .stage = stage};
+	if (!stage) plan->cmds[u].done = true;
+
+	for (size_t i = plan->out_start[u]; i < plan->out_start[u + 1]; i++) {
+		struct edge *edge = &plan->edges[plan->out[i]];
+		if (edge->removed) continue;
+		/* staging satisfies read-before-write constraints only */
+		if (stage && !edge->war) continue;
+		if (stage) edge->removed = true;
+		if (--plan->cmds[edge->to].indegree == 0) queue[(*tail)++] = edge->to;
+	}
+}
+
+static int _break_cycle (struct plan *plan, size_t first, size_t scratch_size, size_t *queue, size_t *tail, const char **error_msg) {
+	/* every remaining command waits for another remaining one; walking
+	 * backwards along unsatisfied constraints thus ends up in a cycle */
+	size_t stamp = ++plan->stamp;
+	size_t u = first;
+	while (plan->cmds[u].visit != stamp) {
+		plan->cmds[u].visit = stamp;
+		for (size_t i = plan->in_start[u]; i < plan->in_start[u + 1]; i++) {
+			const struct edge *edge = &plan->edges[plan->in[i]];
+			if (edge->removed || plan->cmds[edge->from].done) continue;
+			plan->cmds[u].pred_edge = plan->in[i];
+			break;
+		}
+		u = plan->edges[plan->cmds[u].pred_edge].from;
+	}
+
+	/* stage the smallest COPY whose read-before-write constraint is part of the cycle */
+	size_t best = SIZE_MAX;
+	size_t v = u;
+	do {
+		const struct edge *edge = &plan->edges[plan->cmds[v].pred_edge];
+		if (edge->war && (best == SIZE_MAX || plan->cmds[edge->from].len < plan->cmds[best].len)) {
+			best = edge->from;
+		}
+		v = edge->from;
+	} while (v != u);
+
+	if (best == SIZE_MAX) {
+		*error_msg = "Cannot resolve write order";
+		return -EINVAL;
+	}
+
+	struct cmd *cmd = &plan->cmds[best];
+	if (cmd->len > scratch_size - plan->scratch_used) {
+		*error_msg = "Scratch area too small";
+		return -ENOSPC;
+	}
+
+	cmd->staged = true;
+	cmd->scratch = plan->scratch_used;
+	plan->scratch_used += cmd->len;
+	plan->staged++;
+	_emit(plan, best, true, queue, tail);
+
+	return 0;
+}
+
+static int _schedule (struct plan *plan, size_t scratch_size, const char **error_msg) {
+	size_t *queue = malloc((plan->cmd_cnt + 1) * sizeof(*queue));
+	size_t head = 0;
+	size_t tail = 0;
+	size_t first = 0;
+	int rc = 0;
+
+	plan->ops = malloc((2 * plan->cmd_cnt + 1) * sizeof(*plan->ops));
+	if (queue == NULL || plan->ops == NULL) {
+		free(queue);
+		*error_msg = "Out of memory";
+		return -ENOMEM;
+	}
+
+	/* Kahn's algorithm; commands without constraints run in delta order */
+	for (size_t u = 0; u < plan->cmd_cnt; u++) {
+		if (plan->cmds[u].indegree == 0) queue[tail++] = u;
+	}
+
+	for (size_t emitted = 0; emitted < plan->cmd_cnt;) {
+		if (head == tail) {
+			while (plan->cmds[first].done) first++;
+			rc = _break_cycle(plan, first, scratch_size, queue, &tail, error_msg);
+			if (rc < 0) break;
+			continue;
+		}
+
+		_emit(plan, queue[head++], false, queue, &tail);
+		emitted++;
+	}
+
+	free(queue);
+	return rc;
+}
+
+static int _pread_all (int fd, uint8_t *buf, size_t len, size_t offset) {
+	while (len) {
+		ssize_t n = pread(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -errno;
+		if (n == 0) return -EIO;
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int _pwrite_all (int fd, const uint8_t *buf, size_t len, size_t offset) {
+	while (len) {
+		ssize_t n = pwrite(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -errno;
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int _copy (int fd, uint8_t *buf, const struct cmd *cmd) {
+	size_t len = cmd->len;
+	size_t chunk_max = CHUNK_SIZE;
+	bool overlap = cmd->dst > cmd->src && cmd->dst < cmd->src + cmd->len;
+
+	if (overlap && cmd->type == CMD_TARGET_COPY) {
+		/* repeats the data ahead; chunks must not exceed the distance */
+		if (chunk_max > cmd->dst - cmd->src) chunk_max = cmd->dst - cmd->src;
+		overlap = false;
+	}
+
+	/* overlapping source copies behave like memmove: copy backwards */
+	while (len) {
+		size_t chunk = (len > chunk_max) ? chunk_max : len;
+		size_t pos = overlap ? len - chunk : cmd->len - len;
+		int rc = _pread_all(fd, buf, chunk, cmd->src + pos);
+		if (rc < 0) return rc;
+		rc = _pwrite_all(fd, buf, chunk, cmd->dst + pos);
+		if (rc < 0) return rc;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int _execute (const struct plan *plan, int fd, uint8_t *scratch, const char **error_msg) {
+	uint8_t *buf = malloc(CHUNK_SIZE);
+	int rc = 0;
+
+	if (buf == NULL) {
+		*error_msg = "Out of memory";
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; rc == 0 && i < plan->op_cnt; i++) {
+		const struct cmd *cmd = &plan->cmds[plan->ops[i].cmd];
+		if (plan->ops[i].stage) {
+			rc = _pread_all(fd, scratch + cmd->scratch, cmd->len, cmd->src);
+		} else if (cmd->staged) {
+			rc = _pwrite_all(fd, scratch + cmd->scratch, cmd->len, cmd->dst);
+		} else if (cmd->type == CMD_ADD) {
+			rc = _pwrite_all(fd, cmd->data, cmd->len, cmd->dst);
+		} else if (cmd->type == CMD_RUN) {
+			memset(buf, *cmd->data, CHUNK_SIZE);
+			for (size_t pos = 0; rc == 0 && pos < cmd->len; pos += CHUNK_SIZE) {
+				rc = _pwrite_all(fd, buf, (cmd->len - pos > CHUNK_SIZE) ? CHUNK_SIZE : cmd->len - pos, cmd->dst + pos);
+			}
+		} else {
+			rc = _copy(fd, buf, cmd);
+		}
+	}
+
+	if (rc == 0 && ftruncate(fd, plan->target_len) < 0) rc = -errno;
+	if (rc < 0) *error_msg = strerror(-rc);
+
+	free(buf);
+	return rc;
+}
+
+int inplace_apply (int fd, const uint8_t *delta, size_t delta_len, size_t scratch_size,
+                   struct inplace_stats *stats, const char **error_msg) {
+	struct plan plan = {0};
+	uint8_t *scratch = NULL;
+	struct stat st;
+	int rc;
+
+	if (fstat(fd, &st) < 0) {
+		*error_msg = strerror(errno);
+		return -errno;
+	}
+
+	rc = _build_cmds(&plan, delta, delta_len, st.st_size, error_msg);
+	if (rc < 0) goto exit;
+
+	rc = _build_edges(&plan);
+	if (rc < 0) {
+		*error_msg = "Out of memory";
+		goto exit;
+	}
+
+	rc = _schedule(&plan, scratch_size, error_msg);
+	if (rc < 0) goto exit;
+
+	if (plan.scratch_used) {
+		scratch = malloc(plan.scratch_used);
+		if (scratch == NULL) {
+			*error_msg = "Out of memory";
+			rc = -ENOMEM;
+			goto exit;
+		}
+	}
+
+	rc = _execute(&plan, fd, scratch, error_msg);
+
+exit:
+	if (stats) {
+		stats->cmds = plan.cmd_cnt;
+		stats->edges = plan.edge_cnt;
+		stats->staged = plan.staged;
+		stats->staged_bytes = plan.scratch_used;
+	}
+
+	free(scratch);
+	free(plan.ops);
+	free(plan.in);
+	free(plan.in_start);
+	free(plan.out);
+	free(plan.out_start);
+	free(plan.edges);
+	free(plan.cmds);
+
+	return rc;
+}
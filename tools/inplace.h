@@ -0,0 +1,41 @@
+#ifndef INPLACE_H
+#define INPLACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief   Statistics of an in-place update
+ */
+struct inplace_stats {
+	size_t cmds;         /**< Amount of commands derived from the delta */
+	size_t edges;        /**< Amount of ordering constraints between commands */
+	size_t staged;       /**< Amount of COPY commands staged to break cycles */
+	size_t staged_bytes; /**< Amount of scratch bytes used for staging */
+};
+
+/**
+ * @brief   Applies a delta to an image in place
+ *
+ * Source and target are the same file. Every COPY from the source must read
+ * its data before another command overwrites it, and every COPY from the
+ * target must run after the commands producing its data. The commands are
+ * ordered accordingly. If the constraints form a cycle, the source data of
+ * one COPY is staged in a scratch buffer to break it.
+ *
+ * The whole write order is planned before the image is touched. Thus, the
+ * image is left unmodified if the delta is invalid or the scratch buffer is
+ * too small.
+ *
+ * @param[in]  fd           Image opened for reading and writing
+ * @param[in]  delta        Complete delta
+ * @param[in]  delta_len    Length of the delta
+ * @param[in]  scratch_size Upper bound in bytes for staged data
+ * @param[out] stats        Statistics; may be NULL
+ * @param[out] error_msg    Error description if the return code is non-zero
+ * @return `0` on success, `<0` on error
+ */
+int inplace_apply (int fd, const uint8_t *delta, size_t delta_len, size_t scratch_size,
+                   struct inplace_stats *stats, const char **error_msg);
+
+#endif
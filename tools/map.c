@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "vcdiff/parse.h"
+#include "map.h"
+
+void map_add (struct map *map, uint8_t kind, size_t offset, size_t len, size_t arg, const uint8_t *data) {
+	if (len == 0) return;
+	map->pieces = emit_grow(map->pieces, &map->cap, map->cnt, sizeof(*map->pieces));
+	map->pieces[map->cnt++] = (struct map_piece) {
+		.kind = kind, .offset = offset, .len = len, .arg = arg, .data = data
+	};
+}
+
+size_t map_find (const struct map *map, size_t offset) {
+	size_t lo = 0, hi = map->cnt;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct map_piece *p = &map->pieces[mid];
+		if (offset < p->offset) hi = mid;
+		else if (offset >= p->offset + p->len) lo = mid + 1;
+		else return mid;
+	}
+	return map->cnt;
+}
+
+int map_build (struct map *map, const uint8_t *delta, size_t delta_len, const char **error_msg) {
+	static vcdiff_cache_t cache;
+	static vcdiff_codetable_t codetable;
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+	size_t target_offset = 0;
+	int rc;
+
+	vcdiff_parser_init(&parser, &cache, &codetable, delta, delta_len);
+	rc = vcdiff_parse_header(&parser);
+	while (rc == 0 && (rc = vcdiff_parse_window(&parser, &win)) > 0) {
+		while ((rc = vcdiff_parse_inst(&parser, &inst)) > 0) {
+			size_t offset = target_offset + inst.window_pos;
+			if (inst.inst == VCDIFF_INST_ADD) {
+				map_add(map, MAP_ADD, offset, inst.size, 0, inst.data);
+			} else if (inst.inst == VCDIFF_INST_RUN) {
+				map_add(map, MAP_RUN, offset, inst.size, inst.data[0], NULL);
+			} else if (inst.addr >= win.segment_len) {
+				map_add(map, MAP_COPY_SAME, offset, inst.size, target_offset + inst.addr - win.segment_len, NULL);
+			} else if (win.indicator & VCDIFF_VCD_SOURCE) {
+				map_add(map, MAP_COPY_PREV, offset, inst.size, win.segment_pos + inst.addr, NULL);
+			} else {
+				map_add(map, MAP_COPY_SAME, offset, inst.size, win.segment_pos + inst.addr, NULL);
+			}
+		}
+		map->windows = emit_grow(map->windows, &map->window_cap, map->window_cnt, sizeof(*map->windows));
+		map->windows[map->window_cnt++] = win.window_len;
+		target_offset += win.window_len;
+	}
+
+	if (rc < 0) {
+		*error_msg = parser.error_msg;
+	}
+
+	return rc;
+}
+
+int map_resolve (const struct map *map, size_t offset, size_t len, struct emit_window *out, map_emit_fn emit, void *ctx) {
+	/* [start, offset) of the version has been emitted at out_start */
+	size_t start = offset;
+	size_t out_start = out->pos;
+
+	while (len > 0) {
+		size_t i = map_find(map, offset);
+		if (i == map->cnt) {
+			fprintf(stderr, "Offset 0x%zx is not covered by the delta\n", offset);
+			return -EINVAL;
+		}
+
+		const struct map_piece *p = &map->pieces[i];
+		size_t k = offset - p->offset;
+		size_t n = p->len - k;
+		if (n > len) n = len;
+
+		int rc = emit ? emit(ctx, map, p, k, n) : MAP_RESOLVE;
+		if (rc == MAP_RESOLVE) {
+			rc = 0;
+			switch (p->kind) {
+				case MAP_ADD:
+					emit_inst(out, EMIT_ADD, n, 0, &p->data[k]);
+					break;
+				case MAP_RUN:
+					emit_inst(out, EMIT_RUN, n, p->arg, NULL);
+					break;
+				case MAP_COPY_PREV:
+					if (map->prev) rc = map_resolve(map->prev, p->arg + k, n, out, emit, ctx);
+					else emit_inst(out, EMIT_COPY_SOURCE, n, p->arg + k, NULL);
+					break;
+				case MAP_COPY_SAME: {
+					size_t period = p->offset - p->arg;
+					if (p->arg + k >= start && p->arg + k + n <= offset) {
+						/* copy of data emitted before: copy it within the output window, too */
+						emit_inst(out, EMIT_COPY_TARGET, n, out_start + (p->arg + k - start), NULL);
+						break;
+					}
+					if (p->len <= period) {
+						rc = map_resolve(map, p->arg + k, n, out, emit, ctx);
+						break;
+					}
+
+					/* overlapping copy: the data repeats every period bytes. Emit
+					 * one period and let the output window repeat it by itself. */
+					size_t phase = k % period;
+					size_t period_start = out->pos;
+					size_t first = period - phase;
+					if (first > n) first = n;
+					rc = map_resolve(map, p->arg + phase, first, out, emit, ctx);
+					if (rc == 0 && n > first) {
+						size_t second = (n - first < phase) ? n - first : phase;
+						rc = map_resolve(map, p->arg, second, out, emit, ctx);
+						if (rc == 0 && n > first + second) {
+							emit_inst(out, EMIT_COPY_TARGET, n - first - second, period_start, NULL);
+						}
+					}
+					break;
+				}
+			}
+		}
+		if (rc < 0) return rc;
+
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+void map_free (struct map *map) {
+	free(map->pieces);
+	free(map->windows);
+	map->pieces = NULL;
+	map->windows = NULL;
+	map->cnt = map->cap = 0;
+	map->window_cnt = map->window_cap = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "emit.h"
+
+/**
+ * @brief   Map describing how every range of a version is produced
+ *
+ * The map consists of the instructions of the delta producing the version,
+ * sorted by their offset in the version. Resolving a range of the version
+ * emits the instructions that produced it, following COPYs to the data they
+ * copy; nothing is ever reconstructed.
+ */
+
+enum {
+	MAP_ADD,       /**< Literal data inside the delta */
+	MAP_RUN,       /**< Repeated byte */
+	MAP_COPY_PREV, /**< Copy from the previous version */
+	MAP_COPY_SAME  /**< Copy from an earlier position of the same version */
+};
+
+struct map_piece {
+	uint8_t kind;
+	size_t offset;
+	size_t len;
+	size_t arg;             /**< RUN: byte; COPY: absolute offset in the previous or same version */
+	const uint8_t *data;    /**< ADD: data */
+};
+
+struct map {
+	struct map_piece *pieces;
+	size_t cnt;
+	size_t cap;
+	size_t *windows;        /**< Window lengths of the delta */
+	size_t window_cnt;
+	size_t window_cap;
+	const struct map *prev; /**< Map of the previous version or NULL for the base source */
+};
+
+/**
+ * @brief   Returned by a map_emit_fn to resolve the piece the default way
+ */
+#define MAP_RESOLVE 1
+
+/**
+ * @brief   Emits the bytes [k, k + n) of a piece
+ *
+ * @return `0` if the bytes were emitted, #MAP_RESOLVE to let map_resolve()
+ *         emit them, `<0` on error
+ */
+typedef int (*map_emit_fn) (void *ctx, const struct map *map, const struct map_piece *piece, size_t k, size_t n);
+
+/**
+ * @brief   Appends a piece; pieces must be appended in the order of their offsets
+ */
+void map_add (struct map *map, uint8_t kind, size_t offset, size_t len, size_t arg, const uint8_t *data);
+
+/**
+ * @brief   Finds the piece covering the given offset
+ *
+ * @return Index of the piece or the amount of pieces if none covers offset
+ */
+size_t map_find (const struct map *map, size_t offset);
+
+/**
+ * @brief   Adds the instructions of a delta to an empty map
+ *
+ * The map refers to the ADD data inside the delta.
+ *
+ * @param[out] map        Map to fill
+ * @param[in]  delta      Delta producing the version
+ * @param[in]  delta_len  Length of the delta
+ * @param[out] error_msg  Description of the error if parsing failed
+ * @return `0` on success, `<0` on error
+ */
+int map_build (struct map *map, const uint8_t *delta, size_t delta_len, const char **error_msg);
+
+/**
+ * @brief   Emits the instructions producing a range of the version
+ *
+ * By default ADDs and RUNs are emitted as they are, COPYs are resolved in the
+ * map of the version they copy from and COPYs from the base source are
+ * emitted as they are. COPYs within the version of data this call has emitted
+ * already become COPYs from the output window; overlapping ones are emitted
+ * as one period followed by a COPY from the output window.
+ *
+ * @param[in]  map     Map of the version
+ * @param[in]  offset  Start of the range in the version
+ * @param[in]  len     Length of the range
+ * @param[out] out     Window to emit the instructions to
+ * @param[in]  emit    Called for every piece first, or NULL for the default
+ * @param[in]  ctx     Context passed to emit
+ * @return `0` on success, `<0` if the range is not covered by the map or emit failed
+ */
+int map_resolve (const struct map *map, size_t offset, size_t len, struct emit_window *out, map_emit_fn emit, void *ctx);
+
+/**
+ * @brief   Releases the memory of a map
+ */
+void map_free (struct map *map);
+
+#endif
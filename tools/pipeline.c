@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "vcdiff.h"
+#include "pipeline.h"
+
+#define BLOCK_SIZE (64 * 1024)
+
+struct block {
+	uint8_t data[BLOCK_SIZE];
+	size_t len;               /**< `0` marks the end of the stream */
+};
+
+/* single-producer/single-consumer ring; head and tail only ever grow */
+struct ring {
+	struct block *blocks;
+	size_t depth;
+	atomic_size_t head;       /**< Blocks published by the producer */
+	atomic_size_t tail;       /**< Blocks released by the consumer */
+};
+
+struct pipeline {
+	vcdiff_t *ctx;
+	FILE *delta;
+	FILE *target;
+	struct ring in;
+	struct ring out;
+	atomic_bool abort;
+
+	struct block *out_block;  /**< Target block being filled by the decoder */
+	size_t target_offset;
+	int write_rc;
+	struct pipeline_stats stats;
+};
+
+static double _now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int _ring_init (struct ring *ring, size_t depth) {
+	ring->blocks = malloc(depth * sizeof(*ring->blocks));
+	if (ring->blocks == NULL) return -ENOMEM;
+	ring->depth = depth;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return 0;
+}
+
+/* returns NULL if the pipeline has been aborted while waiting */
+static struct block *_ring_produce (struct ring *ring, atomic_bool *abort, double *stall) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->depth) {
+		double start = _now();
+		while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->depth) {
+			if (atomic_load(abort)) return NULL;
+			sched_yield();
+		}
+		*stall += _now() - start;
+	}
+
+	return &ring->blocks[head % ring->depth];
+}
+
+static void _ring_publish (struct ring *ring) {
+	atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+}
+
+static struct block *_ring_consume (struct ring *ring, atomic_bool *abort, double *stall) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+		double start = _now();
+		while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+			if (atomic_load(abort)) return NULL;
+			sched_yield();
+		}
+		*stall += _now() - start;
+	}
+
+	return &ring->blocks[tail % ring->depth];
+}
+
+static void _ring_release (struct ring *ring) {
+	atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
+
+static void *_reader (void *arg) {
+	struct pipeline *p = (struct pipeline *) arg;
+	struct block *block;
+
+	do {
+		block = _ring_produce(&p->in, &p->abort, &p->stats.read_stall);
+		if (block == NULL) break;
+		block->len = fread(block->data, 1, sizeof(block->data), p->delta);
+		p->stats.delta_len += block->len;
+		_ring_publish(&p->in);
+	} while (block->len > 0);
+
+	return NULL;
+}
+
+static void *_writer (void *arg) {
+	struct pipeline *p = (struct pipeline *) arg;
+	struct block *block;
+
+	while ((block = _ring_consume(&p->out, &p->abort, &p->stats.write_stall)) != NULL && block->len > 0) {
+		if (fwrite(block->data, 1, block->len, p->target) != block->len) {
+			p->write_rc = -EIO;
+			atomic_store(&p->abort, true);
+			break;
+		}
+		p->stats.target_len += block->len;
+		_ring_release(&p->out);
+	}
+
+	return NULL;
+}
+
+static int _target_write (void *dev, uint8_t *data, vcdiff_off_t offset, size_t len) {
+	struct pipeline *p = (struct pipeline *) dev;
+
+	if (p->target_offset != offset) {
+		/* Gapped write not supported! */
+		return -ENOTSUP;
+	}
+
+	while (len > 0) {
+		if (p->out_block == NULL) {
+			p->out_block = _ring_produce(&p->out, &p->abort, &p->stats.decode_out_stall);
+			if (p->out_block == NULL) return -EIO;
+			p->out_block->len = 0;
+		}
+
+		size_t n = sizeof(p->out_block->data) - p->out_block->len;
+		if (n > len) n = len;
+		memcpy(p->out_block->data + p->out_block->len, data, n);
+		p->out_block->len += n;
+		p->target_offset += n;
+		data += n;
+		len -= n;
+
+		if (p->out_block->len == sizeof(p->out_block->data)) {
+			_ring_publish(&p->out);
+			p->out_block = NULL;
+		}
+	}
+
+	return 0;
+}
+
+static int _target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) dest;
+	(void) offset;
+	(void) len;
+
+	/* data written into the pipe is gone! */
+	return -ENOTSUP;
+}
+
+static const vcdiff_driver_t target_driver = {
+	.read = _target_read,
+	.write = _target_write
+};
+
+/* hands the pending block and the end of stream marker to the writer */
+static int _finish_output (struct pipeline *p) {
+	if (p->out_block && p->out_block->len > 0) {
+		_ring_publish(&p->out);
+		p->out_block = NULL;
+	}
+
+	if (p->out_block == NULL) {
+		p->out_block = _ring_produce(&p->out, &p->abort, &p->stats.decode_out_stall);
+		if (p->out_block == NULL) return -EIO;
+	}
+	p->out_block->len = 0;
+	_ring_publish(&p->out);
+	p->out_block = NULL;
+
+	return 0;
+}
+
+int pipeline_apply (vcdiff_t *ctx, FILE *delta, FILE *target, size_t depth, struct pipeline_stats *stats) {
+	static struct pipeline p;
+	pthread_t reader, writer;
+	struct block *block;
+	int rc = 0;
+
+	memset(&p, 0, sizeof(p));
+	p.ctx = ctx;
+	p.delta = delta;
+	p.target = target;
+	atomic_init(&p.abort, false);
+	if (depth < 1) depth = 1;
+	if (_ring_init(&p.in, depth) < 0 || _ring_init(&p.out, depth) < 0) {
+		free(p.in.blocks);
+		return -ENOMEM;
+	}
+
+	vcdiff_set_target_driver(ctx, &target_driver, &p);
+
+	if (pthread_create(&reader, NULL, _reader, &p) != 0) {
+		rc = -EAGAIN;
+		goto exit;
+	}
+	if (pthread_create(&writer, NULL, _writer, &p) != 0) {
+		atomic_store(&p.abort, true);
+		pthread_join(reader, NULL);
+		rc = -EAGAIN;
+		goto exit;
+	}
+
+	while ((block = _ring_consume(&p.in, &p.abort, &p.stats.decode_in_stall)) != NULL && block->len > 0) {
+		rc = vcdiff_apply_delta(ctx, block->data, block->len);
+		_ring_release(&p.in);
+		if (rc < 0) break;
+	}
+
+	if (rc == 0 && block != NULL) rc = vcdiff_finish(ctx);
+	if (rc == 0) rc = _finish_output(&p);
+	if (rc < 0) atomic_store(&p.abort, true);
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	if (rc == 0) rc = p.write_rc;
+
+	if (stats) *stats = p.stats;
+
+exit:
+	free(p.in.blocks);
+	free(p.out.blocks);
+
+	return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "vcdiff.h"
+
+/**
+ * @brief   Time each stage of the pipeline spent waiting
+ */
+struct pipeline_stats {
+	double read_stall;       /**< Reader waiting for a free delta block */
+	double decode_in_stall;  /**< Decoder waiting for delta data */
+	double decode_out_stall; /**< Decoder waiting for a free target block */
+	double write_stall;      /**< Writer waiting for target data */
+	size_t delta_len;        /**< Amount of delta bytes read */
+	size_t target_len;       /**< Amount of target bytes written */
+};
+
+/**
+ * @brief   Applies a delta using a reader, a decoder and a writer thread
+ *
+ * The reader fills blocks of delta data, the decoder runs vcdiff_apply_delta()
+ * and the writer writes target blocks. The stages are connected by
+ * single-producer/single-consumer rings of `depth` blocks each, so reading
+ * the delta, source IO and writing the target overlap.
+ *
+ * The context must be initialised with the source driver connected. The
+ * target driver is set by the pipeline; the target is written sequentially.
+ *
+ * @param      ctx       Decoder context
+ * @param[in]  delta     Delta stream
+ * @param[in]  target    Target stream
+ * @param[in]  depth     Amount of blocks per ring
+ * @param[out] stats     Stall times and amounts; may be NULL
+ * @return `0` on success, `<0` on error
+ */
+int pipeline_apply (vcdiff_t *ctx, FILE *delta, FILE *target, size_t depth, struct pipeline_stats *stats);
+
+#endif
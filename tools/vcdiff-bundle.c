@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include "vcdiff/validate.h"
+#include "batch.h"
+#include "bundle.h"
+#include "emit.h"
+
+/*
+ * Packs the deltas of many files into a bundle for vcdiff-decode -B.
+ *
+ * Every delta is validated; the manifest records the length of the target
+ * it produces, so incomplete targets never replace a file.
+ */
+
+static void usage (void) {
+	fprintf(stderr, "Usage: vcdiff-bundle path:delta_path[:mode]...\n");
+	fprintf(stderr, "Packs the delta for every relative path into a bundle. mode is given in octal (default: 644).\n");
+	fprintf(stderr, "STDOUT: bundle file. STDERR: logging.\n");
+}
+
+int main (int argc, char *argv[]) {
+	static vcdiff_validate_t val;
+	size_t cnt = argc - 1;
+	struct batch_map *deltas;
+	struct bundle_file *files;
+	struct emit_buf manifest = {0};
+	const char *error_msg;
+	size_t total = 0;
+	int rc = 1;
+
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+
+	deltas = calloc(cnt, sizeof(*deltas));
+	files = calloc(cnt, sizeof(*files));
+	if (deltas == NULL || files == NULL) {
+		perror("Out of memory");
+		free(deltas);
+		free(files);
+		return 1;
+	}
+
+	for (size_t i = 0; i < cnt; i++) {
+		char *path = argv[i + 1];
+		char *delta_path = strchr(path, ':');
+		unsigned mode = 0644;
+		if (delta_path == NULL || delta_path == path) {
+			fprintf(stderr, "Invalid file %s: expected relative_path:delta_path[:mode]\n", path);
+			goto exit;
+		}
+		*delta_path++ = '\0';
+		char *mode_str = strchr(delta_path, ':');
+		if (mode_str) {
+			*mode_str++ = '\0';
+			mode = strtoul(mode_str, NULL, 8) & 07777;
+		}
+
+		int map_rc = batch_map_file(&deltas[i], delta_path);
+		if (map_rc < 0) {
+			fprintf(stderr, "Cannot open %s: %s\n", delta_path, strerror(-map_rc));
+			goto exit;
+		}
+		if (vcdiff_validate(&val, deltas[i].data, deltas[i].len, VCDIFF_OFF_MAX) < 0) {
+			fprintf(stderr, "Invalid delta %s at offset %zu: %s\n", delta_path, val.error_offset, val.error_msg);
+			goto exit;
+		}
+
+		files[i] = (struct bundle_file) {
+			.path = path,
+			.mode = mode,
+			.target_len = val.target_len,
+			.delta = deltas[i].data,
+			.delta_len = deltas[i].len,
+		};
+		total += val.target_len;
+	}
+
+	/* never write a bundle vcdiff-decode -B rejects */
+	if (bundle_check_paths(files, cnt, &error_msg) < 0) {
+		fprintf(stderr, "Cannot pack bundle: %s\n", error_msg);
+		goto exit;
+	}
+
+	emit_buf_append(&manifest, (const uint8_t *) BUNDLE_MAGIC, BUNDLE_MAGIC_LEN);
+	emit_buf_append_int(&manifest, cnt);
+	for (size_t i = 0; i < cnt; i++) {
+		emit_buf_append_int(&manifest, strlen(files[i].path));
+		emit_buf_append(&manifest, (const uint8_t *) files[i].path, strlen(files[i].path));
+		emit_buf_append_int(&manifest, files[i].mode);
+		emit_buf_append_int(&manifest, files[i].target_len);
+		emit_buf_append_int(&manifest, files[i].delta_len);
+	}
+
+	if (fwrite(manifest.data, 1, manifest.len, stdout) != manifest.len) goto write_error;
+	for (size_t i = 0; i < cnt; i++) {
+		if (fwrite(files[i].delta, 1, files[i].delta_len, stdout) != files[i].delta_len) goto write_error;
+	}
+	if (fclose(stdout) != 0) goto write_error;
+	fprintf(stderr, "FILES=%zu MANIFEST=%zuB TARGETS=%zukB\n", cnt, manifest.len, total / 1024);
+	rc = 0;
+	goto exit;
+
+write_error:
+	perror("Cannot write bundle");
+
+exit:
+	for (size_t i = 0; i < cnt; i++) {
+		batch_unmap_file(&deltas[i]);
+	}
+	free(deltas);
+	free(files);
+	free(manifest.data);
+
+	return rc;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -6,29 +7,41 @@
 #include <string.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "vcdiff.h"
 #include "vcdiff/state.h"
+#include "batch.h"
+#include "bundle.h"
+#include "chain.h"
+#include "inplace.h"
+#include "pipeline.h"
+#include "direct.h"
 
 struct target_stream {
 	FILE *file;
-	size_t offset;
+	vcdiff_off_t offset;
 
 	size_t log_interval;
-	size_t log_last_offset;
+	vcdiff_off_t log_last_offset;
 	size_t log_delta_written;
 };
 
 static void log_stats (struct target_stream *target, bool force) {
 	if (target->log_interval && (force || target->log_last_offset + target->log_interval < target->offset)) {
 		target->log_last_offset = target->offset;
-		fprintf(stderr, "STATS IN=%lukB OUT=%lukB RATIO=1:%lu\n",
+		fprintf(stderr, "STATS IN=%lukB OUT=%" VCDIFF_PRIoff "kB RATIO=1:%" VCDIFF_PRIoff "\n",
 			target->log_delta_written / 1024,
 			target->offset / 1024,
 			(target->offset / target->log_delta_written) + 1);
 	}
 }
 
-static int _target_write (void *dev, uint8_t *data, size_t offset, size_t len) {
+static int _target_write (void *dev, uint8_t *data, vcdiff_off_t offset, size_t len) {
 	struct target_stream *target = (struct target_stream *) dev;
 
 	if (target->offset != offset) {
@@ -48,7 +61,7 @@ static int _target_write (void *dev, uint8_t *data, size_t offset, size_t len) {
 	return 0;
 }
 
-static int _target_read (void *dev, uint8_t *dest, size_t offset, size_t len) {
+static int _target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
 	(void) dev;
 	(void) dest;
 	(void) offset;
@@ -63,10 +76,10 @@ static const vcdiff_driver_t target_driver = {
 	.write = _target_write
 };
 
-static int _source_read (void *dev, uint8_t *dest, size_t offset, size_t len) {
+static int _source_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
 	FILE *source = (FILE *) dev;
 
-	int rc = fseek(source, offset, SEEK_SET);
+	int rc = fseeko(source, offset, SEEK_SET);
 	if (rc < 0) {
 		perror("Cannot seek source");
 		return -ESPIPE;
@@ -84,30 +97,140 @@ static const vcdiff_driver_t source_driver = {
 	.read = _source_read
 };
 
-static int apply_delta(FILE *delta, FILE *source, FILE *target_file, size_t log_interval, vcdiff_log_t inst_log) {
+/* chunks are large so instructions rarely straddle their boundaries */
+#define DELTA_MAP_CHUNK (64 * 1024 * 1024)
+#define DELTA_READ_CHUNK (1024 * 1024)
+
+/* passes a regular file mapped in few large chunks or a pipe in large reads */
+static int feed_delta(vcdiff_t *ctx, FILE *delta, size_t *delta_fed) {
+	struct stat st;
+	int fd = fileno(delta);
+	int rc = 0;
+
+	/* deltas beyond the address space are read instead */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (off_t) (size_t) st.st_size == st.st_size && ftello(delta) == 0) {
+		size_t len = st.st_size;
+		uint8_t *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+			madvise(map, len, MADV_HUGEPAGE);
+#endif
+			for (size_t pos = 0; pos < len && rc == 0; pos += DELTA_MAP_CHUNK) {
+				size_t chunk = (len - pos < DELTA_MAP_CHUNK) ? len - pos : DELTA_MAP_CHUNK;
+				*delta_fed += chunk;
+				rc = vcdiff_apply_delta(ctx, map + pos, chunk);
+			}
+			munmap(map, len);
+			return rc;
+		}
+	}
+
+	uint8_t *buf = malloc(DELTA_READ_CHUNK);
+	if (buf == NULL) {
+		perror("Cannot allocate delta buffer");
+		return -ENOMEM;
+	}
+
+	size_t len;
+	while (rc == 0 && (len = fread(buf, 1, DELTA_READ_CHUNK, delta)) > 0) {
+		*delta_fed += len;
+		rc = vcdiff_apply_delta(ctx, buf, len);
+	}
+
+	free(buf);
+	return rc;
+}
+
+struct hash_opt {
+	vcdiff_hash_type_t type;
+	const char *name;
+	uint8_t expected[VCDIFF_HASH_MAX_LEN];
+	bool check;
+};
+
+static int parse_hash_opt (struct hash_opt *hash, const char *arg) {
+	static const struct {
+		const char *name;
+		vcdiff_hash_type_t type;
+	} algs[] = {
+		{"sha256", VCDIFF_HASH_SHA256},
+		{"crc32", VCDIFF_HASH_CRC32}
+	};
+	const char *sep = strchr(arg, ':');
+	size_t name_len = sep ? (size_t) (sep - arg) : strlen(arg);
+
+	hash->type = VCDIFF_HASH_NONE;
+	for (size_t i = 0; i < sizeof(algs) / sizeof(algs[0]); i++) {
+		if (strlen(algs[i].name) == name_len && !strncmp(arg, algs[i].name, name_len)) {
+			hash->type = algs[i].type;
+			hash->name = algs[i].name;
+		}
+	}
+	if (hash->type == VCDIFF_HASH_NONE) return -1;
+
+	/* optional hex digest to compare against */
+	hash->check = (sep != NULL);
+	if (!sep) return 0;
+	size_t len = vcdiff_hash_len(hash->type);
+	if (strlen(sep + 1) != 2 * len) return -1;
+	for (size_t i = 0; i < len; i++) {
+		unsigned int byte;
+		if (sscanf(sep + 1 + 2 * i, "%2x", &byte) != 1) return -1;
+		hash->expected[i] = byte;
+	}
+
+	return 0;
+}
+
+static void print_hash (vcdiff_t *ctx, const struct hash_opt *hash) {
+	fprintf(stderr, "HASH %s=", hash->name);
+	for (size_t i = 0; i < vcdiff_hash_len(hash->type); i++) fprintf(stderr, "%02x", ctx->digest[i]);
+	fprintf(stderr, "\n");
+}
+
+static int apply_pipelined(vcdiff_t *ctx, FILE *delta, FILE *target_file, size_t depth, bool print_stats) {
+	struct pipeline_stats stats;
+
+	int rc = pipeline_apply(ctx, delta, target_file, depth, &stats);
+	if (print_stats) {
+		fprintf(stderr, "PIPELINE DEPTH=%zu IN=%zukB OUT=%zukB READ_STALL=%.3fms DECODE_STALL_IN=%.3fms DECODE_STALL_OUT=%.3fms WRITE_STALL=%.3fms\n",
+			depth, stats.delta_len / 1024, stats.target_len / 1024,
+			stats.read_stall * 1000, stats.decode_in_stall * 1000,
+			stats.decode_out_stall * 1000, stats.write_stall * 1000);
+	}
+
+	return rc;
+}
+
+static int apply_delta(FILE *delta, const vcdiff_driver_t *source_driver, void *source_dev, FILE *target_file, size_t log_interval, vcdiff_log_t inst_log, const struct hash_opt *hash, size_t depth) {
 	int rc = 0;
 	static vcdiff_t ctx;
 	struct target_stream target = {.file = target_file, .log_interval = log_interval};
-	uint8_t delta_buf[16 * 1024];
-	size_t delta_len;
 
 	vcdiff_init(&ctx);
 	vcdiff_set_logger(&ctx, inst_log, NULL);
-	vcdiff_set_source_driver(&ctx, &source_driver, (void *) source);
+	vcdiff_set_source_driver(&ctx, source_driver, source_dev);
 	vcdiff_set_target_driver(&ctx, &target_driver, (void *) &target);
+	if (hash) vcdiff_set_hash(&ctx, hash->type, hash->check ? hash->expected : NULL);
 
-	while ((delta_len = fread(delta_buf, sizeof(delta_buf[0]), sizeof(delta_buf), delta))) {
-		target.log_delta_written += delta_len;
-		rc = vcdiff_apply_delta(&ctx, delta_buf, delta_len);
-		if (rc < 0) {
-			goto exit;
-		}
+	if (depth > 0) {
+		rc = apply_pipelined(&ctx, delta, target_file, depth, log_interval > 0);
+		goto print_hash;
+	}
+
+	rc = feed_delta(&ctx, delta, &target.log_delta_written);
+	if (rc < 0) {
+		goto exit;
 	}
 
 	log_stats(&target, true);
 
 	rc = vcdiff_finish(&ctx);
 
+print_hash:
+	if (rc == 0 && hash) print_hash(&ctx, hash);
+
 exit:
 	if (rc < 0) {
 		fprintf(stderr, "Error while applying delta: %s\n", vcdiff_error_str(&ctx));
@@ -116,11 +239,380 @@ exit:
 	return rc;
 }
 
+/* the decoder buffer is aligned, so aligned writes bypass the staging buffer */
+#define DIRECT_BUFFER_SIZE (4 * 1024 * 1024)
+
+static int apply_file(FILE *delta, const vcdiff_driver_t *source_driver, void *source_dev, const char *target_path, bool direct, bool print_stats, const struct hash_opt *hash) {
+	static vcdiff_t ctx;
+	struct direct_target target;
+	size_t delta_len = 0;
+	bool huge;
+	int rc;
+
+	uint8_t *buffer = direct_alloc(DIRECT_BUFFER_SIZE, &huge);
+	if (buffer == NULL) {
+		perror("Cannot allocate decoder buffer");
+		return 1;
+	}
+
+	rc = direct_open(&target, target_path, direct, DIRECT_BUFFER_SIZE);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot open target_path: %s\n", strerror(-rc));
+		direct_free(buffer, DIRECT_BUFFER_SIZE, huge);
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	vcdiff_init(&ctx);
+	vcdiff_set_buffer(&ctx, buffer, DIRECT_BUFFER_SIZE);
+	vcdiff_set_source_driver(&ctx, source_driver, source_dev);
+	vcdiff_set_target_driver(&ctx, &direct_driver, (void *) &target);
+	if (hash) vcdiff_set_hash(&ctx, hash->type, hash->check ? hash->expected : NULL);
+
+	rc = feed_delta(&ctx, delta, &delta_len);
+	if (rc == 0) rc = vcdiff_finish(&ctx);
+	if (rc < 0) {
+		fprintf(stderr, "Error while applying delta: %s\n", vcdiff_error_str(&ctx));
+	}
+
+	int close_rc = direct_close(&target);
+	if (close_rc < 0) {
+		fprintf(stderr, "Cannot write target_path: %s\n", strerror(-close_rc));
+		if (rc == 0) rc = close_rc;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (rc == 0 && hash) print_hash(&ctx, hash);
+	if (rc == 0 && print_stats) {
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "FILE DIRECT=%d ALIGN=%zu HUGEPAGES=%d OUT=%" VCDIFF_PRIoff "kB WRITES=%zu RMW=%zu BYPASS=%zukB TIME=%.3fs THROUGHPUT=%.1fMB/s\n",
+			direct, target.align, huge && target.hugepages, target.len / 1024, target.writes, target.rmw_reads,
+			target.direct_bytes / 1024, seconds, (seconds > 0) ? target.len / seconds / (1024 * 1024) : 0.0);
+	}
+
+	direct_free(buffer, DIRECT_BUFFER_SIZE, huge);
+
+	return (rc < 0) ? 1 : 0;
+}
+
+static int _verify_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) src;
+	(void) offset;
+	(void) len;
+
+	/* the target must stay untouched */
+	return -ENOTSUP;
+}
+
+static int _verify_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	FILE *target = (FILE *) dev;
+
+	if (fseeko(target, offset, SEEK_SET) < 0) {
+		perror("Cannot seek target");
+		return -ESPIPE;
+	}
+
+	/* beyond the end of a short target: compared, but reported at its end */
+	size_t bytes_read = fread(dest, sizeof(uint8_t), len, target);
+	if (bytes_read != len && ferror(target)) {
+		return -EIO;
+	}
+	memset(dest + bytes_read, 0, len - bytes_read);
+
+	return 0;
+}
+
+static const vcdiff_driver_t verify_driver = {
+	.read = _verify_read,
+	.write = _verify_write
+};
+
+static int verify_delta(FILE *delta, const vcdiff_driver_t *source_driver, void *source_dev, const char *target_path, const struct hash_opt *hash) {
+	int rc = 0;
+	static vcdiff_t ctx;
+	size_t delta_len = 0;
+	struct stat st;
+
+	FILE *target = fopen(target_path, "r");
+	if (target == NULL) {
+		perror("Cannot open target_path");
+		return 1;
+	}
+	if (fstat(fileno(target), &st) < 0) {
+		perror("Cannot stat target_path");
+		fclose(target);
+		return 1;
+	}
+	vcdiff_off_t target_len = st.st_size;
+
+	vcdiff_init(&ctx);
+	vcdiff_set_flags(&ctx, VCDIFF_FLAG_VERIFY);
+	if (hash) vcdiff_set_hash(&ctx, hash->type, hash->check ? hash->expected : NULL);
+	vcdiff_set_source_driver(&ctx, source_driver, source_dev);
+	vcdiff_set_target_driver(&ctx, &verify_driver, (void *) target);
+
+	rc = feed_delta(&ctx, delta, &delta_len);
+	if (rc == 0) rc = vcdiff_finish(&ctx);
+
+	if (rc < 0 && ctx.mismatch_offset != VCDIFF_OFF_MAX) {
+		fprintf(stderr, "MISMATCH OFFSET=%" VCDIFF_PRIoff "\n", (ctx.mismatch_offset < target_len) ? ctx.mismatch_offset : target_len);
+	} else if (rc < 0) {
+		fprintf(stderr, "Error while verifying delta: %s\n", vcdiff_error_str(&ctx));
+	} else if (target_len != ctx.target_offset) {
+		/* the target holds more or less than the delta produces */
+		fprintf(stderr, "MISMATCH OFFSET=%" VCDIFF_PRIoff "\n", (ctx.target_offset < target_len) ? ctx.target_offset : target_len);
+		rc = -1;
+	} else {
+		fprintf(stderr, "MATCH LEN=%" VCDIFF_PRIoff "\n", ctx.target_offset);
+		if (hash) print_hash(&ctx, hash);
+	}
+
+	fclose(target);
+
+	return (rc < 0) ? 1 : 0;
+}
+
+static int apply_jobs(const struct batch_map *source, struct batch_job *jobs, size_t job_cnt, unsigned workers) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rc = batch_apply(source, jobs, job_cnt, workers);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	size_t failed = 0;
+	size_t total_in = 0;
+	size_t total_out = 0;
+	for (size_t i = 0; i < job_cnt; i++) {
+		struct batch_job *job = &jobs[i];
+		if (job->rc < 0) {
+			failed++;
+			fprintf(stderr, "FAIL %s -> %s: %s (%d)\n", job->delta_path, job->target_path, job->error_msg, job->rc);
+		} else {
+			fprintf(stderr, "OK   %s -> %s IN=%zuB OUT=%zuB TIME=%.3fms\n", job->delta_path, job->target_path,
+				job->delta_len, job->target_len, job->seconds * 1000);
+		}
+		total_in += job->delta_len;
+		total_out += job->target_len;
+	}
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "TOTAL JOBS=%zu FAILED=%zu WORKERS=%u IN=%zukB OUT=%zukB TIME=%.3fs THROUGHPUT=%.1fMB/s\n",
+		job_cnt, failed, workers, total_in / 1024, total_out / 1024, seconds,
+		(seconds > 0) ? total_out / seconds / (1024 * 1024) : 0.0);
+
+	return rc;
+}
+
+static int apply_batch(const char *source_path, char **specs, size_t spec_cnt, unsigned workers) {
+	int rc;
+	struct batch_map source;
+	struct batch_job *jobs;
+
+	jobs = calloc(spec_cnt, sizeof(*jobs));
+	if (jobs == NULL) {
+		perror("Cannot allocate jobs");
+		return 1;
+	}
+
+	for (size_t i = 0; i < spec_cnt; i++) {
+		char *sep = strchr(specs[i], ':');
+		if (sep == NULL) {
+			fprintf(stderr, "Invalid job %s: expected delta_path:target_path\n", specs[i]);
+			free(jobs);
+			return 1;
+		}
+		*sep = '\0';
+		jobs[i].delta_path = specs[i];
+		jobs[i].target_path = sep + 1;
+	}
+
+	rc = batch_map_file(&source, source_path);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot map source_path: %s\n", strerror(-rc));
+		free(jobs);
+		return 1;
+	}
+
+	rc = apply_jobs(&source, jobs, spec_cnt, workers);
+
+	batch_unmap_file(&source);
+	free(jobs);
+
+	return (rc < 0) ? 1 : 0;
+}
+
+static int mkdir_parents (const char *path) {
+	char dir[PATH_MAX];
+
+	if (snprintf(dir, sizeof(dir), "%s", path) >= (int) sizeof(dir)) return -ENAMETOOLONG;
+	for (char *sep = strchr(dir + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+		*sep = '\0';
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -errno;
+		*sep = '/';
+	}
+
+	return 0;
+}
+
+static int cmp_jobs_by_len (const void *a, const void *b) {
+	const struct batch_job *job_a = (const struct batch_job *) a;
+	const struct batch_job *job_b = (const struct batch_job *) b;
+	return (job_a->expected_len < job_b->expected_len) - (job_a->expected_len > job_b->expected_len);
+}
+
+static int apply_bundle(const char *bundle_path, const char *source_dir, const char *target_dir, unsigned workers, size_t memory) {
+	struct bundle bundle;
+	const char *error_msg;
+	int rc;
+
+	rc = bundle_open(&bundle, bundle_path, &error_msg);
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s\n", error_msg, strerror(-rc));
+		return 1;
+	}
+
+	struct batch_job *jobs = calloc(bundle.file_cnt ? bundle.file_cnt : 1, sizeof(*jobs));
+	char **paths = calloc(2 * bundle.file_cnt + 1, sizeof(*paths));
+	if (jobs == NULL || paths == NULL) {
+		perror("Cannot allocate jobs");
+		rc = -ENOMEM;
+		goto exit;
+	}
+
+	for (size_t i = 0; i < bundle.file_cnt; i++) {
+		const struct bundle_file *file = &bundle.files[i];
+		if (asprintf(&paths[2 * i], "%s/%s", source_dir, file->path) < 0 ||
+		    asprintf(&paths[2 * i + 1], "%s/%s", target_dir, file->path) < 0) {
+			perror("Cannot allocate paths");
+			rc = -ENOMEM;
+			goto exit;
+		}
+		rc = mkdir_parents(paths[2 * i + 1]);
+		if (rc < 0) {
+			fprintf(stderr, "Cannot create directory for %s: %s\n", paths[2 * i + 1], strerror(-rc));
+			goto exit;
+		}
+		jobs[i] = (struct batch_job) {
+			.delta_path = file->path,
+			.source_path = paths[2 * i],
+			.target_path = paths[2 * i + 1],
+			.delta = file->delta,
+			.delta_size = file->delta_len,
+			.mode = file->mode,
+			.atomic = true,
+			.expected_len = file->target_len,
+		};
+	}
+
+	/* large files first, so no worker is left with one at the end */
+	qsort(jobs, bundle.file_cnt, sizeof(*jobs), cmp_jobs_by_len);
+
+	/* every worker holds one decoder context plus the mapped source and the
+	 * target of its file; bound by the largest file */
+	size_t largest = 0;
+	for (size_t i = 0; i < bundle.file_cnt; i++) {
+		struct stat st;
+		size_t len = jobs[i].expected_len;
+		if (stat(jobs[i].source_path, &st) == 0) len += st.st_size;
+		if (len > largest) largest = len;
+	}
+	size_t max_workers = memory / (sizeof(vcdiff_t) + largest);
+	if (max_workers < 1) max_workers = 1;
+	if (workers > max_workers) workers = max_workers;
+
+	rc = apply_jobs(NULL, jobs, bundle.file_cnt, workers);
+
+exit:
+	if (paths) {
+		for (size_t i = 0; i < 2 * bundle.file_cnt; i++) free(paths[i]);
+	}
+	free(paths);
+	free(jobs);
+	bundle_close(&bundle);
+
+	return (rc < 0) ? 1 : 0;
+}
+
+static int apply_inplace(const char *image_path, FILE *delta_file, size_t scratch_size, bool print_stats) {
+	uint8_t *delta = NULL;
+	size_t delta_len = 0;
+	size_t delta_cap = 0;
+	size_t n;
+
+	/* the write order is planned from the whole delta */
+	do {
+		if (delta_len == delta_cap) {
+			delta_cap = delta_cap ? delta_cap * 2 : 64 * 1024;
+			uint8_t *buf = realloc(delta, delta_cap);
+			if (buf == NULL) {
+				perror("Cannot allocate delta buffer");
+				free(delta);
+				return 1;
+			}
+			delta = buf;
+		}
+		n = fread(delta + delta_len, 1, delta_cap - delta_len, delta_file);
+		delta_len += n;
+	} while (n > 0);
+
+	int fd = open(image_path, O_RDWR);
+	if (fd < 0) {
+		perror("Cannot open image_path");
+		free(delta);
+		return 1;
+	}
+
+	struct inplace_stats stats;
+	const char *error_msg = NULL;
+	int rc = inplace_apply(fd, delta, delta_len, scratch_size, &stats, &error_msg);
+	if (rc < 0) {
+		fprintf(stderr, "Error while applying delta in place: %s\n", error_msg);
+	} else if (print_stats) {
+		fprintf(stderr, "INPLACE CMDS=%zu EDGES=%zu STAGED=%zu SCRATCH=%zuB\n",
+			stats.cmds, stats.edges, stats.staged, stats.staged_bytes);
+	}
+
+	close(fd);
+	free(delta);
+
+	return (rc < 0) ? 1 : 0;
+}
+
 static void usage (void) {
-	fprintf(stderr, "Usage: vcdiff-decode [-i] [-s <interval>] source_path\n");
+	fprintf(stderr, "Usage: vcdiff-decode [-i] [-s <interval>] [-r <depth>] [-d <delta_path>] source_path\n");
+	fprintf(stderr, "       vcdiff-decode [-s <interval>] [-d <delta_path>] -o <path> [-D] source_path\n");
+	fprintf(stderr, "       vcdiff-decode -b [-j <workers>] source_path delta_path:target_path...\n");
+	fprintf(stderr, "       vcdiff-decode -B <bundle_path> [-j <workers>] [-M <size>] source_dir target_dir\n");
+	fprintf(stderr, "       vcdiff-decode -p [-S <size>] image_path\n");
+	fprintf(stderr, "       vcdiff-decode --verify [-c <delta_path>...] [-H <alg>[:<digest>]] source_path target_path\n");
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "  -i              Enable instruction log\n");
 	fprintf(stderr, "  -s <interval>   Print stats every <interval> Bytes written to the target\n");
+	fprintf(stderr, "  -d <delta_path> Read the delta from the given file instead of STDIN. Regular files\n");
+	fprintf(stderr, "                  are memory-mapped, on STDIN as well.\n");
+	fprintf(stderr, "  -o <path>       Write the target to the given file instead of STDOUT\n");
+	fprintf(stderr, "  -D              Write target_path with O_DIRECT, bypassing the page cache\n");
+	fprintf(stderr, "  -r <depth>      Read, decode and write in separate threads connected by rings of\n");
+	fprintf(stderr, "                  <depth> 64 KiB blocks. Stall times are printed with -s.\n");
+	fprintf(stderr, "  -b              Batch mode: apply all given deltas against the same source\n");
+	fprintf(stderr, "  -j <workers>    Amount of worker threads in batch and bundle mode (default: CPU count)\n");
+	fprintf(stderr, "  -B <path>       Bundle mode: apply the delta of every file in the bundle to the file with\n");
+	fprintf(stderr, "                  the same path in source_dir and atomically replace it in target_dir\n");
+	fprintf(stderr, "  -M <size>       Memory in MiB for the decoder contexts, sources and targets in bundle mode;\n");
+	fprintf(stderr, "                  limits the workers (default: 64)\n");
+	fprintf(stderr, "  -c <delta_path> Apply the given delta to the source before the delta from STDIN.\n");
+	fprintf(stderr, "                  May be repeated to form a chain; intermediate versions are not written.\n");
+	fprintf(stderr, "  -m <size>       Cache size in MiB for intermediate windows in chain mode (default: 64)\n");
+	fprintf(stderr, "                  Must hold one window of every chained delta at once.\n");
+	fprintf(stderr, "  -p              In-place mode: patch image_path, which is both source and target\n");
+	fprintf(stderr, "  -S <size>       Scratch size in KiB for breaking cycles in in-place mode (default: 1024)\n");
+	fprintf(stderr, "  -H, --hash <alg>[:<digest>]\n");
+	fprintf(stderr, "                  Hash the target while writing it (sha256 or crc32) and print the digest.\n");
+	fprintf(stderr, "                  Fails if it doesn't match the given hex digest.\n");
+	fprintf(stderr, "  -v, --verify    Check whether target_path already holds what the delta produces. Nothing is written.\n");
 	fprintf(stderr, "STDIN: delta file. STDOUT: target file. STDERR: logging.\n");
 }
 
@@ -136,8 +628,29 @@ int main(int argc, char* argv[]) {
 	int opt;
 	size_t log_interval = 0;
 	vcdiff_log_t inst_log = NULL;
-
-	while ((opt = getopt(argc, argv, "is:")) != -1) {
+	bool batch = false;
+	const char *bundle_path = NULL;
+	size_t bundle_memory = 64 * 1024 * 1024;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *chain_paths[argc];
+	size_t chain_cnt = 0;
+	size_t chain_cache_size = 64 * 1024 * 1024;
+	bool inplace = false;
+	size_t scratch_size = 1024 * 1024;
+	bool verify = false;
+	struct hash_opt hash;
+	bool hashing = false;
+	size_t depth = 0;
+	const char *delta_path = NULL;
+	const char *target_path = NULL;
+	bool direct = false;
+	static const struct option long_opts[] = {
+		{"verify", no_argument, NULL, 'v'},
+		{"hash", required_argument, NULL, 'H'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "is:bj:B:M:c:m:pS:vH:r:d:o:D", long_opts, NULL)) != -1) {
 		switch (opt) {
 			case 'i':
 				inst_log = stderr_logger;
@@ -145,6 +658,52 @@ int main(int argc, char* argv[]) {
 			case 's':
 				log_interval = atoi(optarg) * 1024;
 				break;
+			case 'b':
+				batch = true;
+				break;
+			case 'j':
+				workers = atoi(optarg);
+				break;
+			case 'B':
+				bundle_path = optarg;
+				break;
+			case 'M':
+				bundle_memory = (size_t) atoi(optarg) * 1024 * 1024;
+				break;
+			case 'c':
+				chain_paths[chain_cnt++] = optarg;
+				break;
+			case 'm':
+				chain_cache_size = (size_t) atoi(optarg) * 1024 * 1024;
+				break;
+			case 'p':
+				inplace = true;
+				break;
+			case 'S':
+				scratch_size = (size_t) atoi(optarg) * 1024;
+				break;
+			case 'v':
+				verify = true;
+				break;
+			case 'H':
+				if (parse_hash_opt(&hash, optarg) < 0) {
+					fprintf(stderr, "Invalid hash: %s\n", optarg);
+					return 1;
+				}
+				hashing = true;
+				break;
+			case 'r':
+				depth = atoi(optarg);
+				break;
+			case 'd':
+				delta_path = optarg;
+				break;
+			case 'o':
+				target_path = optarg;
+				break;
+			case 'D':
+				direct = true;
+				break;
 			default:
 				usage();
 				return 1;
@@ -156,15 +715,117 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 
+	/* the file target has a write path of its own */
+	if (target_path && (depth > 0 || inst_log)) {
+		fprintf(stderr, "-r and -i cannot be combined with -o\n");
+		usage();
+		return 1;
+	}
+	if (direct && !target_path) {
+		fprintf(stderr, "-D requires -o\n");
+		usage();
+		return 1;
+	}
+	/* verifying never writes the target */
+	if (verify && (inplace || batch || bundle_path || target_path || direct || depth > 0)) {
+		fprintf(stderr, "-v cannot be combined with -p, -b, -B, -o, -D or -r\n");
+		usage();
+		return 1;
+	}
+	/* batch, bundle and in-place mode neither hash nor chain their targets */
+	if ((batch || bundle_path || inplace) && (hashing || chain_cnt > 0)) {
+		fprintf(stderr, "-H and -c cannot be combined with -b, -B or -p\n");
+		usage();
+		return 1;
+	}
+
+	if (bundle_path) {
+		if (argc != optind + 2) {
+			usage();
+			return 1;
+		}
+		if (workers < 1) workers = 1;
+		return apply_bundle(bundle_path, argv[optind], argv[optind + 1], workers, bundle_memory);
+	}
+
+	if (batch) {
+		if (argc <= optind + 1) {
+			usage();
+			return 1;
+		}
+		if (workers < 1) workers = 1;
+		return apply_batch(argv[optind], &argv[optind + 1], argc - optind - 1, workers);
+	}
+
+	FILE *delta = stdin;
+	if (delta_path) {
+		delta = fopen(delta_path, "r");
+		if (delta == NULL) {
+			perror("Cannot open delta_path");
+			return 1;
+		}
+	}
+
+	if (inplace) {
+		int rc = apply_inplace(argv[optind], delta, scratch_size, log_interval > 0);
+		fclose(delta);
+		return rc;
+	}
+
 	FILE *source = fopen(argv[optind], "r");
 	if (source == NULL) {
 		perror("Cannot open source_path");
+		fclose(delta);
 		return 1;
 	}
 
-	int rc = apply_delta(stdin, source, stdout, log_interval, inst_log);
+	const vcdiff_driver_t *driver = &source_driver;
+	void *dev = (void *) source;
+	struct chain *chain = NULL;
+	if (chain_cnt > 0) {
+		chain = chain_create(driver, dev, chain_cache_size);
+		if (chain == NULL) {
+			perror("Cannot create chain");
+			fclose(source);
+			fclose(delta);
+			return 1;
+		}
+		for (size_t i = 0; i < chain_cnt; i++) {
+			int rc = chain_append(chain, chain_paths[i]);
+			if (rc < 0) {
+				fprintf(stderr, "Cannot add %s to chain: %s\n", chain_paths[i],
+					(rc == -EFBIG) ? "window exceeds cache size" : strerror(-rc));
+				chain_destroy(chain);
+				fclose(source);
+				fclose(delta);
+				return 1;
+			}
+		}
+		driver = &chain_driver;
+		dev = chain_dev(chain);
+	}
+
+	int rc;
+	if (verify) {
+		if (argc <= optind + 1) {
+			usage();
+			rc = 1;
+		} else {
+			rc = verify_delta(delta, driver, dev, argv[optind + 1], hashing ? &hash : NULL);
+		}
+	} else if (target_path) {
+		rc = apply_file(delta, driver, dev, target_path, direct, log_interval > 0, hashing ? &hash : NULL);
+	} else {
+		rc = apply_delta(delta, driver, dev, stdout, log_interval, inst_log, hashing ? &hash : NULL, depth);
+	}
+
+	if (chain) {
+		if (log_interval) chain_print_stats(chain);
+		chain_destroy(chain);
+	}
 
 	fclose(source);
+	fclose(delta);
 
 	return rc;
 }
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vcdiff/validate.h"
+
+/*
+ * Validates a delta without touching source or target and reports what
+ * applying it would cause.
+ */
+
+/* on error, data is NULL and len 0 */
+static int _read_file (uint8_t **data, size_t *len, const char *path) {
+	*data = NULL;
+	*len = 0;
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return -errno;
+
+	size_t cap = 64 * 1024;
+	size_t n;
+	int rc = 0;
+	do {
+		if (*data == NULL || *len == cap) {
+			if (*data) cap *= 2;
+			uint8_t *buf = realloc(*data, cap);
+			if (buf == NULL) {
+				rc = -ENOMEM;
+				break;
+			}
+			*data = buf;
+		}
+		n = fread(*data + *len, 1, cap - *len, f);
+		*len += n;
+	} while (n > 0);
+
+	if (rc == 0 && ferror(f)) rc = -EIO;
+	fclose(f);
+	if (rc < 0) {
+		free(*data);
+		*data = NULL;
+		*len = 0;
+	}
+	return rc;
+}
+
+static double _percent (vcdiff_off_t part, vcdiff_off_t total) {
+	return total ? 100.0 * part / total : 0.0;
+}
+
+static void usage (void) {
+	fprintf(stderr, "Usage: vcdiff-inspect [-s source_path | -l source_len] delta_path\n");
+	fprintf(stderr, "Validates the delta without any IO on source or target and prints statistics.\n");
+	fprintf(stderr, "  -s <source_path> Check source segments against the size of this file\n");
+	fprintf(stderr, "  -l <source_len>  Check source segments against this length in byte\n");
+}
+
+int main (int argc, char *argv[]) {
+	static vcdiff_validate_t val;
+	vcdiff_off_t source_len = VCDIFF_OFF_MAX;
+	uint8_t *delta;
+	size_t delta_len;
+	struct stat st;
+	int opt;
+	int rc;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+			case 's':
+				if (stat(optarg, &st) < 0) {
+					perror("Cannot stat source_path");
+					return 1;
+				}
+				source_len = st.st_size;
+				break;
+			case 'l':
+				source_len = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (argc != optind + 1) {
+		usage();
+		return 1;
+	}
+
+	rc = _read_file(&delta, &delta_len, argv[optind]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", argv[optind], strerror(-rc));
+		return 1;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = vcdiff_validate(&val, delta, delta_len, source_len);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (rc < 0) {
+		printf("INVALID OFFSET=%zu: %s\n", val.error_offset, val.error_msg);
+		free(delta);
+		return 1;
+	}
+
+	size_t insts = val.add_cnt + val.run_cnt + val.copy_cnt;
+	printf("VALID DELTA=%zuB WINDOWS=%zu TARGET=%" VCDIFF_PRIoff "B TIME=%.3fms THROUGHPUT=%.1fMB/s\n",
+		delta_len, val.windows, val.target_len, seconds * 1000,
+		(seconds > 0) ? delta_len / seconds / (1024 * 1024) : 0.0);
+	printf("ADD  CNT=%zu (%.1f%%) BYTES=%" VCDIFF_PRIoff " (%.1f%%)\n",
+		val.add_cnt, _percent(val.add_cnt, insts), val.add_bytes, _percent(val.add_bytes, val.target_len));
+	printf("RUN  CNT=%zu (%.1f%%) BYTES=%" VCDIFF_PRIoff " (%.1f%%)\n",
+		val.run_cnt, _percent(val.run_cnt, insts), val.run_bytes, _percent(val.run_bytes, val.target_len));
+	printf("COPY CNT=%zu (%.1f%%) BYTES=%" VCDIFF_PRIoff " (%.1f%%)\n",
+		val.copy_cnt, _percent(val.copy_cnt, insts), val.copy_bytes, _percent(val.copy_bytes, val.target_len));
+	printf("SOURCE SEEKS=%zu SEEK_DISTANCE=%" VCDIFF_PRIoff "B AVG_READ=%" VCDIFF_PRIoff "B\n",
+		val.source_seeks, val.source_seek_bytes,
+		val.source_seeks ? val.source_read_bytes / val.source_seeks : val.source_read_bytes);
+	printf("IO ERASE=%" VCDIFF_PRIoff "B WRITE=%" VCDIFF_PRIoff "B SOURCE_READ=%" VCDIFF_PRIoff "B TARGET_READ=%" VCDIFF_PRIoff "B\n",
+		val.target_len, val.target_len, val.source_read_bytes, val.target_read_bytes);
+
+	free(delta);
+
+	return 0;
+}
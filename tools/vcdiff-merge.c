@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include "vcdiff/parse.h"
+#include "vcdiff/codetable.h"
+#include "emit.h"
+#include "map.h"
+
+/*
+ * Composes the deltas A->B and B->C into a single delta A->C.
+ *
+ * The instructions of both deltas are turned into maps describing how
+ * every range of B (resp. C) is produced. COPYs from B are rewritten by
+ * looking up the producing instructions of the first delta. Neither B nor
+ * C is reconstructed; memory consumption is proportional to the deltas.
+ */
+
+static int _compose (struct emit_buf *out_buf, const struct map *map_b, const uint8_t *delta, size_t delta_len) {
+	static vcdiff_cache_t cache;
+	static vcdiff_codetable_t codetable;
+	vcdiff_parser_t parser;
+	vcdiff_window_t win;
+	vcdiff_inst_t inst;
+	struct map map_c = {.prev = map_b};
+	struct emit_window out = {0};
+	size_t target_offset = 0;
+	int rc;
+
+	emit_header(out_buf);
+
+	vcdiff_parser_init(&parser, &cache, &codetable, delta, delta_len);
+	rc = vcdiff_parse_header(&parser);
+	while (rc == 0 && (rc = vcdiff_parse_window(&parser, &win)) > 0) {
+		out.cnt = 0;
+		out.target_offset = target_offset;
+		out.pos = target_offset;
+
+		while ((rc = vcdiff_parse_inst(&parser, &inst)) > 0) {
+			size_t offset = target_offset + inst.window_pos;
+			if (inst.inst == VCDIFF_INST_ADD) {
+				emit_inst(&out, EMIT_ADD, inst.size, 0, inst.data);
+				map_add(&map_c, MAP_ADD, offset, inst.size, 0, inst.data);
+			} else if (inst.inst == VCDIFF_INST_RUN) {
+				emit_inst(&out, EMIT_RUN, inst.size, inst.data[0], NULL);
+				map_add(&map_c, MAP_RUN, offset, inst.size, inst.data[0], NULL);
+			} else if (inst.addr >= win.segment_len) {
+				/* copies inside the window are kept as they are */
+				size_t src = target_offset + inst.addr - win.segment_len;
+				emit_inst(&out, EMIT_COPY_TARGET, inst.size, src, NULL);
+				map_add(&map_c, MAP_COPY_SAME, offset, inst.size, src, NULL);
+			} else if (win.indicator & VCDIFF_VCD_SOURCE) {
+				size_t src = win.segment_pos + inst.addr;
+				rc = map_resolve(map_b, src, inst.size, &out, NULL, NULL);
+				map_add(&map_c, MAP_COPY_PREV, offset, inst.size, src, NULL);
+			} else {
+				size_t src = win.segment_pos + inst.addr;
+				rc = map_resolve(&map_c, src, inst.size, &out, NULL, NULL);
+				map_add(&map_c, MAP_COPY_SAME, offset, inst.size, src, NULL);
+			}
+			if (rc < 0) break;
+		}
+		if (rc < 0) break;
+
+		emit_window(out_buf, &out, win.window_len);
+		target_offset += win.window_len;
+	}
+
+	if (rc < 0 && parser.error_msg) {
+		fprintf(stderr, "Cannot parse second delta: %s\n", parser.error_msg);
+	}
+
+	free(out.insts);
+	map_free(&map_c);
+
+	return rc;
+}
+
+static int _read_file (struct emit_buf *buf, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return -errno;
+
+	uint8_t chunk[64 * 1024];
+	size_t len;
+	while ((len = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		emit_buf_append(buf, chunk, len);
+	}
+
+	int rc = ferror(f) ? -EIO : 0;
+	fclose(f);
+	return rc;
+}
+
+static void usage (void) {
+	fprintf(stderr, "Usage: vcdiff-merge delta_a_b delta_b_c\n");
+	fprintf(stderr, "Composes both deltas into one delta from A to C.\n");
+	fprintf(stderr, "STDOUT: merged delta file. STDERR: logging.\n");
+}
+
+int main (int argc, char *argv[]) {
+	struct emit_buf delta_ab = {0};
+	struct emit_buf delta_bc = {0};
+	struct emit_buf delta_ac = {0};
+	struct map map_b = {0};
+	int rc;
+
+	if (argc != 3) {
+		usage();
+		return 1;
+	}
+
+	rc = _read_file(&delta_ab, argv[1]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", argv[1], strerror(-rc));
+		return 1;
+	}
+
+	rc = _read_file(&delta_bc, argv[2]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot read %s: %s\n", argv[2], strerror(-rc));
+		return 1;
+	}
+
+	const char *error_msg;
+	rc = map_build(&map_b, delta_ab.data, delta_ab.len, &error_msg);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot parse first delta: %s\n", error_msg);
+	} else {
+		rc = _compose(&delta_ac, &map_b, delta_bc.data, delta_bc.len);
+	}
+
+	if (rc == 0) {
+		fwrite(delta_ac.data, 1, delta_ac.len, stdout);
+		fprintf(stderr, "IN=%zuB+%zuB OUT=%zuB PIECES=%zu\n", delta_ab.len, delta_bc.len, delta_ac.len, map_b.cnt);
+	}
+
+	map_free(&map_b);
+	free(delta_ab.data);
+	free(delta_bc.data);
+	free(delta_ac.data);
+
+	return (rc < 0) ? 1 : 0;
+}
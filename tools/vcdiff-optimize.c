@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "vcdiff.h"
+#include "vcdiff/parse.h"
+#include "vcdiff/validate.h"
+#include "batch.h"
+#include "emit.h"
+#include "map.h"
+
+/*
+ * Rewrites a delta into an equivalent one that is cheaper to apply.
+ *
+ * The delta is applied once to reconstruct the target, so every byte a
+ * COPY produces is known. COPYs of a single repeated byte become RUNs, and
+ * COPYs too short to pay for their driver calls and source seek become ADDs
+ * merging with their neighbours. Long runs inside ADDs are split off. The
+ * target is cut into new windows, e.g. one per erase block. COPYs from the
+ * target before the start of a window are resolved to the instructions that
+ * produced the data in the first place.
+ */
+
+/* costs in units of one delta byte */
+struct cost {
+	double call;            /**< Driver call */
+	double seek;            /**< Source COPY not continuing the previous one */
+};
+
+struct optimizer {
+	const struct map *map;
+	const uint8_t *target;  /**< Reconstructed target */
+	struct cost cost;
+	struct emit_window out;
+	size_t source_pos;      /**< End of the last emitted source COPY */
+	size_t copies_replaced;
+	size_t runs_found;
+};
+
+static int _decode (const struct batch_map *source, const uint8_t *delta, size_t delta_len, struct batch_map *target, double *seconds) {
+	static vcdiff_t ctx;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	vcdiff_init(&ctx);
+	vcdiff_set_source_driver(&ctx, &batch_mem_driver, (void *) source);
+	vcdiff_set_target_driver(&ctx, &batch_mem_driver, (void *) target);
+	int rc = vcdiff_apply_delta(&ctx, delta, delta_len);
+	if (rc == 0) rc = vcdiff_finish(&ctx);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (rc < 0) {
+		fprintf(stderr, "Cannot apply delta: %s\n", vcdiff_error_str(&ctx));
+		return rc;
+	}
+
+	*seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return 0;
+}
+
+static size_t _run_len (const uint8_t *data, size_t len) {
+	size_t n = 1;
+	while (n < len && data[n] == data[0]) n++;
+	return n;
+}
+
+static void _emit_add (struct optimizer *opt, size_t offset, size_t len) {
+	const uint8_t *data = &opt->target[offset];
+
+	/* splitting a run off costs up to two more writes */
+	size_t run_min = (size_t) (2 * opt->cost.call) + 2;
+	size_t start = 0;
+	for (size_t i = 0; i < len; ) {
+		size_t n = _run_len(&data[i], len - i);
+		if (n >= run_min || (n == len && n > 1)) {
+			emit_inst(&opt->out, EMIT_ADD, i - start, 0, &data[start]);
+			emit_inst(&opt->out, EMIT_RUN, n, data[i], NULL);
+			opt->runs_found++;
+			start = i + n;
+		}
+		i += n;
+	}
+	emit_inst(&opt->out, EMIT_ADD, len - start, 0, &data[start]);
+}
+
+static void _emit_copy (struct optimizer *opt, uint8_t kind, size_t offset, size_t len, size_t src);
+
+/* emits resolved target data with the same rules as the window itself */
+static int _resolve_piece (void *ctx, const struct map *map, const struct map_piece *p, size_t k, size_t n) {
+	struct optimizer *opt = (struct optimizer *) ctx;
+	(void) map;
+
+	switch (p->kind) {
+		case MAP_ADD:
+			_emit_add(opt, p->offset + k, n);
+			return 0;
+		case MAP_COPY_PREV:
+			_emit_copy(opt, EMIT_COPY_SOURCE, p->offset + k, n, p->arg + k);
+			return 0;
+		case MAP_COPY_SAME:
+			if (p->len <= p->offset - p->arg || _run_len(&opt->target[p->offset + k], n) == n) {
+				_emit_copy(opt, EMIT_COPY_TARGET, p->offset + k, n, p->arg + k);
+				return 0;
+			}
+			break;
+	}
+
+	return MAP_RESOLVE;
+}
+
+static void _emit_copy (struct optimizer *opt, uint8_t kind, size_t offset, size_t len, size_t src) {
+	const uint8_t *data = &opt->target[offset];
+
+	if (_run_len(data, len) == len) {
+		emit_inst(&opt->out, EMIT_RUN, len, data[0], NULL);
+		opt->copies_replaced++;
+		return;
+	}
+
+	/* an ADD saves the read and possibly a seek, but carries the data */
+	double saved = opt->cost.call;
+	if (kind == EMIT_COPY_SOURCE && src != opt->source_pos) saved += opt->cost.seek;
+	if (len < saved) {
+		_emit_add(opt, offset, len);
+		opt->copies_replaced++;
+		return;
+	}
+
+	if (kind == EMIT_COPY_SOURCE) {
+		emit_inst(&opt->out, EMIT_COPY_SOURCE, len, src, NULL);
+		opt->source_pos = src + len;
+	} else if (src >= opt->out.target_offset) {
+		emit_inst(&opt->out, EMIT_COPY_TARGET, len, src, NULL);
+	} else {
+		/* data before the window is out of reach */
+		size_t before = opt->out.target_offset - src;
+		if (before > len) before = len;
+		map_resolve(opt->map, src, before, &opt->out, _resolve_piece, opt);
+		if (len > before) _emit_copy(opt, EMIT_COPY_TARGET, offset + before, len - before, src + before);
+	}
+}
+
+static void _optimize_window (struct optimizer *opt, struct emit_buf *out_buf, size_t from, size_t until) {
+	opt->out.cnt = 0;
+	opt->out.target_offset = from;
+	opt->out.pos = from;
+
+	for (size_t i = map_find(opt->map, from); i < opt->map->cnt && opt->map->pieces[i].offset < until; i++) {
+		const struct map_piece *p = &opt->map->pieces[i];
+		size_t start = (p->offset > from) ? p->offset : from;
+		size_t end = (p->offset + p->len < until) ? p->offset + p->len : until;
+		size_t k = start - p->offset;
+
+		switch (p->kind) {
+			case MAP_ADD:
+				_emit_add(opt, start, end - start);
+				break;
+			case MAP_RUN:
+				emit_inst(&opt->out, EMIT_RUN, end - start, p->arg, NULL);
+				break;
+			case MAP_COPY_PREV:
+				_emit_copy(opt, EMIT_COPY_SOURCE, start, end - start, p->arg + k);
+				break;
+			case MAP_COPY_SAME:
+				_emit_copy(opt, EMIT_COPY_TARGET, start, end - start, p->arg + k);
+				break;
+		}
+	}
+
+	emit_window(out_buf, &opt->out, until - from);
+}
+
+/* predicted cost of applying a delta: every window erases the target, every
+ * ADD and RUN writes it, every COPY reads and writes; on top of that come the
+ * seeks and the delta itself */
+static double _cost (const vcdiff_validate_t *val, size_t delta_len, const struct cost *cost) {
+	size_t calls = val->windows + val->add_cnt + val->run_cnt + 2 * val->copy_cnt;
+	return delta_len + calls * cost->call + val->source_seeks * cost->seek;
+}
+
+static void usage (void) {
+	fprintf(stderr, "Usage: vcdiff-optimize [-b <size>] [-c <cost>] [-k <cost>] [-n <rounds>] source_path delta_path\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -b <size>       Window size in KiB, e.g. the erase block size of the target (default: keep windows)\n");
+	fprintf(stderr, "  -c <cost>       Cost of a driver call in delta bytes (default: 16)\n");
+	fprintf(stderr, "  -k <cost>       Cost of a source seek in delta bytes (default: 64)\n");
+	fprintf(stderr, "  -n <rounds>     Apply both deltas that often to measure the speedup (default: 5)\n");
+	fprintf(stderr, "STDOUT: optimised delta file, or the input delta if the rewrite is not faster. STDERR: logging.\n");
+}
+
+int main (int argc, char *argv[]) {
+	static vcdiff_validate_t val_in, val_out;
+	struct optimizer opt = {.cost = {.call = 16, .seek = 64}};
+	struct batch_map source, delta;
+	struct map map = {0};
+	struct emit_buf out_buf = {0};
+	struct batch_map target_in, target_out;
+	size_t window_size = 0;
+	unsigned rounds = 5;
+	int opt_char;
+	int rc;
+
+	while ((opt_char = getopt(argc, argv, "b:c:k:n:")) != -1) {
+		switch (opt_char) {
+			case 'b':
+				window_size = (size_t) atoi(optarg) * 1024;
+				break;
+			case 'c':
+				opt.cost.call = atof(optarg);
+				break;
+			case 'k':
+				opt.cost.seek = atof(optarg);
+				break;
+			case 'n':
+				rounds = atoi(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (argc != optind + 2 || rounds == 0) {
+		usage();
+		return 1;
+	}
+
+	rc = batch_map_file(&source, argv[optind]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(-rc));
+		return 1;
+	}
+
+	rc = batch_map_file(&delta, argv[optind + 1]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", argv[optind + 1], strerror(-rc));
+		return 1;
+	}
+
+	if (vcdiff_validate(&val_in, delta.data, delta.len, source.len) < 0) {
+		fprintf(stderr, "Invalid delta at offset %zu: %s\n", val_in.error_offset, val_in.error_msg);
+		return 1;
+	}
+
+	/* reconstruct the target */
+	double seconds_in, seconds_out, seconds;
+	uint8_t *data_in = malloc(val_in.target_len + 1);
+	uint8_t *data_out = malloc(val_in.target_len + 1);
+	target_in = (struct batch_map) {.data = data_in, .len = val_in.target_len};
+	target_out = (struct batch_map) {.data = data_out, .len = val_in.target_len};
+	if (data_in == NULL || data_out == NULL) {
+		perror("Out of memory");
+		return 1;
+	}
+	if (_decode(&source, delta.data, delta.len, &target_in, &seconds_in) < 0) return 1;
+	const char *error_msg;
+	if (map_build(&map, delta.data, delta.len, &error_msg) < 0) {
+		fprintf(stderr, "Cannot parse delta: %s\n", error_msg);
+		return 1;
+	}
+
+	/* rewrite */
+	opt.map = &map;
+	opt.target = target_in.data;
+	emit_header(&out_buf);
+	if (window_size > 0) {
+		for (size_t from = 0; from < target_in.len; from += window_size) {
+			size_t until = (target_in.len - from > window_size) ? from + window_size : target_in.len;
+			_optimize_window(&opt, &out_buf, from, until);
+		}
+	} else {
+		size_t from = 0;
+		for (size_t i = 0; i < map.window_cnt; i++) {
+			_optimize_window(&opt, &out_buf, from, from + map.windows[i]);
+			from += map.windows[i];
+		}
+	}
+
+	/* the result must produce the very same target */
+	if (vcdiff_validate(&val_out, out_buf.data, out_buf.len, source.len) < 0) {
+		fprintf(stderr, "Optimised delta is invalid at offset %zu: %s\n", val_out.error_offset, val_out.error_msg);
+		return 1;
+	}
+	memset(data_out, 0, target_out.len);
+	if (_decode(&source, out_buf.data, out_buf.len, &target_out, &seconds_out) < 0) return 1;
+	if (val_out.target_len != val_in.target_len || memcmp(target_in.data, target_out.data, target_in.len)) {
+		fprintf(stderr, "Optimised delta produces a different target\n");
+		return 1;
+	}
+
+	/* take the fastest of all rounds */
+	for (unsigned i = 1; i < rounds; i++) {
+		if (_decode(&source, delta.data, delta.len, &target_in, &seconds) < 0) return 1;
+		if (seconds < seconds_in) seconds_in = seconds;
+		if (_decode(&source, out_buf.data, out_buf.len, &target_out, &seconds) < 0) return 1;
+		if (seconds < seconds_out) seconds_out = seconds;
+	}
+
+	/* a rewrite that is slower by the model or the clock is of no use */
+	double cost_in = _cost(&val_in, delta.len, &opt.cost);
+	double cost_out = _cost(&val_out, out_buf.len, &opt.cost);
+	bool faster = cost_out < cost_in && seconds_out < seconds_in;
+	if (faster) {
+		fwrite(out_buf.data, 1, out_buf.len, stdout);
+	} else {
+		fwrite(delta.data, 1, delta.len, stdout);
+	}
+
+	fprintf(stderr, "IN=%zuB OUT=%zuB WINDOWS=%zu->%zu INSTS=%zu->%zu SEEKS=%zu->%zu COPIES_REPLACED=%zu RUNS_FOUND=%zu\n",
+		delta.len, out_buf.len, val_in.windows, val_out.windows,
+		val_in.add_cnt + val_in.run_cnt + val_in.copy_cnt, val_out.add_cnt + val_out.run_cnt + val_out.copy_cnt,
+		val_in.source_seeks, val_out.source_seeks, opt.copies_replaced, opt.runs_found);
+	fprintf(stderr, "PREDICTED_SPEEDUP=%.2f MEASURED_SPEEDUP=%.2f TIME=%.3fms->%.3fms\n",
+		cost_in / cost_out, (seconds_out > 0) ? seconds_in / seconds_out : 0.0, seconds_in * 1000, seconds_out * 1000);
+	if (!faster) {
+		fprintf(stderr, "Optimised delta is not faster, kept the input delta\n");
+	}
+
+	free(opt.out.insts);
+	map_free(&map);
+	free(out_buf.data);
+	free(data_in);
+	free(data_out);
+	batch_unmap_file(&delta);
+	batch_unmap_file(&source);
+
+	return 0;
+}
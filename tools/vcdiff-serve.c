@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "vcdiff.h"
+#include "batch.h"
+
+#if VCDIFF_BUFFER_SIZE > 0
+# error "Build with VCDIFF_BUFFER_SIZE=0: every stream brings its own buffer"
+#endif
+
+#define MAX_EVENTS 64
+
+/* one connection: the delta comes in, the target goes back out */
+struct stream {
+	int fd;
+	vcdiff_t ctx;
+	uint8_t *buffer;          /**< Decoder buffer */
+
+	uint8_t *in;              /**< Received delta data not consumed yet */
+	size_t in_len;
+	size_t in_pos;
+	bool eof;
+
+	size_t sent;              /**< Target bytes written to the socket */
+	bool yielded;             /**< The decoder stopped within an instruction */
+	size_t delta_len;
+	size_t yields;
+};
+
+static struct {
+	int epfd;
+	struct batch_map source;
+	size_t buffer_size;
+	size_t in_size;
+	size_t budget;
+	size_t streams;
+	size_t max_streams;
+} server;
+
+static int _target_write (void *dev, uint8_t *src, vcdiff_off_t offset, size_t len) {
+	struct stream *s = (struct stream *) dev;
+
+	/* a retried chunk may have been sent partially */
+	if (offset > s->sent || s->sent - offset >= len) {
+		/* Gapped write not supported! */
+		return -ENOTSUP;
+	}
+	size_t skip = s->sent - offset;
+
+	ssize_t n = send(s->fd, src + skip, len - skip, MSG_NOSIGNAL);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) n = 0;
+	if (n < 0) return -errno;
+
+	s->sent += n;
+	if ((size_t) n < len - skip) return VCDIFF_AGAIN;
+
+	return 0;
+}
+
+static int _target_read (void *dev, uint8_t *dest, vcdiff_off_t offset, size_t len) {
+	(void) dev;
+	(void) dest;
+	(void) offset;
+	(void) len;
+
+	/* data sent to the socket is gone! */
+	return -ENOTSUP;
+}
+
+static const vcdiff_driver_t target_driver = {
+	.read = _target_read,
+	.write = _target_write
+};
+
+static void stream_close (struct stream *s, const char *error_msg) {
+	if (error_msg) {
+		fprintf(stderr, "FAIL fd=%d: %s\n", s->fd, error_msg);
+	} else {
+		fprintf(stderr, "OK   fd=%d IN=%zuB OUT=%zuB YIELDS=%zu\n", s->fd, s->delta_len, s->sent, s->yields);
+	}
+
+	epoll_ctl(server.epfd, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	free(s->buffer);
+	free(s->in);
+	free(s);
+	server.streams--;
+}
+
+static int stream_watch (struct stream *s, uint32_t events) {
+	struct epoll_event ev = {.events = events, .data.ptr = s};
+	return epoll_ctl(server.epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+/* decodes as far as the received data and the socket allow */
+static void stream_progress (struct stream *s) {
+	while (1) {
+		/* a yielded instruction may continue without further delta data */
+		while (s->in_pos < s->in_len || s->yielded) {
+			size_t consumed;
+			int rc = vcdiff_apply_delta_budget(&s->ctx, s->in + s->in_pos, s->in_len - s->in_pos, server.budget, &consumed);
+			s->in_pos += consumed;
+			s->yielded = (rc == VCDIFF_YIELD);
+			if (rc < 0) {
+				stream_close(s, vcdiff_error_str(&s->ctx));
+				return;
+			}
+			if (s->yielded) {
+				/* blocked or out of budget: continue once the socket is writable */
+				s->yields++;
+				stream_watch(s, EPOLLOUT);
+				return;
+			}
+		}
+
+		if (s->eof) {
+			if (vcdiff_finish(&s->ctx) < 0) {
+				stream_close(s, vcdiff_error_str(&s->ctx));
+			} else {
+				shutdown(s->fd, SHUT_WR);
+				stream_close(s, NULL);
+			}
+			return;
+		}
+
+		/* only read more delta data once the previous chunk has been consumed */
+		ssize_t n = recv(s->fd, s->in, server.in_size, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			stream_watch(s, EPOLLIN);
+			return;
+		}
+		if (n < 0) {
+			stream_close(s, strerror(errno));
+			return;
+		}
+		s->in_pos = 0;
+		s->in_len = n;
+		s->delta_len += n;
+		if (n == 0) s->eof = true;
+	}
+}
+
+static void stream_accept (int listen_fd) {
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) return;
+
+	if (server.streams >= server.max_streams) {
+		close(fd);
+		return;
+	}
+
+	struct stream *s = calloc(1, sizeof(*s));
+	if (s) s->buffer = malloc(server.buffer_size);
+	if (s) s->in = malloc(server.in_size);
+	if (s == NULL || s->buffer == NULL || s->in == NULL) {
+		if (s) {
+			free(s->buffer);
+			free(s->in);
+		}
+		free(s);
+		close(fd);
+		return;
+	}
+
+	s->fd = fd;
+	vcdiff_init(&s->ctx);
+	vcdiff_set_buffer(&s->ctx, s->buffer, server.buffer_size);
+	vcdiff_set_source_driver(&s->ctx, &batch_mem_driver, (void *) &server.source);
+	vcdiff_set_target_driver(&s->ctx, &target_driver, (void *) s);
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+	if (epoll_ctl(server.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		free(s->buffer);
+		free(s->in);
+		free(s);
+		close(fd);
+		return;
+	}
+	server.streams++;
+}
+
+static void usage (void) {
+	fprintf(stderr, "Usage: vcdiff-serve [-B <size>] [-I <size>] [-q <size>] [-n <streams>] source_path socket_path\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -B <size>       Decoder buffer size in KiB per stream (default: 4)\n");
+	fprintf(stderr, "  -I <size>       Receive buffer size in KiB per stream (default: 4)\n");
+	fprintf(stderr, "  -q <size>       Target KiB decoded per stream before others get their turn (default: 64)\n");
+	fprintf(stderr, "  -n <streams>    Maximum amount of concurrent streams (default: 1024)\n");
+	fprintf(stderr, "Every connection to the UNIX socket sends a delta against source_path and shuts down\n");
+	fprintf(stderr, "its sending side. The target is sent back on the same connection while it is decoded.\n");
+}
+
+int main (int argc, char *argv[]) {
+	int opt;
+
+	server.buffer_size = 4 * 1024;
+	server.in_size = 4 * 1024;
+	server.budget = 64 * 1024;
+	server.max_streams = 1024;
+
+	while ((opt = getopt(argc, argv, "B:I:q:n:")) != -1) {
+		switch (opt) {
+			case 'B':
+				server.buffer_size = (size_t) atoi(optarg) * 1024;
+				break;
+			case 'I':
+				server.in_size = (size_t) atoi(optarg) * 1024;
+				break;
+			case 'q':
+				server.budget = (size_t) atoi(optarg) * 1024;
+				break;
+			case 'n':
+				server.max_streams = atoi(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (argc < optind + 2 || server.buffer_size == 0 || server.in_size == 0 || server.budget == 0) {
+		usage();
+		return 1;
+	}
+
+	int rc = batch_map_file(&server.source, argv[optind]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot map source_path: %s\n", strerror(-rc));
+		return 1;
+	}
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(argv[optind + 1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket_path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[optind + 1]);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+		perror("Cannot listen on socket_path");
+		return 1;
+	}
+
+	server.epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if (server.epfd < 0 || epoll_ctl(server.epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+		perror("Cannot create event loop");
+		return 1;
+	}
+
+	fprintf(stderr, "LISTEN %s CONTEXT=%zuB BUFFERS=%zuB\n", argv[optind + 1], sizeof(struct stream), server.buffer_size + server.in_size);
+
+	while (1) {
+		struct epoll_event events[MAX_EVENTS];
+		int cnt = epoll_wait(server.epfd, events, MAX_EVENTS, -1);
+		if (cnt < 0 && errno == EINTR) continue;
+		if (cnt < 0) {
+			perror("epoll_wait");
+			return 1;
+		}
+
+		for (int i = 0; i < cnt; i++) {
+			if (events[i].data.ptr == NULL) {
+				stream_accept(listen_fd);
+			} else {
+				stream_progress((struct stream *) events[i].data.ptr);
+			}
+		}
+	}
+
+	return 0;
+}